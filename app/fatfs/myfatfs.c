@@ -27,6 +27,7 @@ static sint32_t myfatfs_tell( const struct vfs_file *fd );
 static sint32_t myfatfs_flush( const struct vfs_file *fd );
 static uint32_t myfatfs_fsize( const struct vfs_file *fd );
 static sint32_t myfatfs_ferrno( const struct vfs_file *fd );
+static uint32_t myfatfs_pagesize( const struct vfs_file *fd );
 
 static sint32_t  myfatfs_closedir( const struct vfs_dir *dd );
 static sint32_t  myfatfs_readdir( const struct vfs_dir *dd, struct vfs_stat *buf );
@@ -60,6 +61,9 @@ static vfs_fs_fns myfatfs_fs_fns = {
   .mkdir    = myfatfs_mkdir,
   .fsinfo   = myfatfs_fsinfo,
   .fscfg    = NULL,
+  .fsgc     = NULL,
+  .fscache  = NULL,
+  .fsstats  = NULL,
   .format   = NULL,
   .chdrive  = myfatfs_chdrive,
   .chdir    = myfatfs_chdir,
@@ -76,7 +80,8 @@ static vfs_file_fns myfatfs_file_fns = {
   .tell      = myfatfs_tell,
   .flush     = myfatfs_flush,
   .size      = myfatfs_fsize,
-  .ferrno    = myfatfs_ferrno
+  .ferrno    = myfatfs_ferrno,
+  .pagesize  = myfatfs_pagesize
 };
 
 static vfs_dir_fns myfatfs_dir_fns = {
@@ -274,6 +279,11 @@ static sint32_t myfatfs_ferrno( const struct vfs_file *fd )
   return -last_result;
 }
 
+static uint32_t myfatfs_pagesize( const struct vfs_file *fd )
+{
+  return _MAX_SS;
+}
+
 
 // ---------------------------------------------------------------------------
 // dir functions
@@ -55,6 +55,30 @@ static const char log_prefix[] = "HTTP client: ";
  */
 typedef void (* http_callback_t)(char * response_body, int http_status, char ** full_response_p);
 
+/*
+ * Streaming mode. The response body is not collected in memory but handed out
+ * as it arrives, with chunked transfer encoding already removed.
+ *
+ * "header_cb" is called once the status line and headers are in. "headers" is
+ * the raw header block including the status line. "data_cb" is then called
+ * with every piece of the body. Either one may be NULL, and either one can
+ * return false to abort the request.
+ *
+ * "done_cb" is called at the end with the headers again. "http_status" is
+ * HTTP_STATUS_GENERIC_ERROR if the request failed, was aborted or the body
+ * was cut short. Redirects are followed before any callback is called.
+ */
+typedef bool (* http_header_callback_t)(int http_status, char * headers, void * arg);
+typedef bool (* http_data_callback_t)(char * data, int len, void * arg);
+typedef void (* http_done_callback_t)(int http_status, char ** headers_p, void * arg);
+
+typedef struct http_stream_t {
+	http_header_callback_t	header_cb;
+	http_data_callback_t	data_cb;
+	http_done_callback_t	done_cb;
+	void			* arg;
+} http_stream_t;
+
 /*
  * Call this function to skip URL parsing if the arguments are already in separate variables.
  */
@@ -68,6 +92,21 @@ void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool se
  */
 void ICACHE_FLASH_ATTR http_request(const char * url, const char * method, const char * headers, const char * post_data, http_callback_t callback_handle, int redirect_follow_count);
 
+/*
+ * Same as http_request(), but in streaming mode. "stream" is copied.
+ * Returns false if the URL could not be parsed, in which case no callback is called.
+ */
+bool ICACHE_FLASH_ATTR http_stream_request(const char * url, const char * method, const char * headers, const char * post_data, const http_stream_t * stream);
+
+/*
+ * Keeps connections open for "idle_ms" after their last response, so further
+ * requests to the same host skip the connection setup. Requests to a host
+ * with a connection open are queued on it and pipelined. 0 (the default)
+ * closes every connection after its response. Returns the previous setting,
+ * a negative "idle_ms" only returns the current one.
+ */
+int ICACHE_FLASH_ATTR http_keepalive(int idle_ms);
+
 /*
  * Post data to a web form.
  * The data should be encoded as any format.
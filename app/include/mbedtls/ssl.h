@@ -593,6 +593,8 @@ struct mbedtls_ssl_config
     unsigned int dhm_min_bitlen;    /*!< min. bit length of the DHM prime   */
 #endif
 
+    size_t out_content_len;         /*!< payload size of the output buffer  */
+
     unsigned char max_major_ver;    /*!< max. major version used            */
     unsigned char max_minor_ver;    /*!< max. minor version used            */
     unsigned char min_major_ver;    /*!< min. major version used            */
@@ -700,6 +702,7 @@ struct mbedtls_ssl_context
      * Record layer (incoming data)
      */
     unsigned char *in_buf;      /*!< input buffer                     */
+    size_t in_content_len;      /*!< payload size of in_buf           */
     unsigned char *in_ctr;      /*!< 64-bit incoming message counter
                                      TLS: maintained by us
                                      DTLS: read from peer             */
@@ -731,6 +734,7 @@ struct mbedtls_ssl_context
      * Record layer (outgoing data)
      */
     unsigned char *out_buf;     /*!< output buffer                    */
+    size_t out_content_len;     /*!< payload size of out_buf          */
     unsigned char *out_ctr;     /*!< 64-bit outgoing message counter  */
     unsigned char *out_hdr;     /*!< start of record header           */
     unsigned char *out_len;     /*!< two-bytes message length field   */
@@ -1893,6 +1897,25 @@ void mbedtls_ssl_conf_arc4_support( mbedtls_ssl_config *conf, char arc4 );
 int mbedtls_ssl_conf_max_frag_len( mbedtls_ssl_config *conf, unsigned char mfl_code );
 #endif /* MBEDTLS_SSL_MAX_FRAGMENT_LENGTH */
 
+/**
+ * \brief          Set the size of the output record buffer
+ *                 (Default: MBEDTLS_SSL_MAX_CONTENT_LEN)
+ *
+ * \note           The input buffer always starts out at
+ *                 MBEDTLS_SSL_MAX_CONTENT_LEN. When a smaller maximum
+ *                 fragment length is negotiated, both buffers are shrunk to
+ *                 it at the end of the handshake.
+ *
+ * \note           Every handshake message this end sends, including its
+ *                 certificate chain, has to fit in the output buffer.
+ *
+ * \param conf     SSL configuration
+ * \param len      payload size in bytes, 512 to MBEDTLS_SSL_MAX_CONTENT_LEN
+ *
+ * \return         0 if successful or MBEDTLS_ERR_SSL_BAD_INPUT_DATA
+ */
+int mbedtls_ssl_conf_out_content_len( mbedtls_ssl_config *conf, size_t len );
+
 #if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
 /**
  * \brief          Activate negotiation of truncated HMAC
@@ -107,6 +107,8 @@ typedef struct _ssl_sector{
 struct ssl_packet{
 	uint8* pbuffer;
 	uint16 buffer_size;
+	uint16 receive_size;
+	uint16 send_size;
 	ssl_sector cert_ca_sector;
 	ssl_sector cert_req_sector;
 };
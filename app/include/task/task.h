@@ -27,9 +27,11 @@
 #define task_param_t os_param_t
 
 typedef void (*task_callback_t)(task_param_t param, uint8 prio);
+typedef void (*task_hook_t)(void);
 
 bool task_init_handler(uint8 priority, uint8 qlen);
 task_handle_t task_get_id(task_callback_t t);
+void task_set_dispatch_hook(task_hook_t hook);
 
 #endif
 
@@ -68,7 +68,12 @@ extern void luaL_assertfail(const char *file, int line, const char *message);
 #define SHA2_ENABLE
 
 #define BUILD_SPIFFS
+#ifndef SPIFFS_CACHE
 #define SPIFFS_CACHE 1
+#endif
+// Pages of 256 bytes in the SPIFFS read and write cache, at most 32; can
+// be changed with file.fscfg()
+#define SPIFFS_CACHE_PAGES 2
 
 //#define BUILD_FATFS
 
@@ -78,6 +83,21 @@ extern void luaL_assertfail(const char *file, int line, const char *message);
 // maximum number of open files for SPIFFS
 #define SPIFFS_MAX_OPEN_FILES 4
 
+// Bytes of RAM an open SPIFFS file may use to keep its object index in
+// memory, which makes seeking in large files fast. Every 2 bytes cover a
+// 251 byte page, so 1024 bytes cover about 125kB of file data. Files larger
+// than 25kB are mapped when opened read-only if the budget covers all of
+// them; 0 turns mapping off.
+#define SPIFFS_IX_MAP_BUDGET 1024
+
+// Once SPIFFS has not been used for SPIFFS_GC_IDLE_MS, a low priority task
+// erases one block at a time until SPIFFS_GC_RESERVE blocks are free, so
+// that writes seldom have to collect garbage and wait for erases themselves.
+// Writes collect when fewer than 4 blocks are free. 0 disables idle time
+// collection; both can be changed with file.fsgc().
+#define SPIFFS_GC_RESERVE 6
+#define SPIFFS_GC_IDLE_MS 200
+
 // Uncomment this next line for fastest startup 
 // It reduces the format time dramatically
 // #define SPIFFS_MAX_FILESYSTEM_SIZE	32768
@@ -91,6 +111,20 @@ extern void luaL_assertfail(const char *file, int line, const char *message);
 
 // #define LUA_NUMBER_INTEGRAL
 
+// The Lua Flash Store reserves this many bytes (a multiple of the 4K flash
+// sector size) at the end of the firmware image for precompiled Lua modules
+// that are executed directly from flash. Build the image on the host with
+// "luac.cross -f" and load it with node.flashreload(). Enabling this moves
+// the start of SPIFFS, so the file system has to be reformatted.
+// #define LUA_FLASH_STORE         0x10000
+
+// The size of the Lua string table that fits the strings alive after each
+// garbage collection can be kept in an RTC user memory slot (see the rtcmem
+// module), and the table then starts at that size on the next restart or wake
+// from deep sleep. Pick a slot that rtctime (0-9), rtcfifo and the
+// application leave alone.
+// #define LUA_STRTAB_RTC_SLOT     31
+
 #define READLINE_INTERVAL 80
 #define LUA_TASK_PRIO USER_TASK_PRIO_0
 #define LUA_PROCESS_LINE_SIG 2
@@ -328,7 +328,12 @@ LUA_API lua_Integer lua_tointeger (lua_State *L, int idx) {
   const TValue *o = index2adr(L, idx);
   if (tonumber(o, &n)) {
     lua_Integer res;
-    lua_Number num = nvalue(o);
+    lua_Number num;
+#ifdef LUA_DUALNUMBER
+    if (ttisint(o))
+      return ivalue(o);
+#endif
+    num = nvalue(o);
     lua_number2integer(res, num);
     return res;
   }
@@ -444,7 +449,12 @@ LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
 
 LUA_API void lua_pushinteger (lua_State *L, lua_Integer n) {
   lua_lock(L);
-  setnvalue(L->top, cast_num(n));
+  if (cast(lua_Integer, cast_int(n)) == n) {
+    setivalue(L->top, cast_int(n));
+  }
+  else {
+    setnvalue(L->top, cast_num(n));
+  }
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -590,10 +600,11 @@ LUA_API void lua_getfield (lua_State *L, int idx, const char *k) {
 LUA_API void lua_rawget (lua_State *L, int idx) {
   StkId t;
   const TValue *res;
+  TValue v;
   lua_lock(L);
   t = index2adr(L, idx);
   api_check(L, ttistable(t) || ttisrotable(t));
-  res = ttistable(t) ? luaH_get(hvalue(t), L->top - 1) : luaH_get_ro(rvalue(t), L->top - 1);
+  res = ttistable(t) ? luaH_get(hvalue(t), L->top - 1, &v) : luaH_get_ro(rvalue(t), L->top - 1);
   setobj2s(L, L->top - 1, res);    
   lua_unlock(L);
 }
@@ -601,10 +612,11 @@ LUA_API void lua_rawget (lua_State *L, int idx) {
 
 LUA_API void lua_rawgeti (lua_State *L, int idx, int n) {
   StkId o;
+  TValue v;
   lua_lock(L);
   o = index2adr(L, idx);
   api_check(L, ttistable(o) || ttisrotable(o));
-  setobj2s(L, L->top, ttistable(o) ? luaH_getnum(hvalue(o), n) : luaH_getnum_ro(rvalue(o), n))
+  setobj2s(L, L->top, ttistable(o) ? luaH_getnum(hvalue(o), n, &v) : luaH_getnum_ro(rvalue(o), n))
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -1021,6 +1033,17 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = cast_int(g->memlimit >> 10);
       break;
     }
+    case LUA_GCSTRCHAIN: {
+      /* length of chain `data' of the string table; -1 past its end */
+      GCObject *o;
+      res = -1;
+      if (data >= 0 && data < g->strt.size) {
+        res = 0;
+        for (o = g->strt.hash[data]; o != NULL; o = o->gch.next)
+          res++;
+      }
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
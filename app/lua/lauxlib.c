@@ -13,6 +13,7 @@
 #include C_HEADER_STDLIB
 #include C_HEADER_STRING
 #ifndef LUA_CROSS_COMPILER
+#include "platform.h"
 #include "vfs.h"
 #else
 #endif
@@ -654,6 +655,7 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
 typedef struct LoadFSF {
   int extraline;
   int f;
+  int mapped;  /* read the file through the flash cache while possible */
   char buff[LUAL_BUFFERSIZE];
 } LoadFSF;
 
@@ -671,6 +673,18 @@ static const char *getFSF (lua_State *L, void *ud, size_t *size) {
     return "\n";
   }
 
+  if (lf->mapped) {
+    /* copied, as the lexer and undump make byte loads */
+    uint32_t len = sizeof(lf->buff);
+    const char *p = vfs_map(lf->f, &len);
+    if (p) {
+      platform_flash_mapped_copy(lf->buff, p, len);
+      *size = len;
+      return lf->buff;
+    }
+    lf->mapped = 0;
+  }
+
   if (vfs_eof(lf->f)) return NULL;
   *size = vfs_read(lf->f, lf->buff, sizeof(lf->buff));
 
@@ -717,6 +731,7 @@ LUALIB_API int luaL_loadfsfile (lua_State *L, const char *filename) {
     lf.extraline = 0;
   }
   vfs_ungetc(c, lf.f);
+  lf.mapped = 1;
   status = lua_load(L, getFSF, &lf, lua_tostring(L, -1));
 
   if (filename) vfs_close(lf.f);  /* close file (even in case of errors) */
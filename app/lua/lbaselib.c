@@ -198,12 +198,16 @@ static int luaB_gcinfo (lua_State *L) {
 }
 
 
+/* chains of this length or longer are counted as one shorter */
+#define STRTAB_HISTSIZE	32
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
-    "count", "step", "setpause", "setstepmul","setmemlimit","getmemlimit", NULL};
+    "count", "step", "setpause", "setstepmul","setmemlimit","getmemlimit",
+    "strtab", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-		LUA_GCSETMEMLIMIT,LUA_GCGETMEMLIMIT};
+		LUA_GCSETMEMLIMIT,LUA_GCGETMEMLIMIT,LUA_GCSTRCHAIN};
   int o = luaL_checkoption(L, 1, "collect", opts);
   int ex = luaL_optint(L, 2, 0);
   int res = lua_gc(L, optsnum[o], ex);
@@ -217,6 +221,27 @@ static int luaB_collectgarbage (lua_State *L) {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCSTRCHAIN: {
+      /* string table size, number of strings and histogram of chain lengths;
+         counted first, as filling in the table may resize the string table */
+      int hist[STRTAB_HISTSIZE];
+      int i, len, maxlen = 0, nuse = 0;
+      for (i = 0; i < STRTAB_HISTSIZE; i++) hist[i] = 0;
+      for (i = 0; (len = lua_gc(L, LUA_GCSTRCHAIN, i)) >= 0; i++) {
+        nuse += len;
+        if (len >= STRTAB_HISTSIZE) len = STRTAB_HISTSIZE-1;
+        if (len > maxlen) maxlen = len;
+        hist[len]++;
+      }
+      lua_pushinteger(L, i);
+      lua_pushinteger(L, nuse);
+      lua_createtable(L, maxlen, 1);
+      for (len = 0; len <= maxlen; len++) {
+        lua_pushinteger(L, hist[len]);
+        lua_rawseti(L, -2, len);
+      }
+      return 3;
+    }
     default: {
       lua_pushnumber(L, res);
       return 1;
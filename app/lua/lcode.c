@@ -236,7 +236,7 @@ static int addk (FuncState *fs, TValue *k, TValue *v) {
     return cast_int(nvalue(idx));
   }
   else {  /* constant not found; create a new entry */
-    setnvalue(idx, cast_num(fs->nk));
+    setivalue(idx, fs->nk);
     luaM_growvector(L, f->k, fs->nk, f->sizek, TValue,
                     MAXARG_Bx, "constant table overflow");
     while (oldsize < f->sizek) setnilvalue(&f->k[oldsize++]);
@@ -256,7 +256,7 @@ int luaK_stringK (FuncState *fs, TString *s) {
 
 int luaK_numberK (FuncState *fs, lua_Number r) {
   TValue o;
-  setnvalue(&o, r);
+  setnumvalue(&o, r);
   return addk(fs, &o, &o);
 }
 
@@ -95,6 +95,7 @@ static void resetstack (lua_State *L, int status) {
 void luaD_throw (lua_State *L, int errcode) {
   unfixedstack(L); /* make sure the fixedstack & block_gc flags get reset. */
   unset_block_gc(L);
+  unset_resizing_tables_gc(L);
   if (L->errorJmp) {
     L->errorJmp->status = errcode;
     LUAI_THROW(L, L->errorJmp);
@@ -230,7 +231,7 @@ static StkId adjust_varargs (lua_State *L, Proto *p, int actual) {
       setobj2n(L, luaH_setnum(L, htab, i+1), L->top - 1 - nvar + i);
     unfixedstack(L);
     /* store counter in field `n' */
-    setnvalue(luaH_setstr(L, htab, luaS_newliteral(L, "n")), cast_num(nvar));
+    setivalue(luaH_setstr(L, htab, luaS_newliteral(L, "n")), nvar);
     L->top--; /* remove table from stack */
   }
 #endif
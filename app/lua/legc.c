@@ -2,7 +2,10 @@
 
 #include "legc.h"
 #include "lstate.h"
+#include "lgc.h"
 #include "c_types.h"
+#include "user_interface.h"
+#include "task/task.h"
 
 void legc_set_mode(lua_State *L, int mode, unsigned limit) {
    global_State *g = G(L); 
@@ -11,3 +14,43 @@ void legc_set_mode(lua_State *L, int mode, unsigned limit) {
    g->memlimit = limit;
 }
 
+// Time budgeted incremental collection.  After each task dispatched by the
+// task layer, and therefore between Lua callbacks, the collector is given at
+// most gc_budget microseconds of incremental steps.  While a cycle remains
+// unfinished a low priority task is kept queued, so that idle time is spent
+// finishing it rather than in steps taken inside later allocations.
+static uint32_t gc_budget;
+static task_handle_t gc_idle_task;
+static bool gc_idle_posted;
+
+static void legc_idle(task_param_t param, uint8 prio) {
+  // the work is done by the dispatch hook that runs after this task
+  gc_idle_posted = false;
+}
+
+static void legc_dispatch_hook(void) {
+  lua_State *L = lua_getstate();
+  global_State *g;
+  uint32_t start;
+
+  if (L == NULL || is_block_gc(L))
+    return;
+  g = G(L);
+  // only start a new cycle once there is something to collect
+  if (g->gcstate == GCSpause && g->totalbytes < g->estimate + LEGC_MIN_GARBAGE)
+    return;
+  start = system_get_time();
+  do {
+    g->GCthreshold = g->totalbytes;  // as lua_gc(L, LUA_GCSTEP, 0)
+    luaC_step(L);
+  } while (g->gcstate != GCSpause && system_get_time() - start < gc_budget);
+  if (g->gcstate != GCSpause && !gc_idle_posted)
+    gc_idle_posted = task_post_low(gc_idle_task, 0);
+}
+
+void legc_set_budget(lua_State *L, unsigned budget) {
+  if (!gc_idle_task)
+    gc_idle_task = task_get_id(legc_idle);
+  gc_budget = budget;
+  task_set_dispatch_hook(budget ? legc_dispatch_hook : NULL);
+}
@@ -11,7 +11,13 @@
 #define EGC_ON_MEM_LIMIT      2   // run EGC when an upper memory limit is hit
 #define EGC_ALWAYS            4   // always run EGC before an allocation
 
+// Garbage (in bytes) that must accumulate before idle time starts a new cycle
+#define LEGC_MIN_GARBAGE      1024
+// Upper limit (in microseconds) of the time budgeted GC work per task
+#define LEGC_MAX_BUDGET       10000
+
 void legc_set_mode(lua_State *L, int mode, unsigned limit);
+void legc_set_budget(lua_State *L, unsigned budget);
 
 #endif
 
@@ -0,0 +1,213 @@
+/*
+** Lua Flash Store (LFS): precompiled Lua modules executed from mapped flash
+** See Copyright Notice in lua.h
+*/
+
+#define lflash_c
+#define LUA_CORE
+#define LUAC_CROSS_FILE
+
+#include "lua.h"
+
+#if defined(LUA_FLASH_STORE) && !defined(LUA_CROSS_COMPILER)
+
+#include C_HEADER_STRING
+
+#include "lflash.h"
+#include "lfunc.h"
+#include "lobject.h"
+#include "lstate.h"
+
+#include "platform.h"
+#include "vfs.h"
+
+#if (LUA_FLASH_STORE % INTERNAL_FLASH_SECTOR_SIZE) != 0
+#error "LUA_FLASH_STORE must be a multiple of the flash sector size"
+#endif
+
+/*
+** The store itself.  The array reserves it at the end of irom0 (see
+** ld/nodemcu.ld) so that it is memory mapped with the rest of the firmware
+** and the file system starts on the first free block after it.  It is only
+** read through lua_flash_store, which the linker script defines at the same
+** address: the compiler could fold loads from the all-zero array itself,
+** whereas it knows nothing of what is flashed there.
+*/
+static const char flash_store_reserved[LUA_FLASH_STORE]
+  __attribute__((used, section(".irom0.lfs.reserved"),
+                 aligned(INTERNAL_FLASH_SECTOR_SIZE))) = {0};
+extern const char lua_flash_store[];
+#define flash_store lua_flash_store
+
+#define LFS_HEADER      ((const LFSHeader *) flash_store)
+#define LFS_ENTRIES     ((const LFSEntry *) (flash_store + sizeof(LFSHeader)))
+#define LFS_COPY_BLOCK  256
+
+
+static int lfs_valid (void) {
+  const LFSHeader *h = LFS_HEADER;
+  return h->magic == LFS_MAGIC && h->version == LFS_VERSION &&
+         h->size <= LUA_FLASH_STORE &&
+         sizeof(LFSHeader) + h->nmodules * sizeof(LFSEntry) <= h->size;
+}
+
+
+static const LFSEntry *lfs_find (const char *name) {
+  const LFSHeader *h = LFS_HEADER;
+  const LFSEntry *e = LFS_ENTRIES;
+  uint32_t i;
+  if (!lfs_valid())
+    return NULL;
+  for (i = 0; i < h->nmodules; i++, e++) {
+    if (e->name >= h->size || e->chunk + e->size > h->size || (e->chunk & 3))
+      return NULL;  /* corrupt image */
+    if (c_strcmp(flash_store + e->name, name) == 0)
+      return e;
+  }
+  return NULL;
+}
+
+
+/*
+** Reader for lua_load.  Returning the base address when called with a NULL
+** state and size switches luaU_undump into direct mode.
+*/
+typedef struct LoadLFS {
+  const char *base;
+  size_t size;
+} LoadLFS;
+
+
+static const char *getLFS (lua_State *L, void *ud, size_t *size) {
+  LoadLFS *lf = (LoadLFS *)ud;
+  if (L == NULL && size == NULL) /* direct mode check */
+    return lf->base;
+  if (lf->size == 0) return NULL;
+  *size = lf->size;
+  lf->size = 0;
+  return lf->base;
+}
+
+
+/*
+** Push the main function of module `name' from the store.  Returns 0 on
+** success, -1 with a message pushed if the module is not present, or the
+** lua_load status if the chunk could not be loaded.
+*/
+int luaN_index (lua_State *L, const char *name) {
+  const LFSEntry *e = lfs_find(name);
+  LoadLFS lf;
+  if (e == NULL) {
+    lua_pushfstring(L, "\n\tno module " LUA_QS " in flash store", name);
+    return -1;
+  }
+  lf.base = flash_store + e->chunk;
+  lf.size = e->size;
+  return lua_load(L, getLFS, &lf, name);
+}
+
+
+/*
+** Push an array of the module names in the store, followed by the image
+** size and the store size.  Returns the number of values pushed.
+*/
+int luaN_list (lua_State *L) {
+  const LFSHeader *h = LFS_HEADER;
+  const LFSEntry *e = LFS_ENTRIES;
+  uint32_t i, n = lfs_valid() ? h->nmodules : 0;
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++, e++) {
+    if (e->name >= h->size)
+      break;
+    lua_pushstring(L, flash_store + e->name);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushinteger(L, n ? h->size : 0);
+  lua_pushinteger(L, LUA_FLASH_STORE);
+  return 3;
+}
+
+
+/* Is any active Lua function of this thread executing from the store? */
+static int lfs_inuse (lua_State *L) {
+  CallInfo *ci;
+  for (ci = L->ci; ci > L->base_ci; ci--) {
+    if (isLua(ci)) {
+      const char *code = (const char *) ci_func(ci)->l.p->code;
+      if (code >= flash_store && code < flash_store + LUA_FLASH_STORE)
+        return 1;
+    }
+  }
+  return 0;
+}
+
+
+/* Copy the next block of at most left bytes of the image file to addr. */
+static const char *lfs_copy (int fd, uint32_t *buf, uint32_t addr, uint32_t left) {
+  uint32_t n = left < LFS_COPY_BLOCK ? left : LFS_COPY_BLOCK;
+  if (vfs_read(fd, buf, n) != n)
+    return "image file read failed";
+  if (platform_flash_write(buf, addr, LFS_ALIGN(n)) != LFS_ALIGN(n))
+    return "flash write failed";
+  return NULL;
+}
+
+
+/*
+** Copy an image file built by luac.cross into the store.  The image is
+** validated before anything is erased, so a bad file leaves the current
+** store intact.  The first block, which holds the header, is written last,
+** so a failure part way leaves the store erased rather than an image that
+** looks valid.  Returns NULL on success, in which case the caller must
+** restart the chip since any function previously loaded from the store now
+** refers to overwritten flash; otherwise returns an error message.
+*/
+const char *luaN_reload (lua_State *L, const char *filename) {
+  uint32_t buf[LFS_COPY_BLOCK / sizeof(uint32_t)];
+  LFSHeader *h = (LFSHeader *) buf;
+  uint32_t base, size, off, sect;
+  const char *err = NULL;
+  int fd;
+
+  if (lfs_inuse(L))
+    return "cannot reload flash store from code running in it";
+  fd = vfs_open(filename, "r");
+  if (!fd)
+    return "cannot open image file";
+  size = vfs_size(fd);
+  if (vfs_read(fd, buf, sizeof(LFSHeader)) != sizeof(LFSHeader) ||
+      h->magic != LFS_MAGIC || h->version != LFS_VERSION) {
+    err = "not a flash store image for this target";
+  } else if (h->size != size) {
+    err = "image file is truncated";
+  } else if (size > LUA_FLASH_STORE) {
+    err = "image is too large for flash store";
+  }
+  if (err) {
+    vfs_close(fd);
+    return err;
+  }
+
+  base = platform_flash_mapped2phys((uint32_t) flash_store);
+  for (sect = 0; sect < (size + INTERNAL_FLASH_SECTOR_SIZE - 1) /
+                         INTERNAL_FLASH_SECTOR_SIZE; sect++) {
+    if (platform_flash_erase_sector(
+          platform_flash_get_sector_of_address(base) + sect) != PLATFORM_OK) {
+      err = "flash erase failed";
+      break;
+    }
+  }
+  if (!err && size > LFS_COPY_BLOCK) {
+    vfs_lseek(fd, LFS_COPY_BLOCK, VFS_SEEK_SET);
+    for (off = LFS_COPY_BLOCK; !err && off < size; off += LFS_COPY_BLOCK)
+      err = lfs_copy(fd, buf, base + off, size - off);
+  }
+  if (!err) {
+    vfs_lseek(fd, 0, VFS_SEEK_SET);
+    err = lfs_copy(fd, buf, base, size);
+  }
+  vfs_close(fd);
+  return err;
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+** Lua Flash Store (LFS): precompiled Lua modules executed from mapped flash
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lflash_h
+#define lflash_h
+
+#ifdef LUA_CROSS_COMPILER
+#include <stdint.h>
+#else
+#include "c_stdint.h"
+#endif
+
+#include "lua.h"
+
+/*
+** An LFS image is built on the host by "luac.cross -f" and copied verbatim
+** into a sector aligned area reserved at the end of the firmware image.  Its
+** layout is:
+**
+**   LFSHeader                     magic, version, image size, module count
+**   LFSEntry[nmodules]            one entry per module
+**   module names                  NUL terminated, padded to 4 bytes
+**   chunks                        standard dumped chunks, each 4 byte aligned
+**
+** All offsets are relative to the start of the image and all fields are
+** stored in the byte order of the target.  Each chunk is loaded in direct
+** mode (see luaZ_direct_mode), so code vectors, line info and string bodies
+** are used in place from flash and never copied into the RAM heap.
+*/
+
+#define LFS_MAGIC       0x3153464CU     /* "LFS1" read as a little endian word */
+#define LFS_VERSION     1
+
+#define LFS_ALIGN(s)    (((s) + 3) & ~((uint32_t) 3))
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;        /* total image size in bytes */
+  uint32_t nmodules;
+} LFSHeader;
+
+typedef struct {
+  uint32_t name;        /* offset of module name */
+  uint32_t chunk;       /* offset of dumped chunk */
+  uint32_t size;        /* size of dumped chunk */
+} LFSEntry;
+
+#if defined(LUA_FLASH_STORE) && !defined(LUA_CROSS_COMPILER)
+LUAI_FUNC int luaN_index (lua_State *L, const char *name);
+LUAI_FUNC int luaN_list (lua_State *L);
+LUAI_FUNC const char *luaN_reload (lua_State *L, const char *filename);
+#endif
+
+#endif
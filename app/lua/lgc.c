@@ -176,9 +176,16 @@ static int traversetable (global_State *g, Table *h) {
   }
   if (weakkey && weakvalue) return 1;
   if (!weakvalue) {
-    i = h->sizearray;
-    while (i--)
-      markvalue(g, &h->array[i]);
+#if LUAI_COMPACTARRAY > 0
+    if (h->sizearray >= LUAI_COMPACTARRAY && maycompact(h) && !iscompact(h) &&
+        !testbit(g->gcflags, GCResizingTablesBit))
+      luaH_compact(g->mainthread, h);
+#endif
+    if (!iscompact(h)) {  /* a compact array holds no objects */
+      i = h->sizearray;
+      while (i--)
+        markvalue(g, &h->array[i]);
+    }
   }
   i = sizenode(h);
   while (i--) {
@@ -288,7 +295,7 @@ static l_mem propagatemark (global_State *g) {
       g->gray = h->gclist;
       if (traversetable(g, h))  /* table is weak? */
         black2gray(o);  /* keep it gray */
-      return sizeof(Table) + sizeof(TValue) * h->sizearray +
+      return sizeof(Table) + sizearraypart(h) +
                              sizeof(Node) * sizenode(h);
     }
     case LUA_TFUNCTION: {
@@ -365,7 +372,7 @@ static void cleartable (GCObject *l) {
     int i = h->sizearray;
     lua_assert(testbit(h->marked, VALUEWEAKBIT) ||
                testbit(h->marked, KEYWEAKBIT));
-    if (testbit(h->marked, VALUEWEAKBIT)) {
+    if (testbit(h->marked, VALUEWEAKBIT) && !iscompact(h)) {
       while (i--) {
         TValue *o = &h->array[i];
         if (iscleared(o, 0))  /* value was collected? */
@@ -443,6 +450,7 @@ static void checkSizes (lua_State *L) {
   if (g->strt.nuse < cast(lu_int32, g->strt.size/4) &&
       g->strt.size > MINSTRTABSIZE*2)
     luaS_resize(L, g->strt.size/2);  /* table is too big */
+  luaS_savesizehint(g->strt.nuse);  /* size for the strings still alive */
   /* it is not safe to re-size the buffer if it is in use. */
   if (luaZ_bufflen(&g->buff) > 0) return;
   /* check size of buffer */
@@ -626,6 +634,7 @@ void luaC_step (lua_State *L) {
   global_State *g = G(L);
   if(is_block_gc(L)) return;
   set_block_gc(L);
+  luai_gcstep(L);
   l_mem lim = (GCSTEPSIZE/100) * g->gcstepmul;
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
@@ -113,6 +113,15 @@ typedef lu_int32 Instruction;
 #endif
 
 
+/*
+** luai_gcstep is called once for each incremental step of the collector.
+** CHANGE it if you need to instrument the GC (tools/luabench counts steps).
+*/
+#ifndef luai_gcstep
+#define luai_gcstep(L)		((void)(L))
+#endif
+
+
 /*
 ** macro to control inclusion of some hard tests on stack reallocation
 */ 
@@ -25,6 +25,7 @@
 #include "lauxlib.h"
 #include "lualib.h"
 #include "lrotable.h"
+#include "lflash.h"
 
 /* prefix for open functions in C libraries */
 #define LUA_POF		"luaopen_"
@@ -458,6 +459,20 @@ static int loader_preload (lua_State *L) {
 }
 
 
+#if defined(LUA_FLASH_STORE) && !defined(LUA_CROSS_COMPILER)
+static int loader_flash (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  int stat = luaN_index(L, name);
+  if (stat < 0)
+    return 1;  /* not in the store; message already pushed */
+  if (stat != 0)
+    luaL_error(L, "error loading module " LUA_QS " from flash store:\n\t%s",
+                  name, lua_tostring(L, -1));
+  return 1;  /* library loaded successfully */
+}
+#endif
+
+
 static const int sentinel_ = 0;
 #define sentinel	((void *)&sentinel_)
 
@@ -643,7 +658,11 @@ static const luaL_Reg ll_funcs[] = {
 
 
 static const lua_CFunction loaders[] =
+#if defined(LUA_FLASH_STORE) && !defined(LUA_CROSS_COMPILER)
+  {loader_preload, loader_flash, loader_Lua, loader_C, loader_Croot, NULL};
+#else
   {loader_preload, loader_Lua, loader_C, loader_Croot, NULL};
+#endif
 
 #if LUA_OPTIMIZE_MEMORY > 0
 #undef MIN_OPT_LEVEL
@@ -79,6 +79,10 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
     case LUA_TNIL:
       return 1;
     case LUA_TNUMBER:
+#ifdef LUA_DUALNUMBER
+      if (ttisint(t1) && ttisint(t2))
+        return ivalue(t1) == ivalue(t2);
+#endif
       return luai_numeq(nvalue(t1), nvalue(t2));
     case LUA_TBOOLEAN:
       return bvalue(t1) == bvalue(t2);  /* boolean true must be 1 !! */
@@ -122,6 +126,22 @@ int luaO_str2d (const char *s, lua_Number *result) {
 }
 
 
+#ifdef LUA_DUALNUMBER
+void luaO_setnum (TValue *o, lua_Number n) {
+  if (n >= -2147483648.0 && n <= 2147483647.0) {  /* not NaN either */
+    int i;
+    lua_number2int(i, n);
+    if (luai_numeq(cast_num(i), n) &&
+        (i != 0 || luai_numlt(0, 1/n))) {  /* keep -0 a double */
+      setivalue(o, i);
+      return;
+    }
+  }
+  setnvalue(o, n);
+}
+#endif
+
+
 
 static void pushstr (lua_State *L, const char *str) {
   setsvalue2s(L, L->top, luaS_new(L, str));
@@ -153,7 +173,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
         break;
       }
       case 'd': {
-        setnvalue(L->top, cast_num(va_arg(argp, int)));
+        setivalue(L->top, va_arg(argp, int));
         incr_top(L);
         break;
       }
@@ -34,6 +34,16 @@
 #define LUA_TUPVAL	(LAST_TAG+2)
 #define LUA_TDEADKEY	(LAST_TAG+3)
 
+/*
+** With LUA_DUALNUMBER a number holding an exact int value may be kept
+** as an int, tagged LUA_TNUMBER plus LUA_TINTBIT.  ttype() strips the
+** bit, so only code that asks with ttisint() sees the difference.
+*/
+#ifdef LUA_DUALNUMBER
+#define LUA_TINTBIT	64
+#define LUA_TNUMINT	(LUA_TNUMBER | LUA_TINTBIT)
+#endif
+
 
 /*
 ** Union of all collectable objects
@@ -83,6 +93,7 @@ typedef union {
   void *p;
   lua_Number n;
   int b;
+  int i;
 } Value;
 #endif // #if defined( LUA_PACK_VALUE ) && defined( ELUA_ENDIAN_BIG )
 
@@ -161,7 +172,9 @@ typedef TValuefields TValue;
 #endif // #ifndef LUA_PACK_VALUE
 
 /* Macros to access values */
-#ifndef LUA_PACK_VALUE
+#if defined(LUA_DUALNUMBER)
+#define ttype(o)	((o)->tt & ~LUA_TINTBIT)
+#elif !defined(LUA_PACK_VALUE)
 #define ttype(o)	((o)->tt)
 #else // #ifndef LUA_PACK_VALUE
 #define ttype(o)	((o)->_t.sig == LUA_NOTNUMBER_SIG ? (o)->_t.tt : LUA_TNUMBER)
@@ -171,7 +184,14 @@ typedef TValuefields TValue;
 #define pvalue(o)	check_exp(ttislightuserdata(o), (o)->value.p)
 #define rvalue(o)	check_exp(ttisrotable(o), (o)->value.p)
 #define fvalue(o) check_exp(ttislightfunction(o), (o)->value.p)
+#ifdef LUA_DUALNUMBER
+#define ttisint(o)	((o)->tt == LUA_TNUMINT)
+#define ivalue(o)	check_exp(ttisint(o), (o)->value.i)
+#define nvalue(o)	check_exp(ttisnumber(o), \
+	ttisint(o) ? cast_num((o)->value.i) : (o)->value.n)
+#else
 #define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
+#endif
 #define rawtsvalue(o)	check_exp(ttisstring(o), &(o)->value.gc->ts)
 #define tsvalue(o)	(&rawtsvalue(o)->tsv)
 #define rawuvalue(o)	check_exp(ttisuserdata(o), &(o)->value.gc->u)
@@ -209,6 +229,11 @@ typedef TValuefields TValue;
 #define setnvalue(obj,x) \
   { lua_Number i_x = (x); TValue *i_o=(obj); i_o->value.n=i_x; i_o->tt=LUA_TNUMBER; }
 
+#ifdef LUA_DUALNUMBER
+#define setivalue(obj,x) \
+  { int i_x = (x); TValue *i_o=(obj); i_o->value.i=i_x; i_o->tt=LUA_TNUMINT; }
+#endif
+
 #define setpvalue(obj,x) \
   { void *i_x = (x); TValue *i_o=(obj); i_o->value.p=i_x; i_o->tt=LUA_TLIGHTUSERDATA; }
 
@@ -341,7 +366,7 @@ typedef TValuefields TValue;
 #define setsvalue2n	setsvalue
 
 #ifndef LUA_PACK_VALUE
-#define setttype(obj, tt) (ttype(obj) = (tt))
+#define setttype(obj, t) ((obj)->tt = (t))
 #else // #ifndef LUA_PACK_VALUE
 /* considering it used only in lgc to set LUA_TDEADKEY */
 /* we could define it this way */
@@ -350,6 +375,14 @@ typedef TValuefields TValue;
 
 #define iscollectable(o)	(ttype(o) >= LUA_TSTRING)
 
+/* store an int, or a number as an int when it is exactly one */
+#ifdef LUA_DUALNUMBER
+#define setnumvalue(obj,x)	luaO_setnum(obj,x)
+#else
+#define setivalue(obj,x)	setnvalue(obj,cast_num(x))
+#define setnumvalue(obj,x)	setnvalue(obj,x)
+#endif
+
 
 
 typedef TValue *StkId;  /* index to stack elements */
@@ -549,6 +582,9 @@ LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_rawequalObj (const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaO_str2d (const char *s, lua_Number *result);
+#ifdef LUA_DUALNUMBER
+LUAI_FUNC void luaO_setnum (TValue *o, lua_Number n);
+#endif
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
 LUAI_FUNC const char *luaO_pushfstring (lua_State *L, const char *fmt, ...);
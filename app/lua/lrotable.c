@@ -16,14 +16,54 @@
 /* Externally defined read-only table array */
 extern const luaR_table lua_rotable[];
 
+/*
+** Lookup cache for string keys.  A line remembers where a key was last found
+** in a given rotable, indexed by the table address and the key's string hash.
+** A hit is always verified against the entry itself, so a stale or colliding
+** line costs one c_strcmp and can never return a wrong value.
+*/
+#define LUAR_CACHE_LINES      32    /* must be a power of 2 */
+
+typedef struct {
+  const void *table;
+  unsigned short tag;
+  unsigned short pos;
+} luaR_cacheline;
+
+static luaR_cacheline luaR_cache[LUAR_CACHE_LINES];
+
+#define cacheline(t,h)  (&luaR_cache[((unsigned)((size_t)(t) >> 3) ^ (h)) & (LUAR_CACHE_LINES - 1)])
+#define cachetag(h)     ((unsigned short)((h) >> 16))
+
+/* Same hash as the string table uses, for keys that are not TStrings */
+static unsigned luaR_strhash(const char *str, size_t l) {
+  unsigned h = (unsigned)l;
+  size_t step = (l>>5)+1;
+  size_t l1;
+  for (l1=l; l1>=step; l1-=step)
+    h = h ^ ((h<<5)+(h>>2)+(unsigned char)str[l1-1]);
+  return h;
+}
+
 /* Find a global "read only table" in the constant lua_rotable array */
 void* luaR_findglobal(const char *name, unsigned len) {
-  unsigned i;
+  unsigned i, h;
+  luaR_cacheline *line;
 
-  if (c_strlen(name) > LUA_MAX_ROTABLE_NAME)
+  if (len > LUA_MAX_ROTABLE_NAME)
     return NULL;
+  h = luaR_strhash(name, len);
+  line = cacheline(lua_rotable, h);
+  if (line->table == lua_rotable && line->tag == cachetag(h)) {
+    const char *rname = lua_rotable[line->pos].name;
+    if (!c_strncmp(rname, name, len) && rname[len] == '\0')
+      return (void*)(lua_rotable[line->pos].pentries);
+  }
   for (i=0; lua_rotable[i].name; i ++)
-    if (*lua_rotable[i].name != '\0' && c_strlen(lua_rotable[i].name) == len && !c_strncmp(lua_rotable[i].name, name, len)) {
+    if (*lua_rotable[i].name != '\0' && !c_strncmp(lua_rotable[i].name, name, len) && lua_rotable[i].name[len] == '\0') {
+      line->table = lua_rotable;
+      line->tag = cachetag(h);
+      line->pos = i;
       return (void*)(lua_rotable[i].pentries);
     }
   return NULL;
@@ -49,11 +89,37 @@ static const TValue* luaR_auxfind(const luaR_entry *pentry, const char *strkey,
   return res;
 }
 
+/* Find a string key via the lookup cache; h is the hash of the key */
+static const TValue* luaR_auxfindstr(const luaR_entry *pentries, const char *strkey, unsigned h, unsigned *ppos) {
+  luaR_cacheline *line = cacheline(pentries, h);
+  const TValue *res;
+  unsigned pos;
+
+  if (line->table == pentries && line->tag == cachetag(h)) {
+    const luaR_entry *pentry = pentries + line->pos;
+    if (pentry->key.type == LUA_TSTRING && !c_strcmp(pentry->key.id.strkey, strkey)) {
+      if (ppos)
+        *ppos = line->pos;
+      return &pentry->value;
+    }
+  }
+  res = luaR_auxfind(pentries, strkey, 0, &pos);
+  if (res && pos <= 0xFFFF) {
+    line->table = pentries;
+    line->tag = cachetag(h);
+    line->pos = pos;
+  }
+  if (res && ppos)
+    *ppos = pos;
+  return res;
+}
+
 int luaR_findfunction(lua_State *L, const luaR_entry *ptable) {
   const TValue *res = NULL;
-  const char *key = luaL_checkstring(L, 2);
+  size_t len;
+  const char *key = luaL_checklstring(L, 2, &len);
     
-  res = luaR_auxfind(ptable, key, 0, NULL);  
+  res = luaR_auxfindstr(ptable, key, luaR_strhash(key, len), NULL);
   if (res && ttislightfunction(res)) {
     luaA_pushobject(L, res);
     return 1;
@@ -69,10 +135,21 @@ const TValue* luaR_findentry(void *data, const char *strkey, luaR_numkey numkey,
   return luaR_auxfind((const luaR_entry*)data, strkey, numkey, ppos);
 }
 
+/* Find an entry with a string key given as a Lua string */
+const TValue* luaR_findstrentry(void *data, const TString *key, unsigned *ppos) {
+  if (data == NULL || key->tsv.len > LUA_MAX_ROTABLE_NAME)
+    return NULL;
+  return luaR_auxfindstr((const luaR_entry*)data, getstr(key), key->tsv.hash, ppos);
+}
+
 /* Find the metatable of a given table */
 void* luaR_getmeta(void *data) {
 #ifdef LUA_META_ROTABLES
-  const TValue *res = luaR_auxfind((const luaR_entry*)data, "__metatable", 0, NULL);
+  static unsigned h = 0;
+  const TValue *res;
+  if (h == 0)
+    h = luaR_strhash("__metatable", sizeof("__metatable")-1);
+  res = luaR_auxfindstr((const luaR_entry*)data, "__metatable", h, NULL);
   return res && ttisrotable(res) ? rvalue(res) : NULL;
 #else
   return NULL;
@@ -87,28 +164,30 @@ static void luaR_next_helper(lua_State *L, const luaR_entry *pentries, int pos,
     if (pentries[pos].key.type == LUA_TSTRING)
       setsvalue(L, key, luaS_newro(L, pentries[pos].key.id.strkey))
     else
-      setnvalue(key, (lua_Number)pentries[pos].key.id.numkey)
+      setivalue(key, pentries[pos].key.id.numkey)
    setobj2s(L, val, &pentries[pos].value);
   }
 }
 /* next (used for iteration) */
 void luaR_next(lua_State *L, void *data, TValue *key, TValue *val) {
   const luaR_entry* pentries = (const luaR_entry*)data;
-  char strkey[LUA_MAX_ROTABLE_NAME + 1], *pstrkey = NULL;
-  luaR_numkey numkey = 0;
   unsigned keypos;
   
   /* Special case: if key is nil, return the first element of the rotable */
   if (ttisnil(key)) 
     luaR_next_helper(L, pentries, 0, key, val);
   else if (ttisstring(key) || ttisnumber(key)) {
+    const TValue *res;
     /* Find the previoud key again */  
-    if (ttisstring(key)) {
-      luaR_getcstr(strkey, rawtsvalue(key), LUA_MAX_ROTABLE_NAME);          
-      pstrkey = strkey;
-    } else   
-      numkey = (luaR_numkey)nvalue(key);
-    luaR_findentry(data, pstrkey, numkey, &keypos);
+    if (ttisstring(key))
+      res = luaR_findstrentry(data, rawtsvalue(key), &keypos);
+    else   
+      res = luaR_findentry(data, NULL, (luaR_numkey)nvalue(key), &keypos);
+    if (!res) {  /* key not in table: end the traversal */
+      setnilvalue(key);
+      setnilvalue(val);
+      return;
+    }
     /* Advance to next key */
     keypos ++;    
     luaR_next_helper(L, pentries, keypos, key, val);
@@ -68,6 +68,7 @@ typedef struct
 void* luaR_findglobal(const char *key, unsigned len);
 int luaR_findfunction(lua_State *L, const luaR_entry *ptable);
 const TValue* luaR_findentry(void *data, const char *strkey, luaR_numkey numkey, unsigned *ppos);
+const TValue* luaR_findstrentry(void *data, const TString *key, unsigned *ppos);
 void luaR_getcstr(char *dest, const TString *src, size_t maxsize);
 void luaR_next(lua_State *L, void *data, TValue *key, TValue *val);
 void* luaR_getmeta(void *data);
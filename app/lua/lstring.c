@@ -21,6 +21,47 @@
 #define LUAS_READONLY_STRING      1
 #define LUAS_REGULAR_STRING       0
 
+#if defined(LUA_STRTAB_RTC_SLOT) && !defined(LUA_CROSS_COMPILER)
+#include "rtc/rtcaccess.h"
+
+/*
+** The size that fits the strings alive after a collection is kept in an RTC
+** user memory slot, which survives a restart or deep sleep but not a power
+** cycle, so that the next boot can start with a table of that size rather
+** than regrow it while the modules and init.lua create their strings.
+*/
+#define STRTAB_MAGIC	0x5354	/* upper half of the slot; lower half is log2(size) */
+#define STRTAB_MAXHINT	12	/* log2 of the largest size taken from the slot */
+
+int luaS_sizehint (void) {
+  uint32_t v = rtc_mem_read(LUA_STRTAB_RTC_SLOT);
+  int lsize = v & 0xffff;
+  if ((v >> 16) == STRTAB_MAGIC && lsize <= STRTAB_MAXHINT &&
+      twoto(lsize) > MINSTRTABSIZE)
+    return twoto(lsize);
+  return MINSTRTABSIZE;
+}
+
+void luaS_savesizehint (lu_int32 nuse) {
+  uint32_t v;
+  int lsize;
+  if (nuse <= MINSTRTABSIZE) nuse = MINSTRTABSIZE;
+  lsize = ceillog2(nuse);
+  if (lsize > STRTAB_MAXHINT) lsize = STRTAB_MAXHINT;
+  v = (STRTAB_MAGIC << 16) | lsize;
+  if (rtc_mem_read(LUA_STRTAB_RTC_SLOT) != v)
+    rtc_mem_write(LUA_STRTAB_RTC_SLOT, v);
+}
+#else
+int luaS_sizehint (void) {
+  return MINSTRTABSIZE;
+}
+
+void luaS_savesizehint (lu_int32 nuse) {
+  UNUSED(nuse);
+}
+#endif
+
 void luaS_resize (lua_State *L, int newsize) {
   stringtable *tb;
   int i;
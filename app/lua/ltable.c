@@ -121,6 +121,10 @@ static Node *mainposition (const Table *t, const TValue *key) {
 ** the array part of the table, -1 otherwise.
 */
 static int arrayindex (const TValue *key) {
+#ifdef LUA_DUALNUMBER
+  if (ttisint(key))
+    return ivalue(key);
+#endif
   if (ttisnumber(key)) {
     lua_Number n = nvalue(key);
     int k;
@@ -132,6 +136,117 @@ static int arrayindex (const TValue *key) {
 }
 
 
+/*
+** {=============================================================
+** Compact arrays
+** ==============================================================
+*/
+
+/*
+** A compact array part keeps one int per slot in the memory pointed to by
+** `array', with CNIL for an empty slot, in a quarter of the space of the
+** TValues. The collector gives one to a table whose array part has
+** LUAI_COMPACTARRAY slots or more holding only integers (see luaH_compact),
+** so stores never pay for it. The table loses it for good the first time
+** its array part is stored into or resized: as no TValue pointer to a
+** compact slot can be handed out, luaH_set and luaH_setnum expand the
+** array part before returning one. Lookups copy a compact slot into a
+** TValue supplied by the caller.
+*/
+
+#define carray(t)	(cast(int *, (t)->array))
+#define CNIL		INT_MIN
+
+#define arrayisnil(t,i)	(iscompact(t) ? carray(t)[i] == CNIL : \
+                                        ttisnil(&(t)->array[i]))
+#define arrayget(t,i,v)	(iscompact(t) ? getcompact(t, i, v) : &(t)->array[i])
+
+
+/*
+** can `o' be kept in a compact array? If so, set `*v' to its slot value
+*/
+static int tocompact (const TValue *o, int *v) {
+  if (ttisnil(o)) {
+    *v = CNIL;
+    return 1;
+  }
+#ifdef LUA_DUALNUMBER
+  if (ttisint(o)) {
+    *v = ivalue(o);
+    return *v != CNIL;
+  }
+#endif
+  if (ttisnumber(o)) {
+    lua_Number n = nvalue(o);
+    int k;
+    lua_number2int(k, n);
+    if (luai_numeq(cast_num(k), n) && k != CNIL
+#if !defined(LUA_NUMBER_INTEGRAL)
+        && (k != 0 || 1/n > 0)  /* -0 must keep its sign */
+#endif
+       ) {
+      *v = k;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static const TValue *getcompact (Table *t, int i, TValue *v) {
+  int c = carray(t)[i];
+  if (c == CNIL)
+    return luaO_nilobject;
+  setivalue(v, c);
+  return v;
+}
+
+
+/*
+** convert a compact array part back to TValues; it stays that way
+*/
+static void expandarray (lua_State *L, Table *t) {
+  int i;
+  int n = t->sizearray;
+  int *c = carray(t);
+  TValue *a = luaM_newvector(L, n, TValue);
+  for (i = 0; i < n; i++) {
+    if (c[i] == CNIL) setnilvalue(&a[i]);
+    else setivalue(&a[i], c[i]);
+  }
+  luaM_freearray(L, c, n, int);
+  t->array = a;
+  t->flags = cast_byte((t->flags & ~TFLAG_COMPACT) | TFLAG_NOCOMPACT);
+}
+
+
+/*
+** replace the array part by a compact one, if all its values can be kept
+** there. Called by the collector: the ints are written over the TValues
+** they come from, so the only allocation is the block shrinking, which
+** cannot fail.
+*/
+void luaH_compact (lua_State *L, Table *t) {
+  int i, v;
+  int n = t->sizearray;
+  for (i = 0; i < n; i++) {
+    if (!tocompact(&t->array[i], &v)) {
+      t->flags |= TFLAG_NOCOMPACT;
+      return;
+    }
+  }
+  for (i = 0; i < n; i++) {  /* slot i only overlaps TValues already read */
+    tocompact(&t->array[i], &v);
+    memcpy(&carray(t)[i], &v, sizeof(int));
+  }
+  t->array = cast(TValue *, luaM_realloc_(L, t->array, n*sizeof(TValue),
+                                          n*sizeof(int)));
+  t->flags |= TFLAG_COMPACT;
+}
+
+/* }============================================================= */
+
+
 /*
 ** returns the index of a `key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
@@ -164,10 +279,11 @@ static int findindex (lua_State *L, Table *t, StkId key) {
 
 int luaH_next (lua_State *L, Table *t, StkId key) {
   int i = findindex(L, t, key);  /* find original element */
+  TValue v;
   for (i++; i < t->sizearray; i++) {  /* try first array part */
-    if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setnvalue(key, cast_num(i+1));
-      setobj2s(L, key+1, &t->array[i]);
+    if (!arrayisnil(t, i)) {  /* a non-nil value? */
+      setivalue(key, i+1);
+      setobj2s(L, key+1, arrayget(t, i, &v));
       return 1;
     }
   }
@@ -243,7 +359,7 @@ static int numusearray (const Table *t, int *nums) {
     }
     /* count elements in range (2^(lg-1), 2^lg] */
     for (; i <= lim; i++) {
-      if (!ttisnil(&t->array[i-1]))
+      if (!arrayisnil(t, i-1))
         lc++;
     }
     nums[lg] += lc;
@@ -443,6 +559,11 @@ static void resize_hashpart (lua_State *L, Table *t, int nhsize) {
 static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
   int i;
   int oldasize = t->sizearray;
+  int resizing = is_resizing_tables_gc(L);
+  if (iscompact(t) && nasize != oldasize)
+    expandarray(L, t);
+  /* the collector must not compact the array part under our feet */
+  set_resizing_tables_gc(L);
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   resize_hashpart(L, t, nhsize);
@@ -456,6 +577,8 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
     /* shrink array */
     luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
   }
+  if (!resizing)
+    unset_resizing_tables_gc(L);
 }
 
 
@@ -496,7 +619,7 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
   sethvalue2s(L, L->top, t); /* put table on stack */
   incr_top(L);
   t->metatable = NULL;
-  t->flags = cast_byte(~0);
+  t->flags = cast_byte(~TFLAG_ARRAY);
   /* temporary values (kept only if some malloc fails) */
   t->array = NULL;
   t->sizearray = 0;
@@ -512,7 +635,10 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
 void luaH_free (lua_State *L, Table *t) {
   if (t->node != dummynode)
     luaM_freearray(L, t->node, sizenode(t), Node);
-  luaM_freearray(L, t->array, t->sizearray, TValue);
+  if (iscompact(t))
+    luaM_freearray(L, carray(t), t->sizearray, int);
+  else
+    luaM_freearray(L, t->array, t->sizearray, TValue);
   luaM_free(L, t);
 }
 
@@ -559,12 +685,13 @@ static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
 
 
 /*
-** search function for integers
+** search function for integers; a value in a compact array slot is
+** copied to `v' and returned from there
 */
-const TValue *luaH_getnum (Table *t, int key) {
+const TValue *luaH_getnum (Table *t, int key, TValue *v) {
   /* (1 <= key && key <= t->sizearray) */
   if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
-    return &t->array[key-1];
+    return arrayget(t, key-1, v);
   else {
     lua_Number nk = cast_num(key);
     Node *n = hashnum(t, nk);
@@ -599,29 +726,29 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 
 /* same thing for rotables */
 const TValue *luaH_getstr_ro (void *t, TString *key) {
-  char keyname[LUA_MAX_ROTABLE_NAME + 1];
-  const TValue *res;  
-  if (!t)
-    return luaO_nilobject;
-  luaR_getcstr(keyname, key, LUA_MAX_ROTABLE_NAME);   
-  res = luaR_findentry(t, keyname, 0, NULL);
+  const TValue *res = luaR_findstrentry(t, key, NULL);
   return res ? res : luaO_nilobject;
 }
 
 
 /*
-** main search function
+** main search function; `v' is as for luaH_getnum
 */
-const TValue *luaH_get (Table *t, const TValue *key) {
+const TValue *luaH_get (Table *t, const TValue *key, TValue *v) {
   switch (ttype(key)) {
     case LUA_TNIL: return luaO_nilobject;
     case LUA_TSTRING: return luaH_getstr(t, rawtsvalue(key));
     case LUA_TNUMBER: {
       int k;
-      lua_Number n = nvalue(key);
+      lua_Number n;
+#ifdef LUA_DUALNUMBER
+      if (ttisint(key))
+        return luaH_getnum(t, ivalue(key), v);
+#endif
+      n = nvalue(key);
       lua_number2int(k, n);
       if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
-        return luaH_getnum(t, k);  /* use specialized version */
+        return luaH_getnum(t, k, v);  /* use specialized version */
       /* else go through */
     }
     default: {
@@ -643,7 +770,12 @@ const TValue *luaH_get_ro (void *t, const TValue *key) {
     case LUA_TSTRING: return luaH_getstr_ro(t, rawtsvalue(key));
     case LUA_TNUMBER: {
       int k;
-      lua_Number n = nvalue(key);
+      lua_Number n;
+#ifdef LUA_DUALNUMBER
+      if (ttisint(key))
+        return luaH_getnum_ro(t, ivalue(key));
+#endif
+      n = nvalue(key);
       lua_number2int(k, n);
       if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
         return luaH_getnum_ro(t, k);  /* use specialized version */
@@ -657,8 +789,12 @@ const TValue *luaH_get_ro (void *t, const TValue *key) {
 
 
 TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
-  const TValue *p = luaH_get(t, key);
-  t->flags = 0;
+  const TValue *p;
+  if (iscompact(t) && ttisnumber(key) &&
+      cast(unsigned int, arrayindex(key)-1) < cast(unsigned int, t->sizearray))
+    expandarray(L, t);
+  p = luaH_get(t, key, NULL);  /* no compact slot left to copy */
+  invalidateTMcache(t);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
@@ -671,12 +807,15 @@ TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
 
 
 TValue *luaH_setnum (lua_State *L, Table *t, int key) {
-  const TValue *p = luaH_getnum(t, key);
+  const TValue *p;
+  if (iscompact(t) && cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
+    expandarray(L, t);
+  p = luaH_getnum(t, key, NULL);  /* no compact slot left to copy */
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
     TValue k;
-    setnvalue(&k, cast_num(key));
+    setivalue(&k, key);
     return newkey(L, t, &k);
   }
 }
@@ -696,22 +835,23 @@ TValue *luaH_setstr (lua_State *L, Table *t, TString *key) {
 
 static int unbound_search (Table *t, unsigned int j) {
   unsigned int i = j;  /* i is zero or a present index */
+  TValue v;
   j++;
   /* find `i' and `j' such that i is present and j is not */
-  while (!ttisnil(luaH_getnum(t, j))) {
+  while (!ttisnil(luaH_getnum(t, j, &v))) {
     i = j;
     j *= 2;
     if (j > cast(unsigned int, MAX_INT)) {  /* overflow? */
       /* table was built with bad purposes: resort to linear search */
       i = 1;
-      while (!ttisnil(luaH_getnum(t, i))) i++;
+      while (!ttisnil(luaH_getnum(t, i, &v))) i++;
       return i - 1;
     }
   }
   /* now do a binary search between them */
   while (j - i > 1) {
     unsigned int m = (i+j)/2;
-    if (ttisnil(luaH_getnum(t, m))) j = m;
+    if (ttisnil(luaH_getnum(t, m, &v))) j = m;
     else i = m;
   }
   return i;
@@ -724,12 +864,12 @@ static int unbound_search (Table *t, unsigned int j) {
 */
 int luaH_getn (Table *t) {
   unsigned int j = t->sizearray;
-  if (j > 0 && ttisnil(&t->array[j - 1])) {
+  if (j > 0 && arrayisnil(t, j - 1)) {
     /* there is a boundary in the array part: (binary) search for it */
     unsigned int i = 0;
     while (j - i > 1) {
       unsigned int m = (i+j)/2;
-      if (ttisnil(&t->array[m - 1])) j = m;
+      if (arrayisnil(t, m - 1)) j = m;
       else i = m;
     }
     return i;
@@ -17,18 +17,35 @@
 
 #define key2tval(n)	(&(n)->i_key.tvk)
 
+/*
+** The bits of `flags' above the tag method cache describe the array part.
+** A compact array part holds an int per slot instead of a TValue (see
+** ltable.c); it is used only through the functions below, and only the
+** collector creates one, with luaH_compact.
+*/
+#define TFLAG_COMPACT	(1<<7)	/* array part is compact */
+#define TFLAG_NOCOMPACT	(1<<6)	/* array part may not become compact */
+#define TFLAG_ARRAY	(TFLAG_COMPACT | TFLAG_NOCOMPACT)
+
+#define iscompact(t)	((t)->flags & TFLAG_COMPACT)
+#define maycompact(t)	(!((t)->flags & TFLAG_NOCOMPACT))
+#define invalidateTMcache(t)	((t)->flags &= TFLAG_ARRAY)
+#define sizearraypart(t)	((t)->sizearray * \
+	(iscompact(t) ? sizeof(int) : sizeof(TValue)))
+
 
-LUAI_FUNC const TValue *luaH_getnum (Table *t, int key);
+LUAI_FUNC const TValue *luaH_getnum (Table *t, int key, TValue *v);
 LUAI_FUNC const TValue *luaH_getnum_ro (void *t, int key);
 LUAI_FUNC TValue *luaH_setnum (lua_State *L, Table *t, int key);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_getstr_ro (void *t, TString *key);
 LUAI_FUNC TValue *luaH_setstr (lua_State *L, Table *t, TString *key);
-LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
+LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key, TValue *v);
 LUAI_FUNC const TValue *luaH_get_ro (void *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
 LUAI_FUNC Table *luaH_new (lua_State *L, int narray, int lnhash);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, int nasize);
+LUAI_FUNC void luaH_compact (lua_State *L, Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_next_ro (lua_State *L, void *t, StkId key);
@@ -243,6 +243,7 @@ LUA_API int  (lua_status) (lua_State *L);
 #define LUA_GCSETSTEPMUL	7
 #define LUA_GCSETMEMLIMIT	8
 #define LUA_GCGETMEMLIMIT	9
+#define LUA_GCSTRCHAIN		10
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
@@ -19,6 +19,7 @@
 #include "lauxlib.h"
 
 #include "ldo.h"
+#include "lflash.h"
 #include "lfunc.h"
 #include "lmem.h"
 #include "lobject.h"
@@ -32,6 +33,8 @@
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int flashing=0;			/* output a flash store image? */
+static int optimizing=0;		/* optimise bytecodes? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -59,7 +62,9 @@ static void usage(const char* message)
  "usage: %s [options] [filenames].\n"
  "Available options are:\n"
  "  -        process stdin\n"
+ "  -f       output a flash store image with one module per file\n"
  "  -l       list\n"
+ "  -O       optimise bytecodes (jump threading, dead code removal)\n"
  "  -o name  output to file " LUA_QL("name") " (default is \"%s\")\n"
  "  -p       parse only\n"
  "  -s       strip debug information\n"
@@ -91,8 +96,12 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-f"))			/* flash store image */
+   flashing=1;
   else if (IS("-l"))			/* list */
    ++listing;
+  else if (IS("-O"))			/* optimise */
+   optimizing=1;
   else if (IS("-o"))			/* output file */
   {
    output=argv[++i];
@@ -184,6 +193,105 @@ static int writer(lua_State* L, const void* p, size_t size, void* u)
  return (fwrite(p,size,1,(FILE*)u)!=1) && (size!=0);
 }
 
+/* growable memory buffer used to assemble a flash store image */
+typedef struct {
+ char* b;
+ size_t n;
+ size_t size;
+} Image;
+
+static int imagewriter(lua_State* L, const void* p, size_t size, void* u)
+{
+ Image* I=(Image*)u;
+ UNUSED(L);
+ if (I->n+size>I->size)
+ {
+  size_t newsize=2*(I->n+size);
+  char* b=realloc(I->b,newsize);
+  if (b==NULL) return 1;
+  I->b=b;
+  I->size=newsize;
+ }
+ memcpy(I->b+I->n,p,size);
+ I->n+=size;
+ return 0;
+}
+
+static void imagealign(Image* I)
+{
+ static const char zero[4]={0,0,0,0};
+ if (imagewriter(NULL,zero,LFS_ALIGN(I->n)-I->n,I)) fatal("not enough memory for image");
+}
+
+static void imageword(Image* I, uint32_t x)
+{
+ unsigned char b[4];
+ int i;
+ for (i=0; i<4; i++)
+  b[target.little_endian ? i : 3-i]=(unsigned char)(x>>(8*i));
+ if (imagewriter(NULL,b,4,I)) fatal("not enough memory for image");
+}
+
+/* module name of a source file: its base name without extension */
+static const char* modulename(lua_State* L, const char* filename)
+{
+ const char* base=filename;
+ const char* p;
+ for (p=filename; *p; p++)
+  if (*p=='/' || *p=='\\') base=p+1;
+ p=strrchr(base,'.');
+ lua_pushlstring(L,base,p ? (size_t)(p-base) : strlen(base));
+ return lua_tostring(L,-1);
+}
+
+/*
+** dump each of the n functions on top of the stack as a separate chunk and
+** assemble them, indexed by module name, into a flash store image (lflash.h)
+*/
+static void dumpflash(lua_State* L, int n, char* argv[], FILE* D)
+{
+ Image names={NULL,0,0}, chunks={NULL,0,0}, image={NULL,0,0};
+ uint32_t* offsets=malloc(3*n*sizeof(uint32_t));
+ uint32_t base=sizeof(LFSHeader)+n*sizeof(LFSEntry);
+ int i,j;
+ if (offsets==NULL) fatal("not enough memory for image");
+ for (i=0; i<n; i++)
+ {
+  const char* name=modulename(L,argv[i]);
+  for (j=0; j<i; j++)
+   if (strcmp(names.b+offsets[3*j],name)==0) fatal("duplicate module name in image");
+  offsets[3*i]=names.n;
+  if (imagewriter(NULL,name,strlen(name)+1,&names)) fatal("not enough memory for image");
+  lua_pop(L,1);
+  imagealign(&chunks);
+  offsets[3*i+1]=chunks.n;
+  int result=luaU_dump_crosscompile(L,toproto(L,i-n),imagewriter,&chunks,stripping,target);
+  if (result==LUA_ERR_CC_INTOVERFLOW) fatal("value too big or small for target integer type");
+  if (result==LUA_ERR_CC_NOTINTEGER) fatal("target lua_Number is integral but fractional value found");
+  if (result!=0) fatal("not enough memory for image");
+  offsets[3*i+2]=chunks.n-offsets[3*i+1];
+ }
+ imagealign(&names);
+ imagealign(&chunks);
+ imageword(&image,LFS_MAGIC);
+ imageword(&image,LFS_VERSION);
+ imageword(&image,base+names.n+chunks.n);
+ imageword(&image,n);
+ for (i=0; i<n; i++)
+ {
+  imageword(&image,base+offsets[3*i]);
+  imageword(&image,base+names.n+offsets[3*i+1]);
+  imageword(&image,offsets[3*i+2]);
+ }
+ if (imagewriter(NULL,names.b,names.n,&image) ||
+     imagewriter(NULL,chunks.b,chunks.n,&image)) fatal("not enough memory for image");
+ if (fwrite(image.b,image.n,1,D)!=1) cannot("write");
+ free(offsets);
+ free(names.b);
+ free(chunks.b);
+ free(image.b);
+}
+
 struct Smain {
  int argc;
  char** argv;
@@ -202,6 +310,21 @@ static int pmain(lua_State* L)
   const char* filename=IS("-") ? NULL : argv[i];
   if (luaL_loadfile(L,filename)!=0) fatal(lua_tostring(L,-1));
  }
+ if (optimizing) for (i=0; i<argc; i++) luaU_optimize(L,toproto(L,i-argc));
+ if (flashing)
+ {
+  FILE* D;
+  if (listing) for (i=0; i<argc; i++) luaU_print(toproto(L,i-argc),listing>1);
+  if (!dumping) return 0;
+  D= (output==NULL) ? stdout : fopen(output,"wb");
+  if (D==NULL) cannot("open");
+  lua_lock(L);
+  dumpflash(L,argc,argv,D);
+  lua_unlock(L);
+  if (ferror(D)) cannot("write");
+  if (fclose(D)) cannot("close");
+  return 0;
+ }
  f=combine(L,argc);
  if (listing) luaU_print(f,listing>1);
  if (dumping)
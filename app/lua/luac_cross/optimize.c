@@ -0,0 +1,384 @@
+/*
+** Bytecode optimiser for luac.cross (-O)
+** See Copyright Notice in lua.h
+*/
+
+#define LUAC_CROSS_FILE
+
+#include "luac_cross.h"
+#include C_HEADER_STRING
+
+#define luac_c
+#define LUA_CORE
+
+#include "ldebug.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lundump.h"
+
+#define OptimizeFunction	luaU_optimize
+
+/*
+** The pass runs on the Proto tree after parsing and before dumping. It only
+** makes rewrites that preserve the semantics of every instruction stream the
+** 5.1 code generator emits:
+**
+**  - jump threading: a jump to an unconditional jump goes to its target
+**  - a plain jump to a fixed-size RETURN becomes a copy of that RETURN
+**  - instructions that no path from the entry point reaches are removed
+**  - JMP +0, MOVE A A and the second MOVE of an A<-B, B<-A pair are removed
+**
+** An instruction directly after one that may skip it (tests, LOADBOOL with C,
+** TFORLOOP), the data word of a SETLIST and the pseudo-instructions of a
+** CLOSURE are never touched, nor is the final RETURN. The result must pass
+** luaG_checkcode, otherwise the function is left as it was.
+*/
+
+#define MAXTHREAD	64		/* maximum length of a followed jump chain */
+
+typedef struct {
+ Instruction* code;
+ int* line;			/* line of each instruction, or NULL */
+ int n;
+} Code;
+
+static int jumptarget(Instruction i, int pc)
+{
+ return pc+1+GETARG_sBx(i);
+}
+
+static int isjump(Instruction i)
+{
+ OpCode o=GET_OPCODE(i);
+ return o==OP_JMP || o==OP_FORLOOP || o==OP_FORPREP;
+}
+
+/* may instruction i make the VM skip the instruction after it? */
+static int skipsnext(Instruction i)
+{
+ OpCode o=GET_OPCODE(i);
+ return testTMode(o) || (o==OP_LOADBOOL && GETARG_C(i)) ||
+        (o==OP_SETLIST && GETARG_C(i)==0);
+}
+
+/* mark instructions that must stay where they are relative to their neighbours */
+static void markpinned(const Proto* f, const Code* c, char* pinned)
+{
+ int pc,j;
+ for (pc=0; pc<c->n; pc++)
+ {
+  Instruction i=c->code[pc];
+  if (pc+1<c->n && skipsnext(i)) pinned[pc+1]=1;
+  if (GET_OPCODE(i)==OP_CLOSURE)
+  {
+   int nup=f->p[GETARG_Bx(i)]->nups;
+   for (j=1; j<=nup && pc+j<c->n; j++) pinned[pc+j]=1;
+  }
+ }
+ pinned[c->n-1]=1;
+}
+
+static void threadjumps(Code* c, const char* pinned)
+{
+ int pc;
+ for (pc=0; pc<c->n; pc++)
+ {
+  Instruction i=c->code[pc];
+  int target,steps;
+  if (GET_OPCODE(i)!=OP_JMP) continue;
+  target=jumptarget(i,pc);
+  for (steps=0; steps<MAXTHREAD && target!=pc &&
+       GET_OPCODE(c->code[target])==OP_JMP; steps++)
+  {
+   int next=jumptarget(c->code[target],target);
+   if (next==target) break;		/* jump to itself */
+   target=next;
+  }
+  SETARG_sBx(c->code[pc],target-pc-1);
+  /* an unconditional jump to a return is the return itself */
+  if (!pinned[pc] && (pc==0 || !skipsnext(c->code[pc-1])) &&
+      GET_OPCODE(c->code[target])==OP_RETURN && GETARG_B(c->code[target])!=0)
+   c->code[pc]=c->code[target];
+ }
+}
+
+static void markreachable(lua_State* L, const Code* c, char* live)
+{
+ int* stack=luaM_newvector(L,c->n,int);
+ int top=0;
+ stack[top++]=0;
+ live[0]=1;
+#define reach(p)	{ int p_=(p); if (p_<c->n && !live[p_]) { live[p_]=1; stack[top++]=p_; } }
+ while (top>0)
+ {
+  int pc=stack[--top];
+  Instruction i=c->code[pc];
+  switch (GET_OPCODE(i))
+  {
+   case OP_JMP:
+   case OP_FORPREP:
+    reach(jumptarget(i,pc));
+    break;
+   case OP_FORLOOP:
+    reach(jumptarget(i,pc));
+    reach(pc+1);
+    break;
+   case OP_RETURN:
+    break;
+   case OP_LOADBOOL:
+    reach(GETARG_C(i) ? pc+2 : pc+1);
+    break;
+   case OP_SETLIST:
+    if (GETARG_C(i)==0) { live[pc+1]=1; reach(pc+2); } else reach(pc+1);
+    break;
+   case OP_CLOSURE:
+    reach(pc+1);			/* pseudo-instructions are pinned */
+    break;
+   default:
+    reach(pc+1);
+    if (testTMode(GET_OPCODE(i))) reach(pc+2);
+    break;
+  }
+ }
+#undef reach
+ luaM_freearray(L,stack,c->n,int);
+}
+
+static int isnop(const Code* c, int pc, const char* istarget)
+{
+ Instruction i=c->code[pc];
+ switch (GET_OPCODE(i))
+ {
+  case OP_JMP:
+   return GETARG_sBx(i)==0;
+  case OP_MOVE:
+  {
+   Instruction p;
+   if (GETARG_A(i)==GETARG_B(i)) return 1;
+   if (pc==0 || istarget[pc]) return 0;
+   p=c->code[pc-1];
+   return GET_OPCODE(p)==OP_MOVE && GETARG_A(p)==GETARG_B(i) && GETARG_B(p)==GETARG_A(i);
+  }
+  default:
+   return 0;
+ }
+}
+
+/* expand packed line info into one line number per instruction */
+static int* unpacklines(lua_State* L, const Proto* f, int n)
+{
+#ifdef LUA_OPTIMIZE_DEBUG
+ const unsigned char* p=f->packedlineinfo;
+ int* line;
+ int pc=0,l=0;
+ if (p==NULL) return NULL;
+ line=luaM_newvector(L,n,int);
+ while (*p && *p!=INFO_FILL_BYTE && pc<n)
+ {
+  int count;
+  if (*p & INFO_DELTA_MASK)
+  {
+   int delta=*p & INFO_DELTA_6BITS;
+   unsigned char sign=*p++ & INFO_SIGN_MASK;
+   int shift;
+   for (shift=6; *p & INFO_DELTA_MASK; p++, shift+=7)
+    delta+=(*p & INFO_DELTA_7BITS)<<shift;
+   l+=sign ? -delta : delta+2;
+  }
+  else
+   l++;
+  for (count=*p++; count>0 && pc<n; count--) line[pc++]=l;
+ }
+ while (pc<n) line[pc++]=l;
+ return line;
+#else
+ UNUSED(L); UNUSED(n);
+ return f->lineinfo;
+#endif
+}
+
+#ifdef LUA_OPTIMIZE_DEBUG
+/* append one (line,count) group in the format written by lcode.c */
+static int packgroup(unsigned char* out, int lastline, int line, int count)
+{
+ int n=0;
+ int delta=line-lastline-1;
+ if (delta)
+ {
+  if (delta<0)
+  {
+   delta=-delta-1;
+   out[n++]=(INFO_DELTA_MASK|INFO_SIGN_MASK)|(delta & INFO_DELTA_6BITS);
+  }
+  else
+  {
+   delta=delta-1;
+   out[n++]=INFO_DELTA_MASK|(delta & INFO_DELTA_6BITS);
+  }
+  delta>>=6;
+  while (delta)
+  {
+   out[n++]=INFO_DELTA_MASK|(delta & INFO_DELTA_7BITS);
+   delta>>=7;
+  }
+ }
+ out[n++]=(unsigned char)count;
+ return n;
+}
+
+static unsigned char* packlines(lua_State* L, const int* line, int n)
+{
+ /* worst case is a 6 byte group per instruction plus the terminator */
+ unsigned char* buf=luaM_newvector(L,6*n+1,unsigned char);
+ unsigned char* out;
+ int pc=0,len=0,lastline=0;
+ while (pc<n)
+ {
+  int count=1;
+  while (pc+count<n && line[pc+count]==line[pc] && count<INFO_MAX_LINECNT) count++;
+  len+=packgroup(buf+len,lastline,line[pc],count);
+  lastline=line[pc];
+  pc+=count;
+ }
+ buf[len++]=0;
+ out=luaM_newvector(L,len,unsigned char);
+ memcpy(out,buf,len);
+ luaM_freearray(L,buf,6*n+1,unsigned char);
+ return out;
+}
+#endif
+
+/* remove the unmarked instructions of f, fixing jumps, lines and locals */
+static void compact(lua_State* L, Proto* f, Code* c, const char* keep)
+{
+ int* map=luaM_newvector(L,c->n+1,int);
+ Instruction* code;
+ int pc,n=0;
+ for (pc=0; pc<c->n; pc++) if (keep[pc]) n++;
+ /* removed instructions map to the next kept one */
+ map[c->n]=n;
+ for (pc=c->n-1; pc>=0; pc--) map[pc]=keep[pc] ? --n : n;
+ n=map[c->n];
+ code=luaM_newvector(L,n,Instruction);
+ for (pc=0; pc<c->n; pc++)
+ {
+  Instruction i=c->code[pc];
+  if (!keep[pc]) continue;
+  if (isjump(i)) SETARG_sBx(i,map[jumptarget(i,pc)]-map[pc]-1);
+  code[map[pc]]=i;
+  if (c->line) c->line[map[pc]]=c->line[pc];
+ }
+ for (pc=0; pc<f->sizelocvars; pc++)
+ {
+  f->locvars[pc].startpc=map[f->locvars[pc].startpc];
+  f->locvars[pc].endpc=map[f->locvars[pc].endpc];
+ }
+ luaM_freearray(L,map,c->n+1,int);
+ luaM_freearray(L,c->code,c->n,Instruction);
+ c->code=code;
+ c->n=n;
+}
+
+static void OptimizeCode(lua_State* L, Proto* f)
+{
+ Code c;
+ char *pinned,*live,*istarget,*keep;
+ int pc,n=f->sizecode;
+ Instruction* orig=f->code;
+ int origsize=f->sizecode;
+ int* origlocs;
+#ifndef LUA_OPTIMIZE_DEBUG
+ int* origline=f->lineinfo;
+ int origlinesize=f->sizelineinfo;
+#endif
+ if (n==0) return;
+ c.n=n;
+ c.code=luaM_newvector(L,n,Instruction);
+ memcpy(c.code,f->code,n*sizeof(Instruction));
+ c.line=unpacklines(L,f,n);
+#ifndef LUA_OPTIMIZE_DEBUG
+ if (c.line!=NULL)
+ {
+  c.line=luaM_newvector(L,n,int);
+  memcpy(c.line,f->lineinfo,n*sizeof(int));
+ }
+#endif
+ pinned=luaM_newvector(L,4*n,char);
+ memset(pinned,0,4*n);
+ live=pinned+n; istarget=live+n; keep=istarget+n;
+ /* compact() remaps the local variable ranges in place */
+ origlocs=luaM_newvector(L,2*f->sizelocvars+1,int);
+ for (pc=0; pc<f->sizelocvars; pc++)
+ {
+  origlocs[2*pc]=f->locvars[pc].startpc;
+  origlocs[2*pc+1]=f->locvars[pc].endpc;
+ }
+ markpinned(f,&c,pinned);
+ threadjumps(&c,pinned);
+ markreachable(L,&c,live);
+ for (pc=0; pc<n; pc++)
+  if (live[pc] && isjump(c.code[pc])) istarget[jumptarget(c.code[pc],pc)]=1;
+ for (pc=0; pc<n; pc++)
+  keep[pc]=pinned[pc] || (live[pc] && !isnop(&c,pc,istarget));
+ compact(L,f,&c,keep);
+ luaM_freearray(L,pinned,4*n,char);
+
+ f->code=c.code;
+ f->sizecode=c.n;
+#ifndef LUA_OPTIMIZE_DEBUG
+ /* the check wants as many lines as instructions; c.line has room for n */
+ if (c.line!=NULL)
+ {
+  f->lineinfo=c.line;
+  f->sizelineinfo=c.n;
+ }
+#endif
+ if (!luaG_checkcode(f))		/* should not happen; keep the original */
+ {
+  f->code=orig;
+  f->sizecode=origsize;
+#ifndef LUA_OPTIMIZE_DEBUG
+  if (c.line!=NULL)
+  {
+   f->lineinfo=origline;
+   f->sizelineinfo=origlinesize;
+  }
+#endif
+  for (pc=0; pc<f->sizelocvars; pc++)
+  {
+   f->locvars[pc].startpc=origlocs[2*pc];
+   f->locvars[pc].endpc=origlocs[2*pc+1];
+  }
+  luaM_freearray(L,origlocs,2*f->sizelocvars+1,int);
+  luaM_freearray(L,c.code,c.n,Instruction);
+  if (c.line!=NULL) luaM_freearray(L,c.line,n,int);
+  return;
+ }
+ luaM_freearray(L,origlocs,2*f->sizelocvars+1,int);
+ luaM_freearray(L,orig,origsize,Instruction);
+#ifdef LUA_OPTIMIZE_DEBUG
+ if (c.line!=NULL)
+ {
+  luaM_freearray(L,f->packedlineinfo,strlen((char*)f->packedlineinfo)+1,unsigned char);
+  f->packedlineinfo=packlines(L,c.line,c.n);
+  luaM_freearray(L,c.line,n,int);
+ }
+#else
+ if (c.line!=NULL)
+ {
+  /* shrink the line info installed for the check to its new size */
+  f->lineinfo=luaM_newvector(L,c.n,int);
+  memcpy(f->lineinfo,c.line,c.n*sizeof(int));
+  luaM_freearray(L,c.line,n,int);
+  luaM_freearray(L,origline,origlinesize,int);
+ }
+#endif
+}
+
+void OptimizeFunction(lua_State* L, Proto* f)
+{
+ int i;
+ OptimizeCode(L,f);
+ for (i=0; i<f->sizep; i++) OptimizeFunction(L,f->p[i]);
+}
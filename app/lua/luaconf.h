@@ -374,6 +374,16 @@ extern int readline4lua(const char *prompt, char *buffer, int length);
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 
 
+/*
+@@ LUAI_COMPACTARRAY is the smallest array part that the collector stores
+@* compactly, as one int per slot, when the table only holds integers there.
+** CHANGE it if you want more or fewer tables to use compact arrays; 0
+** disables them. Small arrays gain little and are more likely to need
+** converting back when something else is stored in them.
+*/
+#define LUAI_COMPACTARRAY	16
+
+
 
 /*
 @@ LUA_COMPAT_GETN controls compatibility with old getn behavior.
@@ -598,6 +608,18 @@ extern int readline4lua(const char *prompt, char *buffer, int length);
 #define LUAI_UACNUMBER	LUA_NUMBER
 
 
+/*
+@@ LUA_DUALNUMBER keeps numbers with an exact int value as ints inside
+@* the VM, so that loops, counters and indexing avoid floating point.
+** CHANGE it (undefine it) if you want every number held as a double.
+** The int representation is not visible to Lua code or the C API;
+** arithmetic falls back to doubles on overflow or non-integer operands.
+*/
+#if !defined LUA_NUMBER_INTEGRAL && !defined LUA_PACK_VALUE
+#define LUA_DUALNUMBER
+#endif
+
+
 /*
 @@ LUA_NUMBER_SCAN is the format for reading numbers.
 @@ LUA_NUMBER_FMT is the format for writing numbers.
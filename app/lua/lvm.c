@@ -26,6 +26,7 @@
 #include "ltm.h"
 #include "lvm.h"
 #include "lrotable.h"
+#include "user_modules.h"
 
 
 /* limit for table tag-method chains (to avoid loops) */
@@ -55,7 +56,7 @@ const TValue *luaV_tonumber (const TValue *obj, TValue *n) {
   lua_Number num;
   if (ttisnumber(obj)) return obj;
   if (ttisstring(obj) && luaO_str2d(svalue(obj), &num)) {
-    setnvalue(n, num);
+    setnumvalue(n, num);
     return n;
   }
   else
@@ -128,11 +129,12 @@ static void callTM (lua_State *L, const TValue *f, const TValue *p1,
 void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
   int loop;
   TValue temp;
+  TValue v;  /* for a value from a compact array */
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;
     if (ttistable(t) || ttisrotable(t)) {  /* `t' is a table? */
       void *h = ttistable(t) ? hvalue(t) : rvalue(t);
-      const TValue *res = ttistable(t) ? luaH_get((Table*)h, key) : luaH_get_ro(h, key); /* do a primitive get */
+      const TValue *res = ttistable(t) ? luaH_get((Table*)h, key, &v) : luaH_get_ro(h, key); /* do a primitive get */
       if (!ttisnil(res) ||  /* result is no nil? */
           (tm = fasttm(L, ttistable(t) ? ((Table*)h)->metatable : (Table*)luaR_getmeta(h), TM_INDEX)) == NULL) { /* or no TM? */
         setobj2s(L, val, res);
@@ -171,7 +173,7 @@ void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
           L->top--;
           unfixedstack(L);
           setobj2t(L, oldval, val);
-          ((Table *)h)->flags = 0;
+          invalidateTMcache((Table *)h);
           luaC_barriert(L, (Table*)h, val);
         }
         return;
@@ -257,6 +259,10 @@ static int l_strcmp (const TString *ls, const TString *rs) {
 
 int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   int res;
+#ifdef LUA_DUALNUMBER
+  if (ttisint(l) && ttisint(r))
+    return ivalue(l) < ivalue(r);
+#endif
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
@@ -271,6 +277,10 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
 
 static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
   int res;
+#ifdef LUA_DUALNUMBER
+  if (ttisint(l) && ttisint(r))
+    return ivalue(l) <= ivalue(r);
+#endif
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
@@ -290,7 +300,12 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
   lua_assert(ttype(t1) == ttype(t2));
   switch (ttype(t1)) {
     case LUA_TNIL: return 1;
-    case LUA_TNUMBER: return luai_numeq(nvalue(t1), nvalue(t2));
+    case LUA_TNUMBER:
+#ifdef LUA_DUALNUMBER
+      if (ttisint(t1) && ttisint(t2))
+        return ivalue(t1) == ivalue(t2);
+#endif
+      return luai_numeq(nvalue(t1), nvalue(t2));
     case LUA_TBOOLEAN: return bvalue(t1) == bvalue(t2);  /* true must be 1 !! */
     case LUA_TROTABLE:
       return rvalue(t1) == rvalue(t2);
@@ -392,6 +407,76 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 
 
 
+#ifdef LUA_DUALNUMBER
+/*
+** Int versions of the arithmetic operators. Each stores the result in `*r'
+** and returns 1, or returns 0 when the double operation would not give an
+** int (overflow, a fraction or -0) and must be used instead.
+*/
+static int intadd (int a, int b, int *r) {
+  int s = cast_int(cast(unsigned int, a) + cast(unsigned int, b));
+  if (((a ^ s) & (b ^ s)) < 0) return 0;  /* overflow */
+  *r = s;
+  return 1;
+}
+
+
+static int intsub (int a, int b, int *r) {
+  int s = cast_int(cast(unsigned int, a) - cast(unsigned int, b));
+  if (((a ^ b) & (a ^ s)) < 0) return 0;  /* overflow */
+  *r = s;
+  return 1;
+}
+
+
+static int intmul (int a, int b, int *r) {
+  long long p = (long long)a * b;
+  if (p != cast_int(p) || (p == 0 && (a | b) < 0))  /* overflow or -0 */
+    return 0;
+  *r = cast_int(p);
+  return 1;
+}
+
+
+static int intdiv (int a, int b, int *r) {
+  if (b == 0 || b == -1 || a == 0 || a % b != 0)  /* inf, -0 or fraction */
+    return 0;
+  *r = a / b;
+  return 1;
+}
+
+
+static int intmod (int a, int b, int *r) {
+  int m;
+  if (b == 0) return 0;  /* NaN */
+  m = (b == -1) ? 0 : a % b;  /* INT_MIN % -1 may trap */
+  if (m != 0 && (m ^ b) < 0) m += b;  /* result takes the sign of b */
+  *r = m;
+  return 1;
+}
+
+
+#define intpow(a,b,r)	0
+
+
+/*
+** Make the limit of a `for' loop with an int step an int, if the loop
+** runs the same with it: a fractional limit is rounded towards the start.
+*/
+static int forlimit (TValue *o, int step) {
+  lua_Number f;
+  if (ttisint(o)) return 1;
+  f = (0 < step) ? floor(nvalue(o)) : -floor(-nvalue(o));
+  if (f >= -2147483648.0 && f <= 2147483647.0) {  /* not NaN either */
+    setivalue(o, cast_int(f));
+    return 1;
+  }
+  return 0;
+}
+#endif
+
+
+
 /*
 ** some macros for common tasks in `luaV_execute'
 */
@@ -409,13 +494,34 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 #define KBx(i)	check_exp(getBMode(GET_OPCODE(i)) == OpArgK, k+GETARG_Bx(i))
 
 
+#ifdef LUA_USE_MODULES_PERF
+/* jumps also save the pc, so that loops show up in the perf profile */
+#define dojump(L,pc,i)	{(pc) += (i); L->savedpc = (pc); luai_threadyield(L);}
+#else
 #define dojump(L,pc,i)	{(pc) += (i); luai_threadyield(L);}
+#endif
 
 
 #define Protect(x)	{ L->savedpc = pc; {x;}; base = L->base; }
 
 
-#define arith_op(op,tm) { \
+#ifdef LUA_DUALNUMBER
+#define arith_op(op,iop,tm) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        int ir; \
+        if (ttisint(rb) && ttisint(rc) && iop(ivalue(rb), ivalue(rc), &ir)) { \
+          setivalue(ra, ir); \
+        } \
+        else if (ttisnumber(rb) && ttisnumber(rc)) { \
+          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        } \
+        else \
+          Protect(Arith(L, ra, rb, rc, tm)); \
+      }
+#else
+#define arith_op(op,iop,tm) { \
         TValue *rb = RKB(i); \
         TValue *rc = RKC(i); \
         if (ttisnumber(rb) && ttisnumber(rc)) { \
@@ -425,6 +531,7 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
         else \
           Protect(Arith(L, ra, rb, rc, tm)); \
       }
+#endif
 
 
 
@@ -528,31 +635,37 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         continue;
       }
       case OP_ADD: {
-        arith_op(luai_numadd, TM_ADD);
+        arith_op(luai_numadd, intadd, TM_ADD);
         continue;
       }
       case OP_SUB: {
-        arith_op(luai_numsub, TM_SUB);
+        arith_op(luai_numsub, intsub, TM_SUB);
         continue;
       }
       case OP_MUL: {
-        arith_op(luai_nummul, TM_MUL);
+        arith_op(luai_nummul, intmul, TM_MUL);
         continue;
       }
       case OP_DIV: {
-        arith_op(luai_lnumdiv, TM_DIV);
+        arith_op(luai_lnumdiv, intdiv, TM_DIV);
         continue;
       }
       case OP_MOD: {
-        arith_op(luai_lnummod, TM_MOD);
+        arith_op(luai_lnummod, intmod, TM_MOD);
         continue;
       }
       case OP_POW: {
-        arith_op(luai_numpow, TM_POW);
+        arith_op(luai_numpow, intpow, TM_POW);
         continue;
       }
       case OP_UNM: {
         TValue *rb = RB(i);
+#ifdef LUA_DUALNUMBER
+        if (ttisint(rb) && ivalue(rb) != 0 && ivalue(rb) != INT_MIN) {
+          setivalue(ra, -ivalue(rb));  /* -0 and -INT_MIN need a double */
+        }
+        else
+#endif
         if (ttisnumber(rb)) {
           lua_Number nb = nvalue(rb);
           setnvalue(ra, luai_numunm(nb));
@@ -572,11 +685,11 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         switch (ttype(rb)) {
           case LUA_TTABLE: 
           case LUA_TROTABLE: {
-            setnvalue(ra, ttistable(rb) ? cast_num(luaH_getn(hvalue(rb))) : cast_num(luaH_getn_ro(rvalue(rb))));
+            setivalue(ra, ttistable(rb) ? luaH_getn(hvalue(rb)) : luaH_getn_ro(rvalue(rb)));
             break;
           }
           case LUA_TSTRING: {
-            setnvalue(ra, cast_num(tsvalue(rb)->len));
+            setivalue(ra, cast_int(tsvalue(rb)->len));
             break;
           }
           default: {  /* try metamethod */
@@ -710,6 +823,21 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         }
       }
       case OP_FORLOOP: {
+#ifdef LUA_DUALNUMBER
+        if (ttisint(ra) && ttisint(ra+1) && ttisint(ra+2)) {
+          int idx = ivalue(ra), limit = ivalue(ra+1), step = ivalue(ra+2);
+          /* is idx+step within limit? Unsigned, as the sum may overflow */
+          if (0 < step ? idx <= limit &&
+                         cast(unsigned int, limit) - idx >= cast(unsigned int, step)
+                       : limit <= idx &&
+                         cast(unsigned int, idx) - limit >= 0u - step) {
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setivalue(ra, idx + step);  /* update internal index... */
+            setivalue(ra+3, idx + step);  /* ...and external index */
+          }
+          continue;
+        }
+#endif
         lua_Number step = nvalue(ra+2);
         lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
         lua_Number limit = nvalue(ra+1);
@@ -732,6 +860,17 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           luaG_runerror(L, LUA_QL("for") " limit must be a number");
         else if (!tonumber(pstep, ra+2))
           luaG_runerror(L, LUA_QL("for") " step must be a number");
+#ifdef LUA_DUALNUMBER
+        {
+          int idx;
+          if (ttisint(init) && ttisint(pstep) && forlimit(ra+1, ivalue(pstep)) &&
+              intsub(ivalue(init), ivalue(pstep), &idx)) {
+            setivalue(ra, idx);
+            dojump(L, pc, GETARG_sBx(i));
+            continue;
+          }
+        }
+#endif
         setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
         dojump(L, pc, GETARG_sBx(i));
         continue;
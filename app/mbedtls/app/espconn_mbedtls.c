@@ -48,6 +48,23 @@ static espconn_msg *plink_server = NULL;
 static pmbedtls_parame def_certificate = NULL;
 static pmbedtls_parame def_private_key = NULL;
 
+/*client sessions kept for resumption, keyed by server address*/
+typedef struct _mbedtls_cache_entry{
+	uint8 ip[4];
+	uint16 port;
+	uint8 verified;
+	uint32 stamp;
+	mbedtls_ssl_session session;
+}mbedtls_cache_entry;
+
+#define MBEDTLS_SESSION_CACHE_DEF	2
+#define MBEDTLS_SESSION_CACHE_MAX	8
+#define MBEDTLS_SESSION_EXPORT_MAGIC	0x31534C54	/*"TLS1"*/
+
+static mbedtls_cache_entry *session_cache = NULL;
+static uint8 session_cache_max = MBEDTLS_SESSION_CACHE_DEF;
+static uint32 session_cache_stamp = 0;
+
 #if defined(ESP8266_PLATFORM)
 #define MBEDTLS_SSL_OUTBUFFER_LEN  ( MBEDTLS_SSL_PLAIN_ADD               \
                         + MBEDTLS_SSL_COMPRESSION_ADD               \
@@ -386,6 +403,372 @@ static espconn_msg* mbedtls_msg_find(int sock)
 	return NULL;
 }
 
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+#define MBEDTLS_CACHE_TICKETS
+#endif
+
+static void mbedtls_cache_clear(mbedtls_cache_entry *entry)
+{
+	lwIP_ASSERT(entry);
+#if defined(MBEDTLS_CACHE_TICKETS)
+	if (entry->session.ticket != NULL)
+		os_free(entry->session.ticket);
+#endif
+	mbedtls_zeroize(entry, sizeof(mbedtls_cache_entry));
+}
+
+static void mbedtls_cache_free(void)
+{
+	uint8 index = 0;
+	if (session_cache == NULL)
+		return;
+
+	for (index = 0; index < session_cache_max; index ++)
+		mbedtls_cache_clear(&session_cache[index]);
+	os_free(session_cache);
+	session_cache = NULL;
+}
+
+/******************************************************************************
+ * FunctionName : mbedtls_cache_find
+ * Description  : look up the cached session of a server
+ * Parameters   : ip, port -- the server address
+ *                create -- true to hand out a free or the least recently used
+ *                          entry when the server has none
+ * Returns      : the cache entry, NULL if there is none
+*******************************************************************************/
+static mbedtls_cache_entry *mbedtls_cache_find(const uint8 *ip, uint16 port, bool create)
+{
+	mbedtls_cache_entry *oldest = NULL;
+	uint8 index = 0;
+
+	if (session_cache == NULL){
+		if (!create || session_cache_max == 0)
+			return NULL;
+		session_cache = (mbedtls_cache_entry *)os_zalloc(session_cache_max * sizeof(mbedtls_cache_entry));
+		if (session_cache == NULL)
+			return NULL;
+	}
+
+	for (index = 0; index < session_cache_max; index ++){
+		mbedtls_cache_entry *entry = &session_cache[index];
+		if (entry->stamp != 0 && entry->port == port && os_memcmp(entry->ip, ip, 4) == 0)
+			return entry;
+		if (oldest == NULL || entry->stamp < oldest->stamp)
+			oldest = entry;
+	}
+
+	if (!create)
+		return NULL;
+
+	mbedtls_cache_clear(oldest);
+	os_memcpy(oldest->ip, ip, 4);
+	oldest->port = port;
+	return oldest;
+}
+
+static bool mbedtls_cache_store(mbedtls_cache_entry *entry, const mbedtls_ssl_session *session, uint8 verified)
+{
+	lwIP_ASSERT(entry);
+	lwIP_ASSERT(session);
+#if defined(MBEDTLS_CACHE_TICKETS)
+	if (entry->session.ticket != NULL)
+		os_free(entry->session.ticket);
+#endif
+	os_memcpy(&entry->session, session, sizeof(mbedtls_ssl_session));
+	/*the certificate was checked in the full handshake, only its result is kept*/
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+	entry->session.peer_cert = NULL;
+#endif
+#if defined(MBEDTLS_CACHE_TICKETS)
+	entry->session.ticket = NULL;
+	if (session->ticket != NULL && session->ticket_len != 0){
+		entry->session.ticket = (unsigned char *)os_malloc(session->ticket_len);
+		if (entry->session.ticket == NULL){
+			mbedtls_cache_clear(entry);
+			return false;
+		}
+		os_memcpy(entry->session.ticket, session->ticket, session->ticket_len);
+	} else{
+		entry->session.ticket_len = 0;
+	}
+#endif
+	entry->verified = verified;
+	entry->stamp = ++session_cache_stamp;
+	return true;
+}
+
+static void mbedtls_cache_resume(espconn_msg *Threadmsg)
+{
+	struct espconn *espconn = Threadmsg->pespconn;
+	pmbedtls_msg TLSmsg = Threadmsg->pssl;
+	mbedtls_cache_entry *entry = NULL;
+
+	if (espconn == NULL || espconn->proto.tcp == NULL)
+		return;
+
+	entry = mbedtls_cache_find(espconn->proto.tcp->remote_ip, espconn->proto.tcp->remote_port, false);
+	/*a session is only offered under the verification setting it was made with*/
+	if (entry == NULL || entry->verified != ssl_option.client.cert_ca_sector.flag)
+		return;
+
+	if (mbedtls_ssl_set_session(&TLSmsg->ssl, &entry->session) == 0)
+		entry->stamp = ++session_cache_stamp;
+}
+
+static void mbedtls_cache_save(espconn_msg *Threadmsg)
+{
+	struct espconn *espconn = Threadmsg->pespconn;
+	pmbedtls_msg TLSmsg = Threadmsg->pssl;
+	const mbedtls_ssl_session *session = TLSmsg->ssl.session;
+	mbedtls_cache_entry *entry = NULL;
+	size_t ticket_len = 0;
+
+	if (espconn == NULL || espconn->proto.tcp == NULL || session == NULL)
+		return;
+
+#if defined(MBEDTLS_CACHE_TICKETS)
+	ticket_len = session->ticket_len;
+#endif
+	if (session->id_len == 0 && ticket_len == 0)
+		return;
+
+	entry = mbedtls_cache_find(espconn->proto.tcp->remote_ip, espconn->proto.tcp->remote_port, true);
+	if (entry != NULL)
+		mbedtls_cache_store(entry, session, ssl_option.client.cert_ca_sector.flag);
+}
+
+static void mbedtls_cache_drop(espconn_msg *Threadmsg)
+{
+	struct espconn *espconn = Threadmsg->pespconn;
+	mbedtls_cache_entry *entry = NULL;
+
+	if (espconn == NULL || espconn->proto.tcp == NULL)
+		return;
+
+	entry = mbedtls_cache_find(espconn->proto.tcp->remote_ip, espconn->proto.tcp->remote_port, false);
+	if (entry != NULL)
+		mbedtls_cache_clear(entry);
+}
+
+static uint8 *mbedtls_cache_put(uint8 *buffer, uint32 value, uint8 len)
+{
+	while (len --){
+		*buffer ++ = value & 0xFF;
+		value >>= 8;
+	}
+	return buffer;
+}
+
+static const uint8 *mbedtls_cache_get(const uint8 *buffer, uint32 *value, uint8 len)
+{
+	uint8 shift = 0;
+	*value = 0;
+	while (len --){
+		*value |= (uint32)(*buffer ++) << shift;
+		shift += 8;
+	}
+	return buffer;
+}
+
+static uint16 mbedtls_cache_entry_len(const mbedtls_cache_entry *entry)
+{
+	/*ip, port, verified, ciphersuite, compression, id_len, id, master, verify_result*/
+	uint16 len = 4 + 2 + 1 + 2 + 1 + 1 + entry->session.id_len + 48 + 4;
+#if defined(MBEDTLS_CACHE_TICKETS)
+	len += 4 + 2 + entry->session.ticket_len;
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+	len ++;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+	len ++;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+	len ++;
+#endif
+	return len;
+}
+
+/******************************************************************************
+ * FunctionName : espconn_secure_session_cache
+ * Description  : set how many client sessions are kept for resumption. The
+ *                sessions cached so far are dropped.
+ * Parameters   : count -- number of sessions, 0 turns resumption off and a
+ *                         negative value only queries the setting
+ * Returns      : the previous number of sessions
+*******************************************************************************/
+int espconn_secure_session_cache(int count)
+{
+	int previous = session_cache_max;
+
+	if (count < 0)
+		return previous;
+
+	mbedtls_cache_free();
+	session_cache_max = count > MBEDTLS_SESSION_CACHE_MAX ? MBEDTLS_SESSION_CACHE_MAX : count;
+	return previous;
+}
+
+/******************************************************************************
+ * FunctionName : espconn_secure_session_export
+ * Description  : serialize the cached client sessions, oldest first, so they
+ *                can be kept in RTC memory or flash
+ * Parameters   : buffer -- where to write, NULL to get the size needed
+ *                length -- the size of buffer
+ * Returns      : the number of bytes written or needed, 0 if buffer is too small
+*******************************************************************************/
+uint16 espconn_secure_session_export(uint8 *buffer, uint16 length)
+{
+	uint8 *pbuf = buffer;
+	uint32 last = 0;
+	uint16 total = 4 + 1;
+	uint8 count = 0;
+	uint8 index = 0;
+
+	for (index = 0; session_cache != NULL && index < session_cache_max; index ++){
+		if (session_cache[index].stamp != 0){
+			total += mbedtls_cache_entry_len(&session_cache[index]);
+			count ++;
+		}
+	}
+
+	if (buffer == NULL)
+		return total;
+	if (length < total)
+		return 0;
+
+	pbuf = mbedtls_cache_put(pbuf, MBEDTLS_SESSION_EXPORT_MAGIC, 4);
+	*pbuf ++ = count;
+	while (count --){
+		const mbedtls_cache_entry *entry = NULL;
+		const mbedtls_ssl_session *session = NULL;
+		for (index = 0; index < session_cache_max; index ++){
+			if (session_cache[index].stamp > last &&
+				(entry == NULL || session_cache[index].stamp < entry->stamp))
+				entry = &session_cache[index];
+		}
+		last = entry->stamp;
+		session = &entry->session;
+
+		os_memcpy(pbuf, entry->ip, 4);
+		pbuf += 4;
+		pbuf = mbedtls_cache_put(pbuf, entry->port, 2);
+		*pbuf ++ = entry->verified;
+		pbuf = mbedtls_cache_put(pbuf, session->ciphersuite, 2);
+		*pbuf ++ = session->compression;
+		*pbuf ++ = session->id_len;
+		os_memcpy(pbuf, session->id, session->id_len);
+		pbuf += session->id_len;
+		os_memcpy(pbuf, session->master, 48);
+		pbuf += 48;
+		pbuf = mbedtls_cache_put(pbuf, session->verify_result, 4);
+#if defined(MBEDTLS_CACHE_TICKETS)
+		pbuf = mbedtls_cache_put(pbuf, session->ticket_lifetime, 4);
+		pbuf = mbedtls_cache_put(pbuf, session->ticket_len, 2);
+		if (session->ticket_len != 0)
+			os_memcpy(pbuf, session->ticket, session->ticket_len);
+		pbuf += session->ticket_len;
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+		*pbuf ++ = session->mfl_code;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+		*pbuf ++ = session->trunc_hmac;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+		*pbuf ++ = session->encrypt_then_mac;
+#endif
+	}
+	return total;
+}
+
+/******************************************************************************
+ * FunctionName : espconn_secure_session_import
+ * Description  : add client sessions written by espconn_secure_session_export
+ *                to the cache
+ * Parameters   : buffer -- the serialized sessions
+ *                length -- the size of buffer
+ * Returns      : the number of sessions imported, -1 if the data is invalid
+*******************************************************************************/
+sint8 espconn_secure_session_import(const uint8 *buffer, uint16 length)
+{
+	const uint8 *pbuf = buffer;
+	const uint8 *pend = buffer + length;
+	uint32 value = 0;
+	uint8 count = 0;
+	sint8 imported = 0;
+
+	if (buffer == NULL || length < 4 + 1)
+		return -1;
+
+	pbuf = mbedtls_cache_get(pbuf, &value, 4);
+	if (value != MBEDTLS_SESSION_EXPORT_MAGIC)
+		return -1;
+	count = *pbuf ++;
+
+	while (count --){
+		mbedtls_ssl_session session;
+		mbedtls_cache_entry *entry = NULL;
+		const uint8 *ip = NULL;
+		uint16 port = 0;
+		uint8 verified = 0;
+
+		os_bzero(&session, sizeof(session));
+		if (pend - pbuf < 4 + 2 + 1 + 2 + 1 + 1)
+			return -1;
+		ip = pbuf;
+		pbuf += 4;
+		pbuf = mbedtls_cache_get(pbuf, &value, 2);
+		port = value;
+		verified = *pbuf ++;
+		pbuf = mbedtls_cache_get(pbuf, &value, 2);
+		session.ciphersuite = value;
+		session.compression = *pbuf ++;
+		session.id_len = *pbuf ++;
+		if (session.id_len > sizeof(session.id) || pend - pbuf < session.id_len + 48 + 4)
+			return -1;
+		os_memcpy(session.id, pbuf, session.id_len);
+		pbuf += session.id_len;
+		os_memcpy(session.master, pbuf, 48);
+		pbuf += 48;
+		pbuf = mbedtls_cache_get(pbuf, &value, 4);
+		session.verify_result = value;
+#if defined(MBEDTLS_CACHE_TICKETS)
+		if (pend - pbuf < 4 + 2)
+			return -1;
+		pbuf = mbedtls_cache_get(pbuf, &value, 4);
+		session.ticket_lifetime = value;
+		pbuf = mbedtls_cache_get(pbuf, &value, 2);
+		session.ticket_len = value;
+		if (pend - pbuf < session.ticket_len)
+			return -1;
+		if (session.ticket_len != 0)
+			session.ticket = (unsigned char *)pbuf;
+		pbuf += session.ticket_len;
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+		if (pbuf >= pend)
+			return -1;
+		session.mfl_code = *pbuf ++;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+		if (pbuf >= pend)
+			return -1;
+		session.trunc_hmac = *pbuf ++;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+		if (pbuf >= pend)
+			return -1;
+		session.encrypt_then_mac = *pbuf ++;
+#endif
+		entry = mbedtls_cache_find(ip, port, true);
+		if (entry != NULL && mbedtls_cache_store(entry, &session, verified))
+			imported ++;
+	}
+	return imported;
+}
+
 void mbedtls_handshake_heap(mbedtls_ssl_context *ssl)
 {
 	os_printf("mbedtls_handshake_heap %d %d\n", ssl->state, system_get_free_heap_size());
@@ -439,6 +822,8 @@ static void mbedtls_fail_info(espconn_msg *pinfo, int ret)
 			os_printf("server handshake failed!\n");
 		} else {
 			os_printf("client handshake failed!\n");
+			/*do not offer the session that may have caused this again*/
+			mbedtls_cache_drop(pinfo);
 		}
 	}
 
@@ -497,6 +882,7 @@ static int mbedtls_hanshake_finished(mbedtls_msg *msg)
     ssl->out_len = ssl->out_buf + 11;
     ssl->out_iv  = ssl->out_buf + 13;
     ssl->out_msg = ssl->out_buf + 29;
+    ssl->out_content_len = MBEDTLS_SSL_PLAIN_ADD;
     os_memcpy(ssl->out_ctr, finished->finished_buf, finished->finished_len);
     mbedtls_finished_free(&msg->pfinished);
 
@@ -521,11 +907,26 @@ static void mbedtls_handshake_succ(mbedtls_ssl_context *ssl)
 		ssl->session_negotiate = NULL;
     }
 
+    /*session_in/session_out still point here, so only drop the bulky parts*/
     if( ssl->session )
     {
-        mbedtls_ssl_session_free( ssl->session );
-        os_free( ssl->session );
-		ssl->session = NULL;
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+        if( ssl->session->peer_cert != NULL )
+        {
+            mbedtls_x509_crt_free( ssl->session->peer_cert );
+            os_free( ssl->session->peer_cert );
+            ssl->session->peer_cert = NULL;
+        }
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+        if( ssl->session->ticket != NULL )
+        {
+            mbedtls_zeroize( ssl->session->ticket, ssl->session->ticket_len );
+            os_free( ssl->session->ticket );
+            ssl->session->ticket = NULL;
+            ssl->session->ticket_len = 0;
+        }
+#endif
     }
 
 #if defined(MBEDTLS_X509_CRT_PARSE_C)
@@ -704,6 +1105,19 @@ exit:
 	}
 }
 
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+static unsigned char mbedtls_mfl_code(uint16 size)
+{
+	switch (size){
+		case 512:	return MBEDTLS_SSL_MAX_FRAG_LEN_512;
+		case 1024:	return MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+		case 2048:	return MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+		case 4096:	return MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+		default:	return MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+	}
+}
+#endif
+
 static bool mbedtls_msg_config(mbedtls_msg *msg)
 {
 	const char *pers = NULL;
@@ -711,6 +1125,7 @@ static bool mbedtls_msg_config(mbedtls_msg *msg)
 	bool load_flag = false;
 	int ret = ESPCONN_OK;
 	mbedtls_auth_info auth_info;
+	struct ssl_packet *packet = NULL;
 
 	/*end_point mode*/
 	if (msg->listen_fd.fd == -1){
@@ -785,6 +1200,19 @@ static bool mbedtls_msg_config(mbedtls_msg *msg)
 	}
 	mbedtls_ssl_conf_rng(&msg->conf, mbedtls_ctr_drbg_random, &msg->ctr_drbg);
 	mbedtls_ssl_conf_dbg(&msg->conf, NULL, NULL);
+
+	/*Size the record buffers, only a client can ask the peer for smaller records*/
+	packet = (auth_type == MBEDTLS_SSL_IS_CLIENT) ? &ssl_option.client : &ssl_option.server;
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+	if (auth_type == MBEDTLS_SSL_IS_CLIENT && packet->receive_size != 0){
+		ret = mbedtls_ssl_conf_max_frag_len(&msg->conf, mbedtls_mfl_code(packet->receive_size));
+		lwIP_REQUIRE_NOERROR(ret, exit);
+	}
+#endif
+	if (packet->send_size != 0){
+		ret = mbedtls_ssl_conf_out_content_len(&msg->conf, packet->send_size);
+		lwIP_REQUIRE_NOERROR(ret, exit);
+	}
 	
 	ret = mbedtls_ssl_setup(&msg->ssl, &msg->conf);
 	lwIP_REQUIRE_NOERROR(ret, exit);
@@ -868,6 +1296,8 @@ int __attribute__((weak)) mbedtls_parse_internal(int socket, sint8 error)
 				}
 				config_flag = mbedtls_msg_config(TLSmsg);
 				if (config_flag){
+					if (Threadmsg->preverse == NULL)
+						mbedtls_cache_resume(Threadmsg);
 //					mbedtls_keep_alive(TLSmsg->fd.fd, 1, SSL_KEEP_IDLE, SSL_KEEP_INTVL, SSL_KEEP_CNT);
 					system_overclock();
 				} else{
@@ -897,6 +1327,8 @@ int __attribute__((weak)) mbedtls_parse_internal(int socket, sint8 error)
 					os_printf("client handshake ok!\n");
 				}
 //				mbedtls_keep_alive(TLSmsg->fd.fd, 0, SSL_KEEP_IDLE, SSL_KEEP_INTVL, SSL_KEEP_CNT);
+				if (Threadmsg->preverse == NULL)
+					mbedtls_cache_save(Threadmsg);
 				mbedtls_session_free(&TLSmsg->psession);
 				mbedtls_handshake_succ(&TLSmsg->ssl);
 #if defined(ESP8266_PLATFORM)
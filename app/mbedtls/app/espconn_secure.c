@@ -40,8 +40,8 @@ static const char mem_debug_file[] ICACHE_RODATA_ATTR = __FILE__;
 #include "sys/espconn_mbedtls.h"
 
 ssl_opt ssl_option = {
-		{NULL, ESPCONN_SECURE_DEFAULT_SIZE, 0, false, 0, false},
-		{NULL, ESPCONN_SECURE_DEFAULT_SIZE, 0, false, 0, false},
+		{NULL, ESPCONN_SECURE_DEFAULT_SIZE, 0, 0, {0, false}, {0, false}},
+		{NULL, ESPCONN_SECURE_DEFAULT_SIZE, 0, 0, {0, false}, {0, false}},
 		0
 };
 
@@ -219,6 +219,69 @@ sint16 ICACHE_FLASH_ATTR espconn_secure_get_size(uint8 level)
 	return max_content_len;
 }
 
+/******************************************************************************
+ * FunctionName : espconn_secure_set_buffers
+ * Description  : set the record buffer sizes of new connections
+ * Parameters   : level -- set for client or server
+ *				  1: client,2:server,3:client and server
+ *				  receive -- largest record asked of the server, 512, 1024,
+ *				  2048 or 4096, the client only, 0 for no request
+ *				  send -- largest record sent, 512 up to 4096, 0 for 4096
+ * Returns      : true or false
+*******************************************************************************/
+bool ICACHE_FLASH_ATTR espconn_secure_set_buffers(uint8 level, uint16 receive, uint16 send)
+{
+	if (level >= ESPCONN_MAX || level <= ESPCONN_IDLE)
+		return false;
+
+	if (receive != 0 && receive != 512 && receive != 1024 && receive != 2048 && receive != 4096)
+		return false;
+
+	if (send != 0 && (send < 512 || send > MBEDTLS_SSL_MAX_CONTENT_LEN))
+		return false;
+
+	if (level == ESPCONN_CLIENT || level == ESPCONN_BOTH){
+		ssl_option.client.receive_size = receive;
+		ssl_option.client.send_size = send;
+	}
+
+	if (level == ESPCONN_SERVER || level == ESPCONN_BOTH){
+		ssl_option.server.receive_size = receive;
+		ssl_option.server.send_size = send;
+	}
+
+	return true;
+}
+
+/******************************************************************************
+ * FunctionName : espconn_secure_get_buffers
+ * Description  : get the record buffer sizes in use by a connection, these
+ * 				  shrink to the negotiated fragment length after the handshake
+ * Parameters   : espconn -- the espconn used to connect with host
+ *				  receive -- receive buffer size
+ *				  send -- send buffer size
+ * Returns      : result
+*******************************************************************************/
+sint8 ICACHE_FLASH_ATTR espconn_secure_get_buffers(struct espconn *espconn, uint16 *receive, uint16 *send)
+{
+	espconn_msg *pnode = NULL;
+	pmbedtls_msg pssl = NULL;
+
+	if (espconn == NULL || receive == NULL || send == NULL)
+		return ESPCONN_ARG;
+
+	if (!espconn_find_connection(espconn, &pnode))
+		return ESPCONN_ARG;
+
+	pssl = pnode->pssl;
+	if (pssl == NULL || pssl->ssl.in_content_len == 0)
+		return ESPCONN_INPROGRESS;
+
+	*receive = pssl->ssl.in_content_len;
+	*send = pssl->ssl.out_content_len;
+	return ESPCONN_OK;
+}
+
 /******************************************************************************
  * FunctionName : espconn_secure_ca_enable
  * Description  : enable the certificate authenticate and set the flash sector
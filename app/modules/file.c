@@ -8,6 +8,8 @@
 #include "c_types.h"
 #include "vfs.h"
 #include "c_string.h"
+#include "c_stdio.h"
+#include "task/task.h"
 
 #include <alloca.h>
 
@@ -167,15 +169,42 @@ static int file_format( lua_State* L )
   return 0;
 }
 
+// Lua: addr, size, cache_pages = fscfg([cache_pages])
 static int file_fscfg (lua_State *L)
 {
   uint32_t phys_addr, phys_size;
+  sint32_t pages = luaL_optinteger( L, 1, -1 );
 
+  luaL_argcheck( L, pages >= -1, 1, "invalid cache size" );
+  if (vfs_fscache( "/FLASH", &pages ) != VFS_RES_OK) {
+    if (pages >= 0)
+      return luaL_error( L, "not supported" );
+    pages = 0;
+  }
   vfs_fscfg("/FLASH", &phys_addr, &phys_size);
 
   lua_pushinteger (L, phys_addr);
   lua_pushinteger (L, phys_size);
-  return 2;
+  lua_pushinteger (L, pages);
+  return 3;
+}
+
+// Lua: free, reserve, idle = fsgc([reserve[, idle]])
+static int file_fsgc (lua_State *L)
+{
+  sint32_t reserve = luaL_optinteger( L, 1, -1 );
+  sint32_t idle = luaL_optinteger( L, 2, -1 );
+  uint32_t free_blocks;
+
+  luaL_argcheck( L, reserve >= -1, 1, "invalid reserve" );
+  luaL_argcheck( L, idle == -1 || (idle > 0 && idle <= 6870947), 2, "invalid idle time" );
+  if (vfs_fsgc( "/FLASH", &reserve, &idle, &free_blocks ) != VFS_RES_OK)
+    return luaL_error( L, "not supported" );
+
+  lua_pushinteger( L, free_blocks );
+  lua_pushinteger( L, reserve );
+  lua_pushinteger( L, idle );
+  return 3;
 }
 
 // Lua: open(filename, mode)
@@ -198,6 +227,13 @@ static int file_open( lua_State* L )
   if(!file_fd){
     lua_pushnil(L);
   } else {
+    // index map for fast seeks: true for all of the file, a number of bytes,
+    // or false for none; without it the file system decides
+    if (lua_isboolean( L, 3 ))
+      vfs_ixmap( file_fd, lua_toboolean( L, 3 ) ? vfs_size( file_fd ) : 0 );
+    else if (!lua_isnoneornil( L, 3 ))
+      vfs_ixmap( file_fd, luaL_checkinteger( L, 3 ) );
+
     file_fd_ud *ud = (file_fd_ud *) lua_newuserdata( L, sizeof( file_fd_ud ) );
     ud->fd = file_fd;
     luaL_getmetatable( L, "file.obj" );
@@ -520,10 +556,11 @@ static int file_writeline( lua_State* L )
   return 1;
 }
 
-// Lua: fsinfo()
+// Lua: remaining, used, total[, stats] = fsinfo([stats])
 static int file_fsinfo( lua_State* L )
 {
   u32_t total, used;
+  struct vfs_fsstats stats;
   if (vfs_fsinfo("", &total, &used)) {
     return luaL_error(L, "file system failed");
   }
@@ -535,7 +572,356 @@ static int file_fsinfo( lua_State* L )
   lua_pushinteger(L, total-used);
   lua_pushinteger(L, used);
   lua_pushinteger(L, total);
-  return 3;
+  if (!lua_toboolean(L, 1) || vfs_fsstats("", &stats) != VFS_RES_OK)
+    return 3;
+
+  lua_createtable(L, 0, 5);
+  lua_pushinteger(L, stats.cache_pages);
+  lua_setfield(L, -2, "cache_pages");
+  lua_pushinteger(L, stats.cache_hits);
+  lua_setfield(L, -2, "cache_hits");
+  lua_pushinteger(L, stats.cache_misses);
+  lua_setfield(L, -2, "cache_misses");
+  lua_pushinteger(L, stats.gc_runs);
+  lua_setfield(L, -2, "gc_runs");
+  lua_pushinteger(L, stats.erases);
+  lua_setfield(L, -2, "erases");
+  return 4;
+}
+
+// ---------------------------------------------------------------------------
+// log files
+//
+// Records are copied into a RAM ring and written out from a low priority
+// task in chunks of whole file system pages, so that a write never rewrites
+// a partially filled page. The log rotates through numbered segment files,
+// name.0 to name.<segments-1>, truncating the oldest when the current one
+// is full.
+
+#define LOG_CHUNK_PAGES 4
+#define LOG_DEFAULT_SEGMENTS 4
+#define LOG_MAX_SEGMENTS 100
+#define LOG_DEFAULT_SEGSIZE 0x10000
+#define LOG_SEGNAME_LEN (FS_OBJ_NAME_LEN - 3)   // room for ".99"
+#define LOG_NAME_LEN (LOG_SEGNAME_LEN + 8)      // and for a drive like "/FLASH/"
+
+typedef struct {
+  int fd;                     // current segment, 0 once closed
+  char *buf;                  // ring of unwritten data
+  uint32_t size;              // of buf
+  uint32_t head;              // oldest unwritten byte in buf
+  uint32_t count;             // unwritten bytes in buf
+  uint32_t chunk;             // bytes written at a time, whole pages
+  uint32_t segsize;           // length of a full segment, a multiple of chunk
+  uint32_t length;            // of the current segment
+  uint32_t dropped;           // bytes that found the ring full or failed to write
+  int self_ref;               // keeps the log while its task is posted
+  uint8_t segments;
+  uint8_t seg;                // number of the current segment
+  char name[LOG_NAME_LEN+1];
+} file_log_ud;
+
+static task_handle_t file_log_task_id;
+
+static void file_log_segname( const file_log_ud *lg, uint8_t seg, char *path )
+{
+  c_sprintf( path, "%s.%u", lg->name, seg );
+}
+
+// Open a segment, with "a+" to continue it or "w+" to start it afresh.
+static int file_log_open_segment( file_log_ud *lg, uint8_t seg, const char *mode )
+{
+  char path[LOG_NAME_LEN+4];
+
+  if (lg->fd)
+    vfs_close( lg->fd );
+  file_log_segname( lg, seg, path );
+  lg->seg = seg;
+  if (!(lg->fd = vfs_open( path, mode )))
+    return FALSE;
+  // "a+" leaves a FatFS file at its start
+  lg->length = vfs_lseek( lg->fd, 0, VFS_SEEK_END );
+  return TRUE;
+}
+
+// Move on to the next segment, truncating it.
+static int file_log_rotate( file_log_ud *lg )
+{
+  if (file_log_open_segment( lg, (lg->seg + 1) % lg->segments, "w+" ))
+    return TRUE;
+  // nowhere to write to, lose what is buffered
+  lg->dropped += lg->count;
+  lg->head = lg->count = 0;
+  return FALSE;
+}
+
+// Write the next chunk, or what there is of it, from the ring. A chunk that
+// follows a partial one (after flush) is shortened to end on a page again.
+// A segment is left as soon as it fills, so that the current one is the only
+// one that is not full when the log is opened again.
+static void file_log_write_chunk( file_log_ud *lg, uint32_t max )
+{
+  uint32_t n, first, w;
+
+  if (lg->length >= lg->segsize && !file_log_rotate( lg ))
+    return;
+  n = lg->chunk - lg->length % lg->chunk;
+  if (n > max)
+    n = max;
+
+  first = lg->size - lg->head;
+  if (first > n)
+    first = n;
+  w = vfs_write( lg->fd, lg->buf + lg->head, first );
+  if (w == first && n > first)
+    w += vfs_write( lg->fd, lg->buf, n - first );
+  if (w == n) {
+    lg->length += n;
+  } else {
+    lg->dropped += n;
+    lg->length = vfs_lseek( lg->fd, 0, VFS_SEEK_END );
+  }
+  lg->head = (lg->head + n) % lg->size;
+  lg->count -= n;
+  if (lg->length >= lg->segsize)
+    file_log_rotate( lg );
+}
+
+// bytes that make up the next chunk
+static uint32_t file_log_next_chunk( const file_log_ud *lg )
+{
+  return lg->length >= lg->segsize ? lg->chunk : lg->chunk - lg->length % lg->chunk;
+}
+
+static void file_log_task( task_param_t param, uint8 prio )
+{
+  file_log_ud *lg = (file_log_ud *)param;
+  lua_State *L = lua_getstate();
+
+  // one chunk per dispatch, giving other tasks their turn in between
+  if (lg->fd && lg->count >= file_log_next_chunk( lg ))
+    file_log_write_chunk( lg, lg->count );
+  if (lg->fd && lg->count >= file_log_next_chunk( lg ) &&
+      task_post_low( file_log_task_id, (task_param_t)lg ))
+    return;
+  luaL_unref( L, LUA_REGISTRYINDEX, lg->self_ref );
+  lg->self_ref = LUA_NOREF;
+}
+
+static void file_log_flush( file_log_ud *lg )
+{
+  while (lg->fd && lg->count)
+    file_log_write_chunk( lg, lg->count );
+  if (lg->fd)
+    vfs_flush( lg->fd );
+}
+
+static void file_log_close( file_log_ud *lg )
+{
+  file_log_flush( lg );
+  if (lg->fd) {
+    vfs_close( lg->fd );
+    lg->fd = 0;
+  }
+  if (lg->buf) {
+    c_free( lg->buf );
+    lg->buf = NULL;
+  }
+}
+
+// Lua: lg = file.log(name[, segments[, segsize[, bufsize]]])
+static int file_log( lua_State *L )
+{
+  size_t len;
+  const char *name = luaL_checklstring( L, 1, &len );
+  int segments = luaL_optint( L, 2, LOG_DEFAULT_SEGMENTS );
+  uint32_t segsize = luaL_optinteger( L, 3, LOG_DEFAULT_SEGSIZE );
+  uint32_t bufsize = luaL_optinteger( L, 4, 0 );
+  char path[LOG_NAME_LEN+4];
+  struct vfs_stat stat;
+  uint8_t seg;
+
+  luaL_argcheck( L, c_strlen( vfs_basename( name ) ) <= LOG_SEGNAME_LEN && c_strlen( name ) == len &&
+                 len <= LOG_NAME_LEN, 1, "filename invalid" );
+  luaL_argcheck( L, segments > 0 && segments <= LOG_MAX_SEGMENTS, 2, "invalid number of segments" );
+
+  file_log_ud *lg = (file_log_ud *)lua_newuserdata( L, sizeof( file_log_ud ) );
+  c_memset( lg, 0, sizeof( file_log_ud ) );
+  lg->self_ref = LUA_NOREF;
+  lg->segments = segments;
+  c_strcpy( lg->name, name );
+  luaL_getmetatable( L, "file.log" );
+  lua_setmetatable( L, -2 );
+
+  // the first segment tells the page size, and so the size of a full segment
+  if (!file_log_open_segment( lg, 0, "a+" )) {
+    file_log_segname( lg, 0, path );
+    return luaL_error( L, "cannot open %s", path );
+  }
+  lg->chunk = vfs_pagesize( lg->fd );
+  lg->chunk = LOG_CHUNK_PAGES * (lg->chunk ? lg->chunk : 512);
+  lg->segsize = (segsize + lg->chunk - 1) / lg->chunk * lg->chunk;
+  if (lg->segsize == 0)
+    lg->segsize = lg->chunk;
+
+  // continue in the segment that is not full, all others are. Should none
+  // be, the last one is taken and the first write moves on from it.
+  for (seg = 0; seg < segments - 1; seg++) {
+    file_log_segname( lg, seg, path );
+    if (vfs_stat( path, &stat ) != VFS_RES_OK || stat.size < lg->segsize)
+      break;
+  }
+  if (seg > 0 && !file_log_open_segment( lg, seg, "a+" )) {
+    file_log_segname( lg, seg, path );
+    return luaL_error( L, "cannot open %s", path );
+  }
+
+  lg->size = bufsize > 2 * lg->chunk ? bufsize : 2 * lg->chunk;
+  if (!(lg->buf = (char *)c_malloc( lg->size ))) {
+    file_log_close( lg );
+    return luaL_error( L, "out of memory" );
+  }
+  return 1;
+}
+
+// Lua: ok = lg:write(record)
+static int file_log_write( lua_State *L )
+{
+  file_log_ud *lg = (file_log_ud *)luaL_checkudata( L, 1, "file.log" );
+  size_t len, first;
+  const char *s = luaL_checklstring( L, 2, &len );
+  uint32_t tail;
+
+  if (!lg->fd)
+    return luaL_error( L, "log closed" );
+  if (len > lg->size - lg->count) {
+    lg->dropped += len;
+    lua_pushboolean( L, 0 );
+    return 1;
+  }
+  tail = (lg->head + lg->count) % lg->size;
+  first = lg->size - tail;
+  if (first > len)
+    first = len;
+  c_memcpy( lg->buf + tail, s, first );
+  c_memcpy( lg->buf, s + first, len - first );
+  lg->count += len;
+
+  if (lg->self_ref == LUA_NOREF && lg->count >= file_log_next_chunk( lg ) &&
+      task_post_low( file_log_task_id, (task_param_t)lg )) {
+    lua_pushvalue( L, 1 );
+    lg->self_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+  }
+  lua_pushboolean( L, 1 );
+  return 1;
+}
+
+// Lua: lg:flush()
+static int file_log_flush_l( lua_State *L )
+{
+  file_log_ud *lg = (file_log_ud *)luaL_checkudata( L, 1, "file.log" );
+
+  file_log_flush( lg );
+  return 0;
+}
+
+// Lua: lg:close()
+static int file_log_close_l( lua_State *L )
+{
+  file_log_ud *lg = (file_log_ud *)luaL_checkudata( L, 1, "file.log" );
+
+  file_log_close( lg );
+  return 0;
+}
+
+// Lua: data = lg:tail(n)
+// The last n bytes logged, read back from older segments as needed and
+// including those still in the ring.
+static int file_log_tail( lua_State *L )
+{
+  file_log_ud *lg = (file_log_ud *)luaL_checkudata( L, 1, "file.log" );
+  int arg = luaL_checkinteger( L, 2 );
+  uint32_t n, from_ring, want, len[LOG_MAX_SEGMENTS];
+  char path[LOG_NAME_LEN+4];
+  struct vfs_stat stat;
+  luaL_Buffer b;
+  int i, k;
+
+  luaL_argcheck( L, arg >= 0, 2, "must not be negative" );
+  if (!lg->fd)
+    return luaL_error( L, "log closed" );
+  // no more than the segments and the ring can hold
+  n = (uint32_t)arg;
+  if (n > lg->segments * lg->segsize + lg->size)
+    n = lg->segments * lg->segsize + lg->size;
+  from_ring = n < lg->count ? n : lg->count;
+
+  // walk back through the segments to find where the tail starts
+  want = n - from_ring;
+  for (k = 0; want && k < lg->segments; k++) {
+    uint8_t seg = (lg->seg + lg->segments - k) % lg->segments;
+    uint32_t size = lg->length;
+    if (k > 0) {
+      file_log_segname( lg, seg, path );
+      size = vfs_stat( path, &stat ) == VFS_RES_OK ? stat.size : 0;
+    }
+    len[k] = size < want ? size : want;
+    want -= len[k];
+    if (k > 0 && size == 0)
+      break;
+  }
+
+  luaL_buffinit( L, &b );
+  for (i = k - 1; i >= 0; i--) {
+    uint8_t seg = (lg->seg + lg->segments - i) % lg->segments;
+    int fd = lg->fd;
+    uint32_t left = len[i];
+    if (left == 0)
+      continue;
+    if (i > 0) {
+      file_log_segname( lg, seg, path );
+      if (!(fd = vfs_open( path, "r" )))
+        continue;
+    }
+    vfs_lseek( fd, -(sint32_t)left, VFS_SEEK_END );
+    while (left) {
+      char *p = luaL_prepbuffer( &b );
+      sint32_t r = vfs_read( fd, p, left < LUAL_BUFFERSIZE ? left : LUAL_BUFFERSIZE );
+      if (r <= 0)
+        break;
+      luaL_addsize( &b, r );
+      left -= r;
+    }
+    if (i > 0)
+      vfs_close( fd );
+    else
+      vfs_lseek( fd, 0, VFS_SEEK_END );
+  }
+  // then the part of the ring
+  for (i = lg->count - from_ring; i < lg->count; i++)
+    luaL_addchar( &b, lg->buf[(lg->head + i) % lg->size] );
+  luaL_pushresult( &b );
+  return 1;
+}
+
+// Lua: segment, length, buffered, dropped = lg:status()
+static int file_log_status( lua_State *L )
+{
+  file_log_ud *lg = (file_log_ud *)luaL_checkudata( L, 1, "file.log" );
+
+  lua_pushinteger( L, lg->seg );
+  lua_pushinteger( L, lg->length );
+  lua_pushinteger( L, lg->count );
+  lua_pushinteger( L, lg->dropped );
+  return 4;
+}
+
+static int file_log_free( lua_State *L )
+{
+  file_log_ud *lg = (file_log_ud *)luaL_checkudata( L, 1, "file.log" );
+
+  file_log_close( lg );
+  return 0;
 }
 
 typedef struct {
@@ -597,6 +983,18 @@ static const LUA_REG_TYPE file_obj_map[] =
   { LNILKEY, LNILVAL }
 };
 
+static const LUA_REG_TYPE file_log_map[] =
+{
+  { LSTRKEY( "write" ),     LFUNCVAL( file_log_write ) },
+  { LSTRKEY( "flush" ),     LFUNCVAL( file_log_flush_l ) },
+  { LSTRKEY( "close" ),     LFUNCVAL( file_log_close_l ) },
+  { LSTRKEY( "tail" ),      LFUNCVAL( file_log_tail ) },
+  { LSTRKEY( "status" ),    LFUNCVAL( file_log_status ) },
+  { LSTRKEY( "__gc" ),      LFUNCVAL( file_log_free ) },
+  { LSTRKEY( "__index" ),   LROVAL( file_log_map ) },
+  { LNILKEY, LNILVAL }
+};
+
 static const LUA_REG_TYPE file_vol_map[] =
 {
   { LSTRKEY( "umount" ),   LFUNCVAL( file_vol_umount )},
@@ -619,6 +1017,7 @@ static const LUA_REG_TYPE file_map[] = {
 #ifdef BUILD_SPIFFS
   { LSTRKEY( "format" ),    LFUNCVAL( file_format ) },
   { LSTRKEY( "fscfg" ),     LFUNCVAL( file_fscfg ) },
+  { LSTRKEY( "fsgc" ),      LFUNCVAL( file_fsgc ) },
 #endif
   { LSTRKEY( "remove" ),    LFUNCVAL( file_remove ) },
   { LSTRKEY( "seek" ),      LFUNCVAL( file_seek ) },
@@ -628,6 +1027,7 @@ static const LUA_REG_TYPE file_map[] = {
   { LSTRKEY( "fsinfo" ),    LFUNCVAL( file_fsinfo ) },
   { LSTRKEY( "on" ),        LFUNCVAL( file_on ) },
   { LSTRKEY( "stat" ),      LFUNCVAL( file_stat ) },
+  { LSTRKEY( "log" ),       LFUNCVAL( file_log ) },
 #ifdef BUILD_FATFS
   { LSTRKEY( "mount" ),     LFUNCVAL( file_mount ) },
   { LSTRKEY( "chdir" ),     LFUNCVAL( file_chdir ) },
@@ -638,6 +1038,8 @@ static const LUA_REG_TYPE file_map[] = {
 int luaopen_file( lua_State *L ) {
   luaL_rometatable( L, "file.vol",  (void *)file_vol_map );
   luaL_rometatable( L, "file.obj",  (void *)file_obj_map );
+  luaL_rometatable( L, "file.log",  (void *)file_log_map );
+  file_log_task_id = task_get_id( file_log_task );
   return 0;
 }
 
@@ -9,101 +9,266 @@
 #include "platform.h"
 #include "cpu_esp8266.h"
 #include "httpclient.h"
+#include "vfs.h"
 
-static int http_callback_registry  = LUA_NOREF;
+#define HTTP_MAX_KEEPALIVE 6870  // longest os_timer period (0x68D7A3 ms)
 
-static void http_callback( char * response, int http_status, char ** full_response_p )
+// Pushes a table of the headers in a response header block
+static void http_push_headers( lua_State *L, const char *full_response )
 {
-  const char *full_response = full_response_p ? *full_response_p : NULL;
+  lua_newtable(L);
 
-#if defined(HTTPCLIENT_DEBUG_ON)
-  dbg_printf( "http_status=%d\n", http_status );
-  if ( http_status != HTTP_STATUS_GENERIC_ERROR )
-  {
-    if (full_response != NULL) {
-      dbg_printf( "strlen(full_response)=%d\n", strlen( full_response ) );
+  const char *p = full_response;
+
+  // Need to skip the HTTP/1.1 header line
+  while (*p && *p != '\n') {
+    p++;
+  }
+  if (*p == '\n') {
+    p++;
+  }
+
+  while (*p && *p != '\r' && *p != '\n') {
+    const char *eol = p;
+    while (*eol && *eol != '\r') {
+      eol++;
+    }
+
+    const char *colon = p;
+    while (*colon != ':' && colon < eol) {
+      colon++;
+    }
+
+    if (*colon != ':') {
+      break;
+    }
+
+    const char *value = colon + 1;
+    while (*value == ' ') {
+      value++;
+    }
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    while (p < colon) {
+      luaL_addchar(&b, tolower((unsigned char) *p));
+      p++;
+    }
+    luaL_pushresult(&b);
+
+    lua_pushlstring(L, value, eol - value);
+    lua_settable(L, -3);
+
+    p = eol + 1;
+    if (*p == '\n') {
+      p++;
     }
-    dbg_printf( "response=%s<EOF>\n", response );
   }
-#endif
-  if (http_callback_registry != LUA_NOREF)
-  {
-    lua_State *L = lua_getstate();
+}
 
-    lua_rawgeti(L, LUA_REGISTRYINDEX, http_callback_registry);
+// Request state, one per request
+typedef struct {
+  int headers_ref;      // options.onheaders
+  int data_ref;         // options.ondata
+  int file_ref;         // options.file
+  int hash_ref;         // options.hash
+  int callback_ref;     // final callback
+  int fd;               // open while a 2xx body is written to the file
+  bool sink;            // status is 2xx, feed file and hash
+  bool collect;         // no options, the body is passed to the callback
+  char *body;           // collected body
+  int body_len;
+} http_stream_ctx_t;
+
+static void http_stream_free( lua_State *L, http_stream_ctx_t *ctx )
+{
+  luaL_unref(L, LUA_REGISTRYINDEX, ctx->headers_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, ctx->data_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, ctx->file_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, ctx->hash_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, ctx->callback_ref);
+  if (ctx->body) {
+    c_free(ctx->body);
+  }
+  c_free(ctx);
+}
+
+// Pushes the name the body is written to until it is complete
+static const char *http_stream_tmpname( lua_State *L, http_stream_ctx_t *ctx )
+{
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->file_ref);
+  const char *name = lua_pushfstring(L, "%s~", lua_tostring(L, -1));
+  lua_remove(L, -2);
+  return name;
+}
+
+static bool http_stream_headers( int http_status, char * headers, void * arg )
+{
+  http_stream_ctx_t *ctx = (http_stream_ctx_t *) arg;
+  lua_State *L = lua_getstate();
+
+  ctx->sink = http_status >= 200 && http_status < 300;
+  if (ctx->sink && ctx->file_ref != LUA_NOREF) {
+    // The file itself is only replaced once the whole body is in
+    ctx->fd = vfs_open(http_stream_tmpname(L, ctx), "w");
+    lua_pop(L, 1);
+    if (!ctx->fd) {
+      return false;
+    }
+  }
 
+  if (ctx->headers_ref != LUA_NOREF) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->headers_ref);
     lua_pushnumber(L, http_status);
-    if ( http_status != HTTP_STATUS_GENERIC_ERROR && response)
-    {
-      lua_pushstring(L, response);
-      lua_newtable(L);
+    http_push_headers(L, headers);
+    lua_call(L, 2, 0);
+  }
+  return true;
+}
 
-      const char *p = full_response;
+static bool http_stream_data( char * data, int len, void * arg )
+{
+  http_stream_ctx_t *ctx = (http_stream_ctx_t *) arg;
+  lua_State *L = lua_getstate();
 
-      // Need to skip the HTTP/1.1 header line
-      while (*p && *p != '\n') {
-        p++;
-      }
-      if (*p == '\n') {
-        p++;
-      }
+  if (ctx->collect) {
+    char *body;
+    if (ctx->body_len + len > BUFFER_SIZE_MAX || !(body = (char *) c_malloc(ctx->body_len + len))) {
+      return false;
+    }
+    if (ctx->body) {
+      c_memcpy(body, ctx->body, ctx->body_len);
+      c_free(ctx->body);
+    }
+    c_memcpy(body + ctx->body_len, data, len);
+    ctx->body = body;
+    ctx->body_len += len;
+    return true;
+  }
+  if (ctx->fd && vfs_write(ctx->fd, data, len) != len) {
+    return false;
+  }
+  if ((ctx->sink && ctx->hash_ref != LUA_NOREF) || ctx->data_ref != LUA_NOREF) {
+    lua_pushlstring(L, data, len);
+    if (ctx->sink && ctx->hash_ref != LUA_NOREF) {
+      lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->hash_ref);
+      lua_getfield(L, -1, "update");
+      lua_insert(L, -2);
+      lua_pushvalue(L, -3);
+      lua_call(L, 2, 0);  // hash:update(data)
+    }
+    if (ctx->data_ref != LUA_NOREF) {
+      lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->data_ref);
+      lua_insert(L, -2);
+      lua_call(L, 1, 0);
+    } else {
+      lua_pop(L, 1);
+    }
+  }
+  return true;
+}
 
-      while (*p && *p != '\r' && *p != '\n') {
-        const char *eol = p;
-        while (*eol && *eol != '\r') {
-          eol++;
-        }
-
-        const char *colon = p;
-        while (*colon != ':' && colon < eol) {
-          colon++;
-        }
-
-        if (*colon != ':') {
-          break;
-        }
-
-        const char *value = colon + 1;
-        while (*value == ' ') {
-          value++;
-        }
-
-        luaL_Buffer b;
-        luaL_buffinit(L, &b);
-        while (p < colon) {
-          luaL_addchar(&b, tolower((unsigned char) *p));
-          p++;
-        }
-        luaL_pushresult(&b);
-
-        lua_pushlstring(L, value, eol - value);
-        lua_settable(L, -3);
-
-        p = eol + 1;
-        if (*p == '\n') {
-          p++;
-        }
+static void http_stream_done( int http_status, char ** headers_p, void * arg )
+{
+  http_stream_ctx_t *ctx = (http_stream_ctx_t *) arg;
+  lua_State *L = lua_getstate();
+
+  if (ctx->fd) {
+    vfs_close(ctx->fd);
+    const char *tmpname = http_stream_tmpname(L, ctx);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->file_ref);
+    const char *name = lua_tostring(L, -1);
+    if (http_status != HTTP_STATUS_GENERIC_ERROR) {
+      vfs_remove(name);   // rename does not replace an existing file
+      if (vfs_rename(tmpname, name) != VFS_RES_OK) {
+        http_status = HTTP_STATUS_GENERIC_ERROR;
       }
     }
-    else
-    {
-      lua_pushnil(L);
-      lua_pushnil(L);
+    if (http_status == HTTP_STATUS_GENERIC_ERROR) {
+      // Don't leave a truncated file behind
+      vfs_remove(tmpname);
     }
+    lua_pop(L, 2);
+  }
+
+  if (ctx->callback_ref == LUA_NOREF) {
+    http_stream_free(L, ctx);
+    return;
+  }
 
-    if (full_response_p && *full_response_p) {
-      c_free(*full_response_p);
-      *full_response_p = NULL;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->callback_ref);
+  lua_pushnumber(L, http_status);
+  if (http_status != HTTP_STATUS_GENERIC_ERROR && headers_p && *headers_p) {
+    if (ctx->collect) {
+      lua_pushlstring(L, ctx->body ? ctx->body : "", ctx->body_len);
+    } else {
+      lua_pushnil(L);   // the body went to the stream
     }
+    http_push_headers(L, *headers_p);
+  } else {
+    lua_pushnil(L);
+    lua_pushnil(L);
+  }
+  http_stream_free(L, ctx);
+  lua_call(L, 3, 0);
+}
+
+// Pops the value on top of the stack into the registry
+static int http_stream_ref( lua_State *L )
+{
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return LUA_NOREF;
+  }
+  return luaL_ref(L, LUA_REGISTRYINDEX);
+}
 
-    luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = LUA_NOREF;
+// Starts a request with the callback at stack index "cb", followed by an optional options table
+static int http_stream_start( lua_State *L, const char *url, const char *method, const char *headers, const char *body, int cb )
+{
+  int opt = cb + 1;
+  lua_settop(L, opt);
+  bool collect = !lua_istable(L, opt);
+  if (collect) {
+    lua_newtable(L);
+    lua_replace(L, opt);
+  }
+  lua_getfield(L, opt, "onheaders");
+  lua_getfield(L, opt, "ondata");
+  lua_getfield(L, opt, "file");
+  lua_getfield(L, opt, "hash");
+  int top = lua_gettop(L);
+  int t;
+  luaL_argcheck(L, (t = lua_type(L, top - 3)) == LUA_TNIL || t == LUA_TFUNCTION || t == LUA_TLIGHTFUNCTION, opt, "onheaders must be a function");
+  luaL_argcheck(L, (t = lua_type(L, top - 2)) == LUA_TNIL || t == LUA_TFUNCTION || t == LUA_TLIGHTFUNCTION, opt, "ondata must be a function");
+  luaL_argcheck(L, (t = lua_type(L, top - 1)) == LUA_TNIL || t == LUA_TSTRING, opt, "file must be a string");
+  // Leave room for the '~' of the temporary name
+  luaL_argcheck(L, t == LUA_TNIL || c_strlen(vfs_basename(lua_tostring(L, top - 1))) < FS_OBJ_NAME_LEN, opt, "file name too long");
+
+  http_stream_ctx_t *ctx = (http_stream_ctx_t *) c_zalloc(sizeof(http_stream_ctx_t));
+  if (!ctx) {
+    return luaL_error(L, "out of memory");
+  }
+  ctx->hash_ref = http_stream_ref(L);
+  ctx->file_ref = http_stream_ref(L);
+  ctx->data_ref = http_stream_ref(L);
+  ctx->headers_ref = http_stream_ref(L);
+  ctx->collect = collect;
+  ctx->callback_ref = LUA_NOREF;
+  if (lua_type(L, cb) == LUA_TFUNCTION || lua_type(L, cb) == LUA_TLIGHTFUNCTION) {
+    lua_pushvalue(L, cb);
+    ctx->callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
 
-    lua_call(L, 3, 0); // With 3 arguments and 0 result
+  http_stream_t stream = { http_stream_headers, http_stream_data, http_stream_done, ctx };
+  if (!http_stream_request(url, method, headers, body, &stream)) {
+    http_stream_free(L, ctx);
+    return luaL_error(L, "invalid URL");
   }
+  return 0;
 }
 
-// Lua: http.request( url, method, header, body, function(status, reponse) end )
+// Lua: http.request( url, method, header, body, function(status, reponse) end[, options] )
 static int http_lapi_request( lua_State *L )
 {
   int length;
@@ -127,17 +292,10 @@ static int http_lapi_request( lua_State *L )
     body = luaL_checklstring(L, 4, &length);
   }
 
-  if (lua_type(L, 5) == LUA_TFUNCTION || lua_type(L, 5) == LUA_TLIGHTFUNCTION) {
-    lua_pushvalue(L, 5);  // copy argument (func) to the top of stack
-    luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
-  }
-
-  http_request(url, method, headers, body, http_callback, 0);
-  return 0;
+  return http_stream_start(L, url, method, headers, body, 5);
 }
 
-// Lua: http.post( url, header, body, function(status, reponse) end )
+// Lua: http.post( url, header, body, function(status, reponse) end[, options] )
 static int http_lapi_post( lua_State *L )
 {
   int length;
@@ -160,18 +318,10 @@ static int http_lapi_post( lua_State *L )
     body = luaL_checklstring(L, 3, &length);
   }
 
-  if (lua_type(L, 4) == LUA_TFUNCTION || lua_type(L, 4) == LUA_TLIGHTFUNCTION) {
-    lua_pushvalue(L, 4);  // copy argument (func) to the top of stack
-    if (http_callback_registry != LUA_NOREF)
-      luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
-  }
-
-  http_post(url, headers, body, http_callback);
-  return 0;
+  return http_stream_start(L, url, "POST", headers, body, 4);
 }
 
-// Lua: http.put( url, header, body, function(status, reponse) end )
+// Lua: http.put( url, header, body, function(status, reponse) end[, options] )
 static int http_lapi_put( lua_State *L )
 {
   int length;
@@ -194,18 +344,10 @@ static int http_lapi_put( lua_State *L )
     body = luaL_checklstring(L, 3, &length);
   }
 
-  if (lua_type(L, 4) == LUA_TFUNCTION || lua_type(L, 4) == LUA_TLIGHTFUNCTION) {
-    lua_pushvalue(L, 4);  // copy argument (func) to the top of stack
-    if (http_callback_registry != LUA_NOREF)
-      luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
-  }
-
-  http_put(url, headers, body, http_callback);
-  return 0;
+  return http_stream_start(L, url, "PUT", headers, body, 4);
 }
 
-// Lua: http.delete( url, header, body, function(status, reponse) end )
+// Lua: http.delete( url, header, body, function(status, reponse) end[, options] )
 static int http_lapi_delete( lua_State *L )
 {
   int length;
@@ -228,18 +370,10 @@ static int http_lapi_delete( lua_State *L )
     body = luaL_checklstring(L, 3, &length);
   }
 
-  if (lua_type(L, 4) == LUA_TFUNCTION || lua_type(L, 4) == LUA_TLIGHTFUNCTION) {
-    lua_pushvalue(L, 4);  // copy argument (func) to the top of stack
-    if (http_callback_registry != LUA_NOREF)
-      luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
-  }
-
-  http_delete(url, headers, body, http_callback);
-  return 0;
+  return http_stream_start(L, url, "DELETE", headers, body, 4);
 }
 
-// Lua: http.get( url, header, function(status, reponse) end )
+// Lua: http.get( url, header, function(status, reponse) end[, options] )
 static int http_lapi_get( lua_State *L )
 {
   int length;
@@ -257,15 +391,22 @@ static int http_lapi_get( lua_State *L )
     headers = luaL_checklstring(L, 2, &length);
   }
 
-  if (lua_type(L, 3) == LUA_TFUNCTION || lua_type(L, 3) == LUA_TLIGHTFUNCTION) {
-    lua_pushvalue(L, 3);  // copy argument (func) to the top of stack
-    if (http_callback_registry != LUA_NOREF)
-      luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
-  }
+  return http_stream_start(L, url, "GET", headers, NULL, 3);
+}
 
-  http_get(url, headers, http_callback);
-  return 0;
+// Lua: previous = http.keepalive( [seconds] )
+static int http_lapi_keepalive( lua_State *L )
+{
+  int previous;
+  if (lua_isnoneornil(L, 1)) {
+    previous = http_keepalive(-1);
+  } else {
+    int seconds = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, seconds >= 0 && seconds <= HTTP_MAX_KEEPALIVE, 1, "out of range");
+    previous = http_keepalive(seconds * 1000);
+  }
+  lua_pushinteger(L, previous / 1000);
+  return 1;
 }
 
 // Module function map
@@ -275,6 +416,7 @@ static const LUA_REG_TYPE http_map[] = {
   { LSTRKEY( "put" ),             LFUNCVAL( http_lapi_put ) },
   { LSTRKEY( "delete" ),          LFUNCVAL( http_lapi_delete ) },
   { LSTRKEY( "get" ),             LFUNCVAL( http_lapi_get ) },
+  { LSTRKEY( "keepalive" ),       LFUNCVAL( http_lapi_keepalive ) },
 
   { LSTRKEY( "OK" ),              LNUMVAL( 0 ) },
   { LSTRKEY( "ERROR" ),           LNUMVAL( HTTP_STATUS_GENERIC_ERROR ) },
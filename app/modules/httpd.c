@@ -0,0 +1,986 @@
+// Module for a native HTTP/1.1 server
+
+#include "module.h"
+#include "lauxlib.h"
+#include "platform.h"
+
+#include "c_string.h"
+#include "c_stdlib.h"
+#include "c_ctype.h"
+
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+#include "lwip/tcp.h"
+#include "vfs.h"
+
+#define HTTPD_LINE_MAX    256   // longest request or header line
+#define HTTPD_BODY_MAX    4096  // largest request body accepted
+#define HTTPD_FILE_CHUNK  512   // bytes read from a file at a time
+#define HTTPD_TIMEOUT     15    // default idle timeout in seconds
+#define HTTPD_MAX_TIMEOUT 6870  // longest os_timer period (0x68D7A3 ms)
+#define HTTPD_HANDLER_TIMEOUT 60  // seconds a response may make no progress
+#define HTTPD_POLL_INTERVAL 2   // lwIP poll period in 500ms ticks
+
+static const char HTTPD_SERVER[] = "httpd.server";
+static const char HTTPD_CONN[]   = "httpd.conn";
+
+typedef struct httpd_server {
+  struct tcp_pcb *pcb;
+  int self_ref;
+  int routes_ref;           // "METHOD /path" -> handler
+  int root_ref;             // directory served for unrouted GETs, or LUA_NOREF
+  uint16_t timeout;         // seconds an idle connection is kept
+} httpd_server;
+
+typedef enum httpd_state {
+  ST_REQLINE = 0,           // waiting for the request line
+  ST_HEADERS,
+  ST_BODY,
+  ST_HANDLER,               // response in progress, input is held
+  ST_CLOSED
+} httpd_state;
+
+// One per connection. The same object is handed to handlers as `res`.
+typedef struct httpd_conn {
+  struct tcp_pcb *pcb;
+  httpd_server *srv;
+  int self_ref;
+  int srv_ref;              // keeps the server, and with it the routes, alive
+  os_timer_t idle;
+  // Request parser:
+  uint8_t state;
+  uint8_t in_input;         // 1 while httpd_input() runs
+  uint8_t keepalive;
+  uint8_t http10;           // HTTP/1.0 client, no chunked responses
+  uint8_t head;             // HEAD request, headers only
+  int req_ref;              // request table being filled in
+  char *body;
+  uint32_t body_len;
+  uint32_t body_got;
+  struct pbuf *pending;     // received, not yet parsed
+  uint16_t pend_off;        // bytes parsed from the first pbuf
+  uint16_t linelen;
+  char line[HTTPD_LINE_MAX];
+  // Response:
+  uint16_t status;
+  uint8_t sent_headers;
+  uint8_t chunked;
+  uint8_t finished;         // everything is queued
+  int hdr_ref;              // extra header lines, or LUA_NOREF
+  int out_ref;              // strings waiting for the send buffer
+  int out_head;
+  int out_tail;
+  uint32_t out_off;         // bytes of out[out_head] already written
+  int fd;                   // file being sent, or 0
+  uint32_t file_left;
+} httpd_conn;
+
+// Set when tcp_close() failed and the pcb had to be aborted, so that the
+// lwIP callback we are in can report it.
+static struct tcp_pcb *httpd_aborted;
+
+static void httpd_input( lua_State *L, httpd_conn *c );
+static void httpd_pump( lua_State *L, httpd_conn *c );
+static err_t httpd_poll_cb( void *arg, struct tcp_pcb *tpcb );
+
+#pragma mark - Helpers
+
+static const char *httpd_reason( int status ) {
+  switch (status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default:  return "Unknown";
+  }
+}
+
+static const char *const httpd_mime_types[] = {
+  "html", "text/html",
+  "htm",  "text/html",
+  "css",  "text/css",
+  "js",   "application/javascript",
+  "json", "application/json",
+  "txt",  "text/plain",
+  "png",  "image/png",
+  "jpg",  "image/jpeg",
+  "jpeg", "image/jpeg",
+  "gif",  "image/gif",
+  "ico",  "image/x-icon",
+  "svg",  "image/svg+xml",
+  NULL
+};
+
+static const char *httpd_mime( const char *path ) {
+  const char *ext = c_strrchr(path, '.');
+  if (ext && !c_strcmp(ext, ".gz")) {
+    // name.ext.gz: look at the extension before .gz
+    const char *p = ext;
+    while (p > path && p[-1] != '.') p--;
+    if (p > path) {
+      for (int i = 0; httpd_mime_types[i]; i += 2) {
+        size_t n = c_strlen(httpd_mime_types[i]);
+        if (ext - p == n && !c_strncmp(p, httpd_mime_types[i], n))
+          return httpd_mime_types[i + 1];
+      }
+    }
+  } else if (ext) {
+    for (int i = 0; httpd_mime_types[i]; i += 2)
+      if (!c_strcmp(ext + 1, httpd_mime_types[i]))
+        return httpd_mime_types[i + 1];
+  }
+  return "application/octet-stream";
+}
+
+static void httpd_unref( lua_State *L, int *ref ) {
+  luaL_unref(L, LUA_REGISTRYINDEX, *ref);
+  *ref = LUA_NOREF;
+}
+
+#pragma mark - Connection
+
+// Tear the connection down. lwIP may still be sending what was written,
+// but nothing more reaches this object.
+static void httpd_conn_close( lua_State *L, httpd_conn *c ) {
+  os_timer_disarm(&c->idle);
+  c->state = ST_CLOSED;
+  if (c->pcb) {
+    tcp_arg(c->pcb, NULL);
+    tcp_recv(c->pcb, NULL);
+    tcp_sent(c->pcb, NULL);
+    tcp_err(c->pcb, NULL);
+    tcp_poll(c->pcb, NULL, 0);
+    if (tcp_close(c->pcb) != ERR_OK) {
+      tcp_abort(c->pcb);
+      httpd_aborted = c->pcb;
+    }
+    c->pcb = NULL;
+  }
+  if (c->pending) {
+    pbuf_free(c->pending);
+    c->pending = NULL;
+  }
+  if (c->body) {
+    c_free(c->body);
+    c->body = NULL;
+  }
+  if (c->fd) {
+    vfs_close(c->fd);
+    c->fd = 0;
+  }
+  httpd_unref(L, &c->req_ref);
+  httpd_unref(L, &c->hdr_ref);
+  httpd_unref(L, &c->out_ref);
+  httpd_unref(L, &c->srv_ref);
+  lua_gc(L, LUA_GCSTOP, 0);
+  httpd_unref(L, &c->self_ref);
+  lua_gc(L, LUA_GCRESTART, 0);
+}
+
+static void httpd_idle_cb( void *arg ) {
+  httpd_conn *c = (httpd_conn *)arg;
+  lua_State *L = lua_getstate();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->self_ref);
+  httpd_conn_close(L, c);
+  lua_pop(L, 1);
+}
+
+static void httpd_idle( httpd_conn *c ) {
+  os_timer_disarm(&c->idle);
+  os_timer_arm(&c->idle, c->srv->timeout * 1000, 0);
+}
+
+// While a response is in progress the connection is closed if it makes
+// no progress for the longer of HTTPD_HANDLER_TIMEOUT and the idle
+// timeout, so that a handler that never answers doesn't hold it forever.
+static void httpd_busy( httpd_conn *c ) {
+  os_timer_disarm(&c->idle);
+  os_timer_arm(&c->idle, LWIP_MAX(c->srv->timeout, HTTPD_HANDLER_TIMEOUT) * 1000, 0);
+}
+
+#pragma mark - Response
+
+// Append the string on top of the stack to the output queue.
+static void httpd_queue( lua_State *L, httpd_conn *c ) {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->out_ref);
+  lua_insert(L, -2);
+  lua_rawseti(L, -2, ++c->out_tail);
+  lua_pop(L, 1);
+}
+
+static void httpd_add_header( lua_State *L, httpd_conn *c, const char *name, const char *value ) {
+  int n = 1;
+  if (c->hdr_ref != LUA_NOREF) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, c->hdr_ref);
+    httpd_unref(L, &c->hdr_ref);
+    n++;
+  }
+  lua_pushfstring(L, "%s: %s\r\n", name, value);
+  lua_concat(L, n);
+  c->hdr_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+// Queue the status line and headers. A negative length means the body
+// is chunked, or for HTTP/1.0 delimited by closing the connection.
+static void httpd_start( lua_State *L, httpd_conn *c, const char *ctype, int length ) {
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  lua_pushfstring(L, "HTTP/1.1 %d %s\r\n", c->status, httpd_reason(c->status));
+  luaL_addvalue(&b);
+  if (ctype) {
+    luaL_addstring(&b, "Content-Type: ");
+    luaL_addstring(&b, ctype);
+    luaL_addstring(&b, "\r\n");
+  }
+  if (c->hdr_ref != LUA_NOREF) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, c->hdr_ref);
+    luaL_addvalue(&b);
+    httpd_unref(L, &c->hdr_ref);
+  }
+  if (length >= 0) {
+    lua_pushfstring(L, "Content-Length: %d\r\n", length);
+    luaL_addvalue(&b);
+  } else if (c->http10) {
+    c->keepalive = 0;
+  } else {
+    luaL_addstring(&b, "Transfer-Encoding: chunked\r\n");
+    c->chunked = 1;
+  }
+  luaL_addstring(&b, c->keepalive ? "Connection: keep-alive\r\n\r\n"
+                                  : "Connection: close\r\n\r\n");
+  luaL_pushresult(&b);
+  httpd_queue(L, c);
+  c->sent_headers = 1;
+}
+
+// The response is out of our hands. Wait for the next request on the
+// same connection or close it.
+static void httpd_done( lua_State *L, httpd_conn *c ) {
+  c->finished = 0;
+  if (!c->keepalive) {
+    httpd_conn_close(L, c);
+    return;
+  }
+  c->state = ST_REQLINE;
+  httpd_idle(c);
+  if (!c->in_input)
+    httpd_input(L, c);
+}
+
+// Move queued output into lwIP as far as the send buffer allows. Called
+// again from the sent callback as acks free up room.
+static void httpd_pump( lua_State *L, httpd_conn *c ) {
+  struct tcp_pcb *pcb = c->pcb;
+  if (!pcb) return;
+  err_t err = ERR_OK;
+  while (err == ERR_OK && tcp_sndbuf(pcb) > 0) {
+    if (c->out_head <= c->out_tail) {
+      size_t len;
+      lua_rawgeti(L, LUA_REGISTRYINDEX, c->out_ref);
+      lua_rawgeti(L, -1, c->out_head);
+      const char *s = lua_tolstring(L, -1, &len);
+      uint32_t n = LWIP_MIN(len - c->out_off, tcp_sndbuf(pcb));
+      err = tcp_write(pcb, s + c->out_off, n, TCP_WRITE_FLAG_COPY);
+      if (err == ERR_OK) {
+        c->out_off += n;
+        if (c->out_off == len) {
+          lua_pushnil(L);
+          lua_rawseti(L, -3, c->out_head++);
+          c->out_off = 0;
+        }
+      }
+      lua_pop(L, 2);
+    } else if (c->fd) {
+      char buf[HTTPD_FILE_CHUNK];
+      uint32_t n = LWIP_MIN(LWIP_MIN(c->file_left, sizeof(buf)), tcp_sndbuf(pcb));
+      sint32_t got = vfs_read(c->fd, buf, n);
+      if (got <= 0) {
+        // File got shorter than the Content-Length sent, all we can do
+        // is close the connection once the rest is out.
+        c->keepalive = 0;
+        c->file_left = 0;
+      } else {
+        err = tcp_write(pcb, buf, got, TCP_WRITE_FLAG_COPY);
+        if (err == ERR_OK)
+          c->file_left -= got;
+        else
+          vfs_lseek(c->fd, -got, VFS_SEEK_CUR);
+      }
+      if (!c->file_left) {
+        vfs_close(c->fd);
+        c->fd = 0;
+      }
+    } else {
+      break;
+    }
+  }
+  tcp_output(pcb);
+  // ERR_MEM: lwIP is out of segments, the next ack brings us back here,
+  // or the poll if there is nothing in flight to be acked.
+  if (err == ERR_MEM && !pcb->unacked)
+    tcp_poll(pcb, httpd_poll_cb, HTTPD_POLL_INTERVAL);
+  if (c->finished && c->out_head > c->out_tail && !c->fd)
+    httpd_done(L, c);
+}
+
+// Reply with a short plain text error.
+static void httpd_error( lua_State *L, httpd_conn *c, int status ) {
+  c->state = ST_HANDLER;
+  httpd_busy(c);
+  httpd_unref(L, &c->req_ref);
+  httpd_unref(L, &c->hdr_ref);
+  if (c->body) {
+    c_free(c->body);
+    c->body = NULL;
+  }
+  if (status != 404)
+    c->keepalive = 0;  // the rest of the input can't be trusted
+  c->status = status;
+  c->sent_headers = c->chunked = 0;
+  lua_pushfstring(L, "%d %s\n", status, httpd_reason(status));
+  httpd_start(L, c, "text/plain", lua_objlen(L, -1));
+  if (c->head)
+    lua_pop(L, 1);
+  else
+    httpd_queue(L, c);
+  c->finished = 1;
+  httpd_pump(L, c);
+}
+
+// Start sending a file as the whole response. Looks for path.gz if the
+// file itself does not exist. Returns 0 if neither does.
+static int httpd_file( lua_State *L, httpd_conn *c, const char *path, const char *ctype ) {
+  int fd = vfs_open(path, "r");
+  if (!fd) {
+    lua_pushfstring(L, "%s.gz", path);
+    fd = vfs_open(lua_tostring(L, -1), "r");
+    lua_pop(L, 1);
+    if (!fd)
+      return 0;
+    httpd_add_header(L, c, "Content-Encoding", "gzip");
+  }
+  uint32_t size = vfs_size(fd);
+  httpd_start(L, c, ctype ? ctype : httpd_mime(path), size);
+  if (c->head || !size) {
+    vfs_close(fd);
+  } else {
+    c->fd = fd;
+    c->file_left = size;
+  }
+  c->finished = 1;
+  httpd_pump(L, c);
+  return 1;
+}
+
+#pragma mark - Request
+
+// Look up the handler for the request table on top of the stack. Exact
+// routes are tried before prefix routes ending in '*', the longest
+// prefix wins. Pushes the handler and returns 1, or returns 0.
+static int httpd_route( lua_State *L, httpd_conn *c ) {
+  int top = lua_gettop(L);
+  lua_getfield(L, top, "method");
+  lua_getfield(L, top, "path");
+  const char *method = lua_tostring(L, top + 1);
+  size_t plen;
+  const char *path = lua_tolstring(L, top + 2, &plen);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->srv->routes_ref);
+  lua_pushfstring(L, "%s %s", method, path);
+  lua_rawget(L, top + 3);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_pushfstring(L, "* %s", path);
+    lua_rawget(L, top + 3);
+  }
+  if (lua_isnil(L, -1)) {
+    size_t best = 0;
+    lua_pushnil(L);
+    while (lua_next(L, top + 3)) {
+      size_t klen;
+      const char *k = lua_tolstring(L, -2, &klen);
+      const char *sp = c_strchr(k, ' ');
+      size_t mlen = sp - k, pre = klen - mlen - 2;
+      int any = mlen == 1 && *k == '*';
+      size_t score = 2 * (pre + 1) + !any;  // the method breaks a tie
+      if (k[klen - 1] == '*' && score > best && pre <= plen &&
+          !c_strncmp(sp + 1, path, pre) &&
+          (any || (!c_strncmp(k, method, mlen) && !method[mlen]))) {
+        best = score;
+        lua_pushvalue(L, -1);
+        lua_replace(L, top + 4);
+      }
+      lua_pop(L, 1);
+    }
+  }
+  int found = !lua_isnil(L, top + 4);
+  if (found) {
+    lua_replace(L, top + 1);
+    lua_settop(L, top + 1);
+  } else {
+    lua_settop(L, top);
+  }
+  return found;
+}
+
+// The request is complete: run its handler, or serve a file.
+static void httpd_dispatch( lua_State *L, httpd_conn *c ) {
+  c->state = ST_HANDLER;
+  httpd_busy(c);
+  c->status = 200;
+  c->sent_headers = c->chunked = c->finished = 0;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->req_ref);
+  httpd_unref(L, &c->req_ref);
+  if (c->body) {
+    lua_pushlstring(L, c->body, c->body_len);
+    lua_setfield(L, -2, "body");
+    c_free(c->body);
+    c->body = NULL;
+  }
+  if (httpd_route(L, c)) {
+    lua_insert(L, -2);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, c->self_ref);
+    lua_call(L, 2, 0);
+    return;
+  }
+  lua_getfield(L, -1, "method");
+  lua_getfield(L, -2, "path");
+  const char *method = lua_tostring(L, -2);
+  const char *path = lua_tostring(L, -1);
+  int served = 0;
+  if (c->srv->root_ref != LUA_NOREF && (c->head || !c_strcmp(method, "GET")) &&
+      !c_strstr(path, "..")) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, c->srv->root_ref);
+    lua_pushstring(L, path + 1);
+    if (path[c_strlen(path) - 1] == '/')
+      lua_pushliteral(L, "index.html");
+    else
+      lua_pushliteral(L, "");
+    lua_concat(L, 3);
+    served = httpd_file(L, c, lua_tostring(L, -1), NULL);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 3);
+  if (!served)
+    httpd_error(L, c, 404);
+}
+
+static void httpd_reqline( lua_State *L, httpd_conn *c ) {
+  char *line = c->line;
+  if (!*line)
+    return;  // stray CRLF between requests
+  char *sp1 = c_strchr(line, ' ');
+  char *sp2 = c_strrchr(line, ' ');
+  // the URL must be an absolute path, which the routes and root rely on
+  if (!sp1 || sp1 == sp2 || sp1[1] != '/' || c_strncmp(sp2 + 1, "HTTP/1.", 7)) {
+    httpd_error(L, c, 400);
+    return;
+  }
+  c->http10 = sp2[8] == '0';
+  c->keepalive = !c->http10;
+  c->body_len = c->body_got = 0;
+  lua_createtable(L, 0, 6);
+  lua_pushlstring(L, line, sp1 - line);
+  c->head = !c_strcmp(lua_tostring(L, -1), "HEAD");
+  lua_setfield(L, -2, "method");
+  char *url = sp1 + 1;
+  lua_pushlstring(L, url, sp2 - url);
+  lua_setfield(L, -2, "url");
+  char *q = memchr(url, '?', sp2 - url);
+  lua_pushlstring(L, url, (q ? q : sp2) - url);
+  lua_setfield(L, -2, "path");
+  if (q) {
+    lua_pushlstring(L, q + 1, sp2 - q - 1);
+    lua_setfield(L, -2, "query");
+  }
+  lua_newtable(L);
+  lua_setfield(L, -2, "headers");
+  c->req_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  c->state = ST_HEADERS;
+}
+
+static void httpd_header( lua_State *L, httpd_conn *c, uint16_t len ) {
+  char *line = c->line;
+  if (!len) {
+    // end of the headers
+    if (!c->body_len) {
+      httpd_dispatch(L, c);
+    } else if (c->body_len > HTTPD_BODY_MAX) {
+      httpd_error(L, c, 413);
+    } else if (!(c->body = (char *)c_malloc(c->body_len))) {
+      httpd_error(L, c, 503);
+    } else {
+      c->state = ST_BODY;
+    }
+    return;
+  }
+  char *colon = memchr(line, ':', len);
+  if (!colon) {
+    httpd_error(L, c, 400);
+    return;
+  }
+  for (char *p = line; p < colon; p++)
+    *p = tolower((unsigned char)*p);
+  *colon = 0;
+  char *value = colon + 1, *end = line + len;
+  while (*value == ' ' || *value == '\t') value++;
+  while (end > value && (end[-1] == ' ' || end[-1] == '\t')) end--;
+  *end = 0;
+
+  if (!c_strcmp(line, "content-length")) {
+    c->body_len = c_strtoul(value, NULL, 10);
+  } else if (!c_strcmp(line, "transfer-encoding")) {
+    httpd_error(L, c, 501);  // chunked request bodies are not supported
+    return;
+  } else if (!c_strcmp(line, "connection")) {
+    for (char *p = value; *p; p++)
+      *p = tolower((unsigned char)*p);
+    if (c_strstr(value, "close"))
+      c->keepalive = 0;
+    else if (c_strstr(value, "keep-alive"))
+      c->keepalive = 1;
+  } else if (!c_strcmp(line, "expect") && !c_strcmp(value, "100-continue")) {
+    lua_pushliteral(L, "HTTP/1.1 100 Continue\r\n\r\n");
+    httpd_queue(L, c);
+    httpd_pump(L, c);
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->req_ref);
+  lua_getfield(L, -1, "headers");
+  lua_pushstring(L, line);
+  lua_pushlstring(L, value, end - value);
+  lua_rawset(L, -3);
+  lua_pop(L, 2);
+}
+
+// Parse what can be parsed of data. Stops after a complete request, so
+// that whatever follows waits until the response is done. Returns the
+// number of bytes used.
+static uint16_t httpd_parse( lua_State *L, httpd_conn *c, const char *data, uint16_t len ) {
+  uint16_t used = 0;
+  while (used < len && c->state < ST_HANDLER) {
+    if (c->state == ST_BODY) {
+      uint32_t n = LWIP_MIN(len - used, c->body_len - c->body_got);
+      c_memcpy(c->body + c->body_got, data + used, n);
+      c->body_got += n;
+      used += n;
+      if (c->body_got == c->body_len)
+        httpd_dispatch(L, c);
+      continue;
+    }
+    const char *nl = memchr(data + used, '\n', len - used);
+    uint16_t n = (nl ? nl + 1 : data + len) - (data + used);
+    uint16_t take = nl ? n - 1 : n;
+    used += n;
+    if (c->linelen + take >= HTTPD_LINE_MAX) {
+      httpd_error(L, c, c->state == ST_REQLINE ? 414 : 431);
+      break;
+    }
+    c_memcpy(c->line + c->linelen, data + used - n, take);
+    c->linelen += take;
+    if (!nl)
+      break;
+    if (c->linelen && c->line[c->linelen - 1] == '\r')
+      c->linelen--;
+    c->line[c->linelen] = 0;
+    uint16_t l = c->linelen;
+    c->linelen = 0;
+    if (c->state == ST_REQLINE)
+      httpd_reqline(L, c);
+    else
+      httpd_header(L, c, l);
+  }
+  return used;
+}
+
+// Feed held input to the parser until it is used up or a request is
+// being answered. The window is only reopened for what has been parsed,
+// so pipelined requests hold the client back rather than our heap.
+static void httpd_input( lua_State *L, httpd_conn *c ) {
+  if (c->in_input) return;
+  c->in_input = 1;
+  while (c->pending && c->state < ST_HANDLER) {
+    struct pbuf *p = c->pending;
+    c->pend_off += httpd_parse(L, c, (char *)p->payload + c->pend_off,
+                               p->len - c->pend_off);
+    if (c->pending != p)
+      break;  // closed
+    if (c->pend_off == p->len) {
+      struct pbuf *q = p->next;
+      if (q)
+        pbuf_ref(q);
+      if (c->pcb)
+        tcp_recved(c->pcb, p->len);
+      pbuf_free(p);
+      c->pending = q;
+      c->pend_off = 0;
+    }
+  }
+  c->in_input = 0;
+}
+
+#pragma mark - LWIP callbacks
+
+static err_t httpd_recv_cb( void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err ) {
+  httpd_conn *c = (httpd_conn *)arg;
+  if (!c || c->pcb != tpcb) {
+    if (p) pbuf_free(p);
+    return ERR_OK;
+  }
+  lua_State *L = lua_getstate();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->self_ref);  // keep c alive
+  if (!p) {
+    httpd_conn_close(L, c);
+  } else {
+    if (c->pending)
+      pbuf_cat(c->pending, p);
+    else
+      c->pending = p;
+    if (c->state < ST_HANDLER)
+      httpd_idle(c);
+    httpd_input(L, c);
+  }
+  lua_pop(L, 1);
+  if (httpd_aborted == tpcb) {
+    httpd_aborted = NULL;
+    return ERR_ABRT;
+  }
+  return ERR_OK;
+}
+
+static err_t httpd_sent_cb( void *arg, struct tcp_pcb *tpcb, u16_t len ) {
+  httpd_conn *c = (httpd_conn *)arg;
+  if (!c || c->pcb != tpcb) return ERR_OK;
+  lua_State *L = lua_getstate();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->self_ref);
+  if (c->state == ST_HANDLER)
+    httpd_busy(c);  // the response is moving
+  httpd_pump(L, c);
+  lua_pop(L, 1);
+  if (httpd_aborted == tpcb) {
+    httpd_aborted = NULL;
+    return ERR_ABRT;
+  }
+  return ERR_OK;
+}
+
+static err_t httpd_poll_cb( void *arg, struct tcp_pcb *tpcb ) {
+  httpd_conn *c = (httpd_conn *)arg;
+  tcp_poll(tpcb, NULL, 0);
+  if (!c || c->pcb != tpcb) return ERR_OK;
+  lua_State *L = lua_getstate();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, c->self_ref);
+  httpd_pump(L, c);  // polls again if lwIP still has no room
+  lua_pop(L, 1);
+  if (httpd_aborted == tpcb) {
+    httpd_aborted = NULL;
+    return ERR_ABRT;
+  }
+  return ERR_OK;
+}
+
+static void httpd_err_cb( void *arg, err_t err ) {
+  httpd_conn *c = (httpd_conn *)arg;
+  if (!c) return;
+  c->pcb = NULL;  // already freed by lwIP
+  httpd_conn_close(lua_getstate(), c);
+}
+
+static err_t httpd_accept_cb( void *arg, struct tcp_pcb *newpcb, err_t err ) {
+  httpd_server *srv = (httpd_server *)arg;
+  if (!srv || !srv->pcb || err != ERR_OK) {
+    if (newpcb)
+      tcp_abort(newpcb);  // ERR_ABRT tells lwIP the pcb is gone
+    return ERR_ABRT;
+  }
+  lua_State *L = lua_getstate();
+  httpd_conn *c = (httpd_conn *)lua_newuserdata(L, sizeof(httpd_conn));
+  c_memset(c, 0, sizeof(httpd_conn));
+  luaL_getmetatable(L, HTTPD_CONN);
+  lua_setmetatable(L, -2);
+  c->req_ref = c->hdr_ref = LUA_NOREF;
+  c->out_head = 1;
+  lua_newtable(L);
+  c->out_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, srv->self_ref);
+  c->srv_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  c->srv = srv;
+  c->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  c->pcb = newpcb;
+  tcp_arg(newpcb, c);
+  tcp_recv(newpcb, httpd_recv_cb);
+  tcp_sent(newpcb, httpd_sent_cb);
+  tcp_err(newpcb, httpd_err_cb);
+  tcp_accepted(srv->pcb);
+  os_timer_setfn(&c->idle, httpd_idle_cb, c);
+  httpd_idle(c);
+  return ERR_OK;
+}
+
+#pragma mark - Lua API - server
+
+// Lua: httpd.createServer(port[, timeout])
+static int httpd_create( lua_State *L ) {
+  int port = luaL_checkinteger(L, 1);
+  int timeout = luaL_optinteger(L, 2, HTTPD_TIMEOUT);
+  luaL_argcheck(L, timeout > 0 && timeout <= HTTPD_MAX_TIMEOUT, 2, "out of range");
+  httpd_server *srv = (httpd_server *)lua_newuserdata(L, sizeof(httpd_server));
+  srv->pcb = NULL;
+  srv->self_ref = srv->routes_ref = srv->root_ref = LUA_NOREF;
+  srv->timeout = timeout;
+  luaL_getmetatable(L, HTTPD_SERVER);
+  lua_setmetatable(L, -2);
+  lua_newtable(L);
+  srv->routes_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  struct tcp_pcb *pcb = tcp_new();
+  if (!pcb)
+    return luaL_error(L, "cannot allocate PCB");
+  pcb->so_options |= SOF_REUSEADDR;
+  err_t err = tcp_bind(pcb, IP_ADDR_ANY, port);
+  if (err == ERR_OK) {
+    struct tcp_pcb *lpcb = tcp_listen(pcb);
+    if (lpcb)
+      pcb = lpcb;
+    else
+      err = ERR_MEM;
+  }
+  if (err != ERR_OK) {
+    tcp_close(pcb);
+    return luaL_error(L, "cannot listen on port %d", port);
+  }
+  srv->pcb = pcb;
+  tcp_arg(pcb, srv);
+  tcp_accept(pcb, httpd_accept_cb);
+  lua_pushvalue(L, -1);
+  srv->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  return 1;
+}
+
+// Lua: server:route([method, ]path, handler(req, res))
+static int httpd_route_set( lua_State *L ) {
+  httpd_server *srv = (httpd_server *)luaL_checkudata(L, 1, HTTPD_SERVER);
+  const char *method = "*";
+  int stack = 2;
+  if (lua_isstring(L, 3))
+    method = luaL_checkstring(L, stack++);
+  const char *path = luaL_checkstring(L, stack++);
+  luaL_argcheck(L, *path == '/', stack - 1, "must start with /");
+  if (!lua_isnoneornil(L, stack) && !lua_isfunction(L, stack) &&
+      !lua_islightfunction(L, stack))
+    return luaL_argerror(L, stack, "function expected");
+  lua_rawgeti(L, LUA_REGISTRYINDEX, srv->routes_ref);
+  lua_pushfstring(L, "%s %s", method, path);
+  lua_pushvalue(L, stack);
+  lua_rawset(L, -3);
+  return 0;
+}
+
+// Lua: server:static([dir])
+static int httpd_static( lua_State *L ) {
+  httpd_server *srv = (httpd_server *)luaL_checkudata(L, 1, HTTPD_SERVER);
+  httpd_unref(L, &srv->root_ref);
+  if (lua_isstring(L, 2)) {
+    lua_pushvalue(L, 2);
+    srv->root_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  } else if (lua_isnoneornil(L, 2)) {
+    lua_pushliteral(L, "");
+    srv->root_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  } else {
+    luaL_checkstring(L, 2);
+  }
+  return 0;
+}
+
+// Lua: server:close()
+static int httpd_close( lua_State *L ) {
+  httpd_server *srv = (httpd_server *)luaL_checkudata(L, 1, HTTPD_SERVER);
+  if (srv->pcb) {
+    tcp_arg(srv->pcb, NULL);
+    tcp_close(srv->pcb);
+    srv->pcb = NULL;
+  }
+  lua_gc(L, LUA_GCSTOP, 0);
+  httpd_unref(L, &srv->self_ref);
+  lua_gc(L, LUA_GCRESTART, 0);
+  return 0;
+}
+
+static int httpd_server_delete( lua_State *L ) {
+  httpd_server *srv = (httpd_server *)luaL_checkudata(L, 1, HTTPD_SERVER);
+  httpd_close(L);
+  httpd_unref(L, &srv->routes_ref);
+  httpd_unref(L, &srv->root_ref);
+  return 0;
+}
+
+#pragma mark - Lua API - response
+
+static httpd_conn *httpd_res( lua_State *L, int headers_ok ) {
+  httpd_conn *c = (httpd_conn *)luaL_checkudata(L, 1, HTTPD_CONN);
+  if (!c->pcb)
+    luaL_error(L, "not connected");
+  if (c->state != ST_HANDLER || c->finished)
+    luaL_error(L, "no response in progress");
+  if (!headers_ok && c->sent_headers)
+    luaL_error(L, "headers already sent");
+  return c;
+}
+
+// Lua: res:status(code)
+static int httpd_res_status( lua_State *L ) {
+  httpd_conn *c = httpd_res(L, 0);
+  int status = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, status >= 100 && status <= 999, 2, "out of range");
+  c->status = status;
+  return 0;
+}
+
+// Lua: res:header(name, value)
+static int httpd_res_header( lua_State *L ) {
+  httpd_conn *c = httpd_res(L, 0);
+  const char *name = luaL_checkstring(L, 2);
+  const char *value = luaL_checkstring(L, 3);
+  luaL_argcheck(L, !c_strpbrk(name, ":\r\n"), 2, "invalid header name");
+  luaL_argcheck(L, !c_strpbrk(value, "\r\n"), 3, "invalid header value");
+  httpd_add_header(L, c, name, value);
+  return 0;
+}
+
+// Lua: res:send([body[, status[, content_type]]])
+static int httpd_res_send( lua_State *L ) {
+  httpd_conn *c = httpd_res(L, 0);
+  size_t len = 0;
+  if (!lua_isnoneornil(L, 2))
+    luaL_checklstring(L, 2, &len);
+  if (lua_isnumber(L, 3))
+    c->status = lua_tointeger(L, 3);
+  httpd_start(L, c, luaL_optstring(L, 4, NULL), len);
+  if (len && !c->head) {
+    lua_pushvalue(L, 2);
+    httpd_queue(L, c);
+  }
+  c->finished = 1;
+  httpd_pump(L, c);
+  return 0;
+}
+
+// Lua: res:write(data)
+static int httpd_res_write( lua_State *L ) {
+  httpd_conn *c = httpd_res(L, 1);
+  size_t len;
+  luaL_checklstring(L, 2, &len);
+  if (!c->sent_headers)
+    httpd_start(L, c, NULL, -1);
+  if (len && !c->head) {
+    if (c->chunked) {
+      char hex[12], *p = hex + sizeof(hex);
+      *--p = 0; *--p = '\n'; *--p = '\r';
+      do { *--p = "0123456789abcdef"[len & 15]; } while (len >>= 4);
+      lua_pushstring(L, p);
+      httpd_queue(L, c);
+    }
+    lua_pushvalue(L, 2);
+    httpd_queue(L, c);
+    if (c->chunked) {
+      lua_pushliteral(L, "\r\n");
+      httpd_queue(L, c);
+    }
+  }
+  httpd_pump(L, c);
+  return 0;
+}
+
+// Lua: res:finish([data])
+static int httpd_res_finish( lua_State *L ) {
+  httpd_conn *c = httpd_res(L, 1);
+  if (!c->sent_headers)
+    return httpd_res_send(L);  // all there is, no need for chunks
+  if (!lua_isnoneornil(L, 2)) {
+    lua_settop(L, 2);
+    httpd_res_write(L);
+  }
+  if (c->chunked && !c->head) {
+    lua_pushliteral(L, "0\r\n\r\n");
+    httpd_queue(L, c);
+  }
+  c->finished = 1;
+  httpd_pump(L, c);
+  return 0;
+}
+
+// Lua: res:sendfile(path[, content_type]), returns false if there is no such file
+static int httpd_res_sendfile( lua_State *L ) {
+  httpd_conn *c = httpd_res(L, 0);
+  const char *path = luaL_checkstring(L, 2);
+  lua_pushboolean(L, httpd_file(L, c, path, luaL_optstring(L, 3, NULL)));
+  return 1;
+}
+
+// Lua: res:close()
+static int httpd_res_close( lua_State *L ) {
+  httpd_conn *c = (httpd_conn *)luaL_checkudata(L, 1, HTTPD_CONN);
+  if (c->state != ST_CLOSED)
+    httpd_conn_close(L, c);
+  return 0;
+}
+
+static int httpd_conn_delete( lua_State *L ) {
+  httpd_conn *c = (httpd_conn *)luaL_checkudata(L, 1, HTTPD_CONN);
+  if (c->state != ST_CLOSED)
+    httpd_conn_close(L, c);
+  return 0;
+}
+
+#pragma mark - Tables
+
+static const LUA_REG_TYPE httpd_server_map[] = {
+  { LSTRKEY( "route" ),   LFUNCVAL( httpd_route_set ) },
+  { LSTRKEY( "static" ),  LFUNCVAL( httpd_static ) },
+  { LSTRKEY( "close" ),   LFUNCVAL( httpd_close ) },
+  { LSTRKEY( "__gc" ),    LFUNCVAL( httpd_server_delete ) },
+  { LSTRKEY( "__index" ), LROVAL( httpd_server_map ) },
+  { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE httpd_conn_map[] = {
+  { LSTRKEY( "status" ),   LFUNCVAL( httpd_res_status ) },
+  { LSTRKEY( "header" ),   LFUNCVAL( httpd_res_header ) },
+  { LSTRKEY( "send" ),     LFUNCVAL( httpd_res_send ) },
+  { LSTRKEY( "write" ),    LFUNCVAL( httpd_res_write ) },
+  { LSTRKEY( "finish" ),   LFUNCVAL( httpd_res_finish ) },
+  { LSTRKEY( "sendfile" ), LFUNCVAL( httpd_res_sendfile ) },
+  { LSTRKEY( "close" ),    LFUNCVAL( httpd_res_close ) },
+  { LSTRKEY( "__gc" ),     LFUNCVAL( httpd_conn_delete ) },
+  { LSTRKEY( "__index" ),  LROVAL( httpd_conn_map ) },
+  { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE httpd_map[] = {
+  { LSTRKEY( "createServer" ), LFUNCVAL( httpd_create ) },
+  { LSTRKEY( "__metatable" ),  LROVAL( httpd_map ) },
+  { LNILKEY, LNILVAL }
+};
+
+int luaopen_httpd( lua_State *L ) {
+  luaL_rometatable(L, HTTPD_SERVER, (void *)httpd_server_map);
+  luaL_rometatable(L, HTTPD_CONN, (void *)httpd_conn_map);
+  return 0;
+}
+
+NODEMCU_MODULE(HTTPD, "httpd", httpd_map, luaopen_httpd);
@@ -57,7 +57,8 @@ extern const luaR_entry math_map[];
 BUILTIN_LIB(      MATH,      LUA_MATHLIBNAME,   math_map);
 #endif
 
-#ifdef LUA_CROSS_COMPILER
+/* host builds that link the registrations themselves (tools/luabench) */
+#if defined(LUA_CROSS_COMPILER) && !defined(LUA_LINKED_LIBS)
 const luaL_Reg lua_libs[] = {{NULL, NULL}};
 const luaR_table lua_rotable[] = {{NULL, NULL}};
 #else 
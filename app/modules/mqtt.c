@@ -10,6 +10,7 @@
 #include "c_types.h"
 #include "mem.h"
 #include "lwip/ip_addr.h"
+#include "lwip/tcp.h"
 #include "espconn.h"
 
 #include "mqtt_msg.h"
@@ -24,6 +25,8 @@
 #define MQTT_MAX_PASS_LEN     64
 #define MQTT_SEND_TIMEOUT			5
 #define MQTT_CONNECT_TIMEOUT  5
+#define MQTT_BATCH_SIZE       1024
+#define MQTT_BATCH_MAX_SIZE   8192
 
 typedef enum {
   MQTT_INIT,
@@ -55,6 +58,7 @@ typedef struct mqtt_state_t
   uint16_t message_length_read;
   mqtt_connection_t mqtt_connection;
   msg_queue_t* pending_msg_q;
+  msg_ring_t batch;         // QoS0 publishes, only used once set up by mqtt:batch()
 } mqtt_state_t;
 
 typedef struct lmqtt_userdata
@@ -77,6 +81,7 @@ typedef struct lmqtt_userdata
 #endif
   bool connected;     // indicate socket connected, not mqtt prot connected.
   bool keepalive_sent;
+  bool batch_sent;    // the last send was a batch, the queue goes next
   ETSTimer mqttTimer;
   tConnState connState;
 }lmqtt_userdata;
@@ -243,7 +248,29 @@ static sint8 mqtt_send_if_possible(struct espconn *pesp_conn)
   // happen
   if (mud->event_timeout == 0) {
     msg_queue_t *pending_msg = msg_peek(&(mud->mqtt_state.pending_msg_q));
-    if (pending_msg) {
+    uint16_t batch_len = 0;
+    uint8_t *batch = NULL;
+    // QoS0 publishes go out together, one segment at a time, taking turns
+    // with the queue so that acks and subscriptions are not held up
+    if (mud->connState == MQTT_DATA && !(pending_msg && mud->batch_sent))
+      batch = msg_ring_flush(&(mud->mqtt_state.batch), TCP_MSS, &batch_len);
+    if (batch) {
+      mud->batch_sent = true;
+      mud->event_timeout = MQTT_SEND_TIMEOUT;
+      NODE_DBG("Sent batch: %d\n", batch_len);
+#ifdef CLIENT_SSL_ENABLE
+      if( mud->secure )
+      {
+        espconn_status = espconn_secure_send( pesp_conn, batch, batch_len );
+      }
+      else
+#endif
+      {
+        espconn_status = espconn_send( pesp_conn, batch, batch_len );
+      }
+      mud->keep_alive_tick = 0;
+    } else if (pending_msg) {
+      mud->batch_sent = false;
       mud->event_timeout = MQTT_SEND_TIMEOUT;
       NODE_DBG("Sent: %d\n", pending_msg->msg.length);
 #ifdef CLIENT_SSL_ENABLE
@@ -519,7 +546,17 @@ static void mqtt_socket_sent(void *arg)
   uint8_t try_send = 1;
   // qos = 0, publish and forgot.
   msg_queue_t *node = msg_peek(&(mud->mqtt_state.pending_msg_q));
-  if(node && node->msg_type == MQTT_MSG_TYPE_PUBLISH && node->publish_qos == 0) {
+  if(mud->mqtt_state.batch.sending) {
+    uint16_t sent = msg_ring_sent(&(mud->mqtt_state.batch));
+    if(mud->cb_puback_ref != LUA_NOREF && mud->self_ref != LUA_NOREF) {
+      lua_State *L = lua_getstate();
+      while(sent--) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
+        lua_call(L, 1, 0);
+      }
+    }
+  } else if(node && node->msg_type == MQTT_MSG_TYPE_PUBLISH && node->publish_qos == 0) {
     msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
     if(mud->cb_puback_ref != LUA_NOREF && mud->self_ref != LUA_NOREF) {
       lua_State *L = lua_getstate();
@@ -553,6 +590,8 @@ static void mqtt_socket_connected(void *arg)
   if(mud == NULL)
     return;
   mud->connected = true;
+  // a batch cut off by the last connection is not sent again
+  msg_ring_sent(&(mud->mqtt_state.batch));
   espconn_regist_recvcb(pesp_conn, mqtt_socket_received);
   espconn_regist_sentcb(pesp_conn, mqtt_socket_sent);
   espconn_regist_disconcb(pesp_conn, mqtt_socket_disconnected);
@@ -602,7 +641,9 @@ void mqtt_socket_timer(void *arg)
       return;
     } else {
       NODE_DBG("event timeout. \n");
-      if(mud->connState == MQTT_DATA)
+      if(mud->connState == MQTT_DATA && mud->mqtt_state.batch.sending)
+        msg_ring_sent(&(mud->mqtt_state.batch));
+      else if(mud->connState == MQTT_DATA)
         msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
       // should remove the head of the queue and re-send with DUP = 1
       // Not implemented yet.
@@ -656,7 +697,7 @@ void mqtt_socket_timer(void *arg)
     mqtt_connack_fail(mud, MQTT_CONN_FAIL_TIMEOUT_RECEIVING);
   } else if(mud->connState == MQTT_DATA){
     msg_queue_t *pending_msg = msg_peek(&(mud->mqtt_state.pending_msg_q));
-    if(pending_msg){
+    if(pending_msg || msg_ring_pending(&(mud->mqtt_state.batch))){
       mqtt_send_if_possible(mud->pesp_conn);
     } else {
       // no queued event.
@@ -836,6 +877,8 @@ static int mqtt_delete( lua_State* L )
   while(mud->mqtt_state.pending_msg_q) {
     msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
   }
+  // ---- alloc-ed in mqtt_socket_batch()
+  msg_ring_free(&(mud->mqtt_state.batch));
 
   // ---- alloc-ed in mqtt_socket_lwt()
   if(mud->connect_info.will_topic){
@@ -1177,6 +1220,7 @@ static int mqtt_socket_close( lua_State* L )
   while (mud->mqtt_state.pending_msg_q) {
     msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
   }
+  msg_ring_clear(&(mud->mqtt_state.batch));
 
   NODE_DBG("leave mqtt_socket_close.\n");
 
@@ -1495,21 +1539,40 @@ static int mqtt_socket_publish( lua_State* L )
   uint8_t retain = luaL_checkinteger( L, stack);
   stack ++;
 
-  uint8_t temp_buffer[MQTT_BUF_SIZE];
-  mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_BUF_SIZE);
-  mqtt_message_t *temp_msg = mqtt_msg_publish(&mud->mqtt_state.mqtt_connection,
-                       topic, payload, l,
-                       qos, retain,
-                       &msg_id);
-
   if (lua_type(L, stack) == LUA_TFUNCTION || lua_type(L, stack) == LUA_TLIGHTFUNCTION){
     lua_pushvalue(L, stack);  // copy argument (func) to the top of stack
     luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
     mud->cb_puback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }
 
-  msg_queue_t *node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
-                      msg_id, MQTT_MSG_TYPE_PUBLISH, (int)qos );
+  bool node = false;
+  if (qos == 0 && mud->mqtt_state.batch.buf) {
+    // built straight into the batch: fixed header, topic length and topic, payload
+    size_t tl = c_strlen(topic);
+    size_t need = 3 + 2 + tl + l;
+    uint8_t *space = need > MQTT_BATCH_MAX_SIZE ? NULL : msg_ring_reserve(&(mud->mqtt_state.batch), need);
+    if (space) {
+      mqtt_msg_init(&mud->mqtt_state.mqtt_connection, space, need);
+      mqtt_message_t *temp_msg = mqtt_msg_publish(&mud->mqtt_state.mqtt_connection,
+                           topic, payload, l,
+                           qos, retain,
+                           &msg_id);
+      if (temp_msg->length) {
+        msg_ring_commit(&(mud->mqtt_state.batch), temp_msg);
+        node = true;
+      }
+    }
+  } else {
+    uint8_t temp_buffer[MQTT_BUF_SIZE];
+    mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_BUF_SIZE);
+    mqtt_message_t *temp_msg = mqtt_msg_publish(&mud->mqtt_state.mqtt_connection,
+                         topic, payload, l,
+                         qos, retain,
+                         &msg_id);
+
+    node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
+                       msg_id, MQTT_MSG_TYPE_PUBLISH, (int)qos ) != NULL;
+  }
 
   sint8 espconn_status = ESPCONN_OK;
 
@@ -1526,6 +1589,39 @@ static int mqtt_socket_publish( lua_State* L )
   return 1;
 }
 
+// Lua: queued, dropped = mqtt:batch( [depth, [size, [policy]]] )
+static int mqtt_socket_batch( lua_State* L )
+{
+  NODE_DBG("enter mqtt_socket_batch.\n");
+  lmqtt_userdata *mud;
+  uint8_t stack = 1;
+
+  mud = (lmqtt_userdata *)luaL_checkudata(L, stack, "mqtt.socket");
+  luaL_argcheck(L, mud, stack, "mqtt.socket expected");
+  stack++;
+  if(mud == NULL)
+    return 0;
+
+  msg_ring_t *batch = &(mud->mqtt_state.batch);
+  if(!lua_isnoneornil(L, stack)){
+    int depth = luaL_checkinteger( L, stack);
+    int size = luaL_optinteger( L, stack + 1, MQTT_BATCH_SIZE);
+    int policy = luaL_optinteger( L, stack + 2, MSG_RING_DROP_NEWEST);
+    luaL_argcheck(L, depth >= 0 && depth <= 0xffff, stack, "invalid depth");
+    luaL_argcheck(L, size >= 16 && size <= MQTT_BATCH_MAX_SIZE, stack + 1, "invalid size");
+    luaL_argcheck(L, policy == MSG_RING_DROP_NEWEST || policy == MSG_RING_DROP_OLDEST, stack + 2, "invalid policy");
+    if(batch->sending)
+      return luaL_error( L, "batch is being sent" );
+    if(!msg_ring_init(batch, size, depth, policy))
+      return luaL_error( L, "not enough memory" );
+  }
+
+  lua_pushinteger(L, batch->count);
+  lua_pushinteger(L, batch->dropped);
+  NODE_DBG("leave mqtt_socket_batch.\n");
+  return 2;
+}
+
 // Lua: mqtt:lwt( topic, message, qos, retain, function(client) )
 static int mqtt_socket_lwt( lua_State* L )
 {
@@ -1612,6 +1708,7 @@ static const LUA_REG_TYPE mqtt_socket_map[] = {
   { LSTRKEY( "subscribe" ), LFUNCVAL( mqtt_socket_subscribe ) },
   { LSTRKEY( "unsubscribe" ), LFUNCVAL( mqtt_socket_unsubscribe ) },
   { LSTRKEY( "lwt" ),       LFUNCVAL( mqtt_socket_lwt ) },
+  { LSTRKEY( "batch" ),     LFUNCVAL( mqtt_socket_batch ) },
   { LSTRKEY( "on" ),        LFUNCVAL( mqtt_socket_on ) },
   { LSTRKEY( "__gc" ),      LFUNCVAL( mqtt_delete ) },
   { LSTRKEY( "__index" ),   LROVAL( mqtt_socket_map ) },
@@ -1634,6 +1731,9 @@ static const LUA_REG_TYPE mqtt_map[] = {
   { LSTRKEY( "CONNACK_REFUSED_BAD_USER_OR_PASS" ),      LNUMVAL( MQTT_CONNACK_REFUSED_BAD_USER_OR_PASS ) },
   { LSTRKEY( "CONNACK_REFUSED_NOT_AUTHORIZED" ),        LNUMVAL( MQTT_CONNACK_REFUSED_NOT_AUTHORIZED ) },
 
+  { LSTRKEY( "DROP_NEWEST" ),                           LNUMVAL( MSG_RING_DROP_NEWEST ) },
+  { LSTRKEY( "DROP_OLDEST" ),                           LNUMVAL( MSG_RING_DROP_OLDEST ) },
+
   { LSTRKEY( "__metatable" ),                           LROVAL( mqtt_map ) },
   { LNILKEY, LNILVAL }
 };
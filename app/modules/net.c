@@ -17,6 +17,8 @@
 #include "lwip/igmp.h"
 #include "lwip/tcp.h"
 #include "lwip/udp.h"
+#include "vfs.h"
+#include "task/task.h"
 
 #if defined(CLIENT_SSL_ENABLE) && defined(LUA_USE_MODULES_NET) && defined(LUA_USE_MODULES_TLS)
 #define TLS_MODULE_PRESENT
@@ -42,6 +44,14 @@ static const net_table_name NET_TABLES[] = {
 #define TYPE_TCP TYPE_TCP_CLIENT
 #define TYPE_UDP TYPE_UDP_SOCKET
 
+// Small sends gathered into one segment, see net_batch_add().
+typedef struct net_batch {
+  os_timer_t timer;
+  uint32_t delay;           // ms from the first queued byte to the flush
+  uint16_t len;             // bytes queued
+  char data[TCP_MSS];
+} net_batch;
+
 typedef struct lnet_userdata {
   enum net_type type;
   int self_ref;
@@ -65,6 +75,24 @@ typedef struct lnet_userdata {
       int cb_connect_ref;
       int cb_disconnect_ref;
       int cb_reconnect_ref;
+      // Data streamed as the send buffer drains:
+      int stream;               // 1 until all of it has been acknowledged
+      int stream_ref;           // string being sent, or LUA_NOREF
+      int stream_fd;            // file being sent, or 0
+      const char *stream_data;  // next byte of the string
+      uint32_t stream_left;     // bytes not yet queued
+      // Received data held back to be delivered in one piece:
+      struct pbuf *rx_pending;  // chains not yet delivered, or NULL
+      uint16_t rx_coalesce;     // deliver once this many bytes are held
+      uint8_t rx_flush;         // 1 while a flush task is posted
+      // Receive window accounting, only while rx_high is set:
+      uint8_t rx_throttled;     // 1 from rx_high until back to rx_low
+      uint16_t rx_high;         // stop reopening the window at this backlog
+      uint16_t rx_low;          // resume once the backlog is down to this
+      uint32_t rx_backlog;      // bytes delivered but not yet consumed
+      uint32_t rx_credit;       // bytes consumed but not yet reopened
+      net_batch *batch;         // send queue, or NULL when not batching
+      uint8_t closing;          // 1 while close() waits for the batch to go out
     } client;
   };
 } lnet_userdata;
@@ -112,6 +140,20 @@ lnet_userdata *net_create( lua_State *L, enum net_type type ) {
       ud->client.cb_reconnect_ref = LUA_NOREF;
       ud->client.cb_disconnect_ref = LUA_NOREF;
       ud->client.hold = 0;
+      ud->client.stream = 0;
+      ud->client.stream_ref = LUA_NOREF;
+      ud->client.stream_fd = 0;
+      ud->client.stream_left = 0;
+      ud->client.rx_pending = NULL;
+      ud->client.rx_coalesce = 0;
+      ud->client.rx_flush = 0;
+      ud->client.rx_throttled = 0;
+      ud->client.rx_high = 0;
+      ud->client.rx_low = 0;
+      ud->client.rx_backlog = 0;
+      ud->client.rx_credit = 0;
+      ud->client.batch = NULL;
+      ud->client.closing = 0;
     case TYPE_UDP_SOCKET:
       ud->client.wait_dns = 0;
       ud->client.cb_dns_ref = LUA_NOREF;
@@ -125,17 +167,228 @@ lnet_userdata *net_create( lua_State *L, enum net_type type ) {
   return ud;
 }
 
+#pragma mark - Streamed send
+
+// Data larger than the TCP send buffer is queued piecewise as it drains.
+// lwIP is built with LWIP_NETIF_TX_SINGLE_PBUF, so tcp_write() copies
+// anyway; what streaming saves is holding the whole payload in lwIP, or
+// for files in the Lua heap, at once.
+#define NET_STREAM_CHUNK 512
+
+// lwIP polls a connection every NET_POLL_INTERVAL * 500ms
+#define NET_POLL_INTERVAL 2
+
+static err_t net_poll_cb(void *arg, struct tcp_pcb *tpcb);
+
+static void net_stream_end( lua_State *L, lnet_userdata *ud ) {
+  luaL_unref(L, LUA_REGISTRYINDEX, ud->client.stream_ref);
+  ud->client.stream_ref = LUA_NOREF;
+  if (ud->client.stream_fd) {
+    vfs_close(ud->client.stream_fd);
+    ud->client.stream_fd = 0;
+  }
+  ud->client.stream_left = 0;
+}
+
+static void net_stream_free( lua_State *L, lnet_userdata *ud ) {
+  if (ud->type == TYPE_TCP_CLIENT && ud->client.stream) {
+    net_stream_end(L, ud);
+    ud->client.stream = 0;
+  }
+}
+
+// Queue as much of the stream as the send buffer takes. On an error other
+// than running out of lwIP memory the stream is dropped and the error
+// returned.
+static err_t net_stream_more( lnet_userdata *ud ) {
+  struct tcp_pcb *pcb = ud->tcp_pcb;
+  char buf[NET_STREAM_CHUNK];
+  err_t err = ERR_OK;
+  while (ud->client.stream_left > 0 && tcp_sndbuf(pcb) > 0) {
+    uint32_t n = LWIP_MIN(ud->client.stream_left, tcp_sndbuf(pcb));
+    const char *data = ud->client.stream_data;
+    if (ud->client.stream_fd) {
+      sint32_t got = vfs_read(ud->client.stream_fd, buf, LWIP_MIN(n, sizeof(buf)));
+      if (got <= 0) {  // file got shorter
+        ud->client.stream_left = 0;
+        break;
+      }
+      n = got;
+      data = buf;
+    }
+    err = tcp_write(pcb, data, n, TCP_WRITE_FLAG_COPY |
+                    (n < ud->client.stream_left ? TCP_WRITE_FLAG_MORE : 0));
+    if (err != ERR_OK) {
+      if (ud->client.stream_fd)
+        vfs_lseek(ud->client.stream_fd, -(sint32_t)n, VFS_SEEK_CUR);
+      if (err == ERR_MEM)  // queue full, wait for an ack or the poll
+        err = ERR_OK;
+      break;
+    }
+    ud->client.stream_data += n;
+    ud->client.stream_left -= n;
+  }
+  if (err != ERR_OK) {
+    net_stream_free(lua_getstate(), ud);
+    return err;
+  }
+  if (ud->client.stream_left == 0)
+    net_stream_end(lua_getstate(), ud);
+  tcp_output(pcb);
+  if (ud->client.stream_left && !pcb->unacked)
+    tcp_poll(pcb, net_poll_cb, NET_POLL_INTERVAL);  // no ack will come to go on
+  return err;
+}
+
+#pragma mark - Batched send
+
+// With batching on, sends smaller than a segment are copied into the
+// batch instead of each becoming a tcp_write() of its own. The batch goes
+// out when it fills up, when its timer runs, on flush() or close(), when
+// an ack arrives (as Nagle would) and ahead of any larger send, so the
+// byte order on the wire is always that of the send() calls.
+
+// Hand the batch to lwIP. If lwIP is out of segments the data stays
+// queued for the next ack or timer run.
+static err_t net_batch_flush( lnet_userdata *ud ) {
+  net_batch *b = ud->client.batch;
+  if (!b || !b->len) return ERR_OK;
+  if (!ud->tcp_pcb) {
+    b->len = 0;
+    os_timer_disarm(&b->timer);
+    return ERR_CONN;
+  }
+  err_t err = tcp_write(ud->tcp_pcb, b->data, b->len, TCP_WRITE_FLAG_COPY);
+  if (err == ERR_MEM) {
+    os_timer_disarm(&b->timer);
+    os_timer_arm(&b->timer, b->delay, 0);
+    return ERR_OK;
+  }
+  b->len = 0;
+  os_timer_disarm(&b->timer);
+  tcp_output(ud->tcp_pcb);
+  return err;
+}
+
+static void net_batch_timeout( void *arg ) {
+  net_batch_flush((lnet_userdata *)arg);
+}
+
+// Drop whatever is queued, the connection is gone.
+static void net_batch_reset( lnet_userdata *ud ) {
+  if (ud->type == TYPE_TCP_CLIENT && ud->client.batch) {
+    ud->client.batch->len = 0;
+    os_timer_disarm(&ud->client.batch->timer);
+  }
+}
+
+// Queue data that fits the batch. Returns 0 if it is a segment or more
+// and should be sent directly, which is only done once the batch is out.
+// Otherwise the data was queued, or *err says why it could not be.
+static int net_batch_add( lnet_userdata *ud, const char *data, size_t len, err_t *err ) {
+  net_batch *b = ud->client.batch;
+  *err = ERR_OK;
+  if (b->len + len > sizeof(b->data)) {
+    *err = net_batch_flush(ud);
+    if (*err == ERR_OK && b->len)
+      *err = ERR_MEM;  // lwIP still can't take the batch
+    if (*err != ERR_OK)
+      return 1;
+  }
+  if (len >= sizeof(b->data))
+    return 0;
+  if (!b->len)
+    os_timer_arm(&b->timer, b->delay, 0);
+  c_memcpy(b->data + b->len, data, len);
+  b->len += len;
+  if (b->len == sizeof(b->data))
+    *err = net_batch_flush(ud);
+  return 1;
+}
+
+static void net_batch_free( lnet_userdata *ud ) {
+  if (ud->type == TYPE_TCP_CLIENT && ud->client.batch) {
+    os_timer_disarm(&ud->client.batch->timer);
+    c_free(ud->client.batch);
+    ud->client.batch = NULL;
+  }
+}
+
+// Set when net_tcp_close() had to abort a pcb, so that the lwIP callback
+// we are in, if it is for that pcb, can report it with ERR_ABRT.
+static struct tcp_pcb *net_aborted;
+
+static err_t net_tcp_result( struct tcp_pcb *tpcb ) {
+  if (net_aborted != tpcb) return ERR_OK;
+  net_aborted = NULL;
+  return ERR_ABRT;
+}
+
+// Close the connection once lwIP has taken the batch. Until then the
+// close is retried from the sent and poll callbacks. Returns ERR_ABRT if
+// the pcb had to be aborted.
+static err_t net_tcp_close( lnet_userdata *ud ) {
+  net_batch_flush(ud);
+  if (ud->client.batch && ud->client.batch->len) {
+    ud->client.closing = 1;
+    tcp_poll(ud->tcp_pcb, net_poll_cb, NET_POLL_INTERVAL);
+    return ERR_OK;
+  }
+  ud->client.closing = 0;
+  tcp_poll(ud->tcp_pcb, NULL, 0);
+  err_t err = ERR_OK;
+  if (ERR_OK != tcp_close(ud->tcp_pcb)) {
+    tcp_arg(ud->tcp_pcb, NULL);
+    tcp_abort(ud->tcp_pcb);
+    net_aborted = ud->tcp_pcb;
+    err = ERR_ABRT;
+  }
+  ud->tcp_pcb = NULL;
+  return err;
+}
+
+// Go on with a close() that waited for the batch.
+static err_t net_tcp_close_pending( lnet_userdata *ud ) {
+  err_t err = net_tcp_close(ud);
+  if (!ud->pcb && ud->client.wait_dns == 0) {
+    lua_State *L = lua_getstate();
+    lua_gc(L, LUA_GCSTOP, 0);
+    luaL_unref(L, LUA_REGISTRYINDEX, ud->self_ref);
+    ud->self_ref = LUA_NOREF;
+    lua_gc(L, LUA_GCRESTART, 0);
+  }
+  return err;
+}
+
 #pragma mark - LWIP callbacks
 
+static void net_rx_free( lnet_userdata *ud ) {
+  if (ud->type != TYPE_TCP_CLIENT) return;
+  if (ud->client.rx_pending) {
+    pbuf_free(ud->client.rx_pending);
+    ud->client.rx_pending = NULL;
+  }
+  ud->client.rx_flush = 0;  // a posted flush no longer matches self_ref
+  ud->client.rx_throttled = 0;
+  ud->client.rx_backlog = 0;
+  ud->client.rx_credit = 0;
+}
+
 static void net_err_cb(void *arg, err_t err) {
   lnet_userdata *ud = (lnet_userdata*)arg;
   if (!ud || ud->type != TYPE_TCP_CLIENT || ud->self_ref == LUA_NOREF) return;
   ud->pcb = NULL; // Will be freed at LWIP level
   lua_State *L = lua_getstate();
+  net_stream_free(L, ud);
+  net_rx_free(ud);
+  net_batch_reset(ud);
   int ref;
-  if (err != ERR_OK && ud->client.cb_reconnect_ref != LUA_NOREF)
+  if (ud->client.closing)
+    ref = LUA_NOREF;  // closed by the script already
+  else if (err != ERR_OK && ud->client.cb_reconnect_ref != LUA_NOREF)
     ref = ud->client.cb_reconnect_ref;
   else ref = ud->client.cb_disconnect_ref;
+  ud->client.closing = 0;
   if (ref != LUA_NOREF) {
     lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
     lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
@@ -150,6 +403,15 @@ static void net_err_cb(void *arg, err_t err) {
   }
 }
 
+// A stream failed from an lwIP callback: drop the connection and report
+// the error to the reconnection or disconnection callback.
+static err_t net_stream_failed( lnet_userdata *ud, struct tcp_pcb *tpcb, err_t err ) {
+  tcp_arg(tpcb, NULL);
+  tcp_abort(tpcb);
+  net_err_cb(ud, err);
+  return ERR_ABRT;
+}
+
 static err_t net_connected_cb(void *arg, struct tcp_pcb *tpcb, err_t err) {
   lnet_userdata *ud = (lnet_userdata*)arg;
   if (!ud || ud->pcb != tpcb) return ERR_ABRT;
@@ -158,12 +420,13 @@ static err_t net_connected_cb(void *arg, struct tcp_pcb *tpcb, err_t err) {
     return ERR_ABRT;
   }
   lua_State *L = lua_getstate();
+  net_aborted = NULL;
   if (ud->self_ref != LUA_NOREF && ud->client.cb_connect_ref != LUA_NOREF) {
     lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.cb_connect_ref);
     lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
     lua_call(L, 1, 0);
   }
-  return ERR_OK;
+  return net_tcp_result(tpcb);
 }
 
 static void net_dns_cb(const char *name, ip_addr_t *ipaddr, void *arg) {
@@ -197,6 +460,21 @@ static void net_dns_cb(const char *name, ip_addr_t *ipaddr, void *arg) {
   }
 }
 
+// Push a whole pbuf chain as one string. A chain is what lwIP hands us
+// for one datagram or one batch of in-order segments, so no data gets
+// cut off at the first pbuf.
+static void net_push_pbuf( lua_State *L, struct pbuf *p ) {
+  if (!p->next) {
+    lua_pushlstring(L, p->payload, p->len);
+    return;
+  }
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  for (; p; p = p->next)
+    luaL_addlstring(&b, p->payload, p->len);
+  luaL_pushresult(&b);
+}
+
 static void net_recv_cb(lnet_userdata *ud, struct pbuf *p, ip_addr_t *addr, u16_t port) {
   if (ud->client.cb_receive_ref == LUA_NOREF) {
     pbuf_free(p);
@@ -206,7 +484,7 @@ static void net_recv_cb(lnet_userdata *ud, struct pbuf *p, ip_addr_t *addr, u16_
   int num_args = 2;
   lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.cb_receive_ref);
   lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
-  lua_pushlstring(L, p->payload, p->len);
+  net_push_pbuf(L, p);
   if (ud->type == TYPE_UDP_SOCKET) {
     num_args += 2;
     char iptmp[16];
@@ -215,8 +493,8 @@ static void net_recv_cb(lnet_userdata *ud, struct pbuf *p, ip_addr_t *addr, u16_
     lua_pushinteger(L, port);
     lua_pushstring(L, iptmp);
   }
-  lua_call(L, num_args, 0);
   pbuf_free(p);
+  lua_call(L, num_args, 0);
 }
 
 static void net_udp_recv_cb(void *arg, struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *addr, u16_t port) {
@@ -228,27 +506,156 @@ static void net_udp_recv_cb(void *arg, struct udp_pcb *pcb, struct pbuf *p, ip_a
   net_recv_cb(ud, p, addr, port);
 }
 
+// With watermarks set the window is reopened by what the consumer reports
+// as done with, not by what was delivered. Credit is returned as it comes
+// in until the backlog reaches rx_high, then held until it is down to
+// rx_low, so a slow consumer throttles the peer without the window
+// flapping. lwIP itself only sends a window update once it has grown by
+// a useful amount.
+static void net_rx_consumed( lnet_userdata *ud, uint32_t len ) {
+  if (len > ud->client.rx_backlog)
+    len = ud->client.rx_backlog;
+  ud->client.rx_backlog -= len;
+  ud->client.rx_credit += len;
+  if (ud->client.rx_throttled && ud->client.rx_backlog > ud->client.rx_low)
+    return;
+  ud->client.rx_throttled = 0;
+  if (ud->tcp_pcb && !ud->client.hold && ud->client.rx_credit) {
+    tcp_recved(ud->tcp_pcb, ud->client.rx_credit);
+    ud->client.rx_credit = 0;
+  }
+}
+
+// Deliver the held chains to Lua and only then open the window for them.
+static void net_rx_deliver( lnet_userdata *ud ) {
+  struct pbuf *p = ud->client.rx_pending;
+  if (!p) return;
+  ud->client.rx_pending = NULL;
+  if (!ud->client.rx_high) {
+    net_recv_cb(ud, p, 0, 0);
+    if (ud->tcp_pcb)
+      tcp_recved(ud->tcp_pcb, ud->client.hold ? 0 : TCP_WND);
+    return;
+  }
+  // Counted before the callback, which may report it consumed right away.
+  uint16_t len = p->tot_len;
+  ud->client.rx_backlog += len;
+  if (ud->client.rx_backlog >= ud->client.rx_high)
+    ud->client.rx_throttled = 1;
+  int nocb = ud->client.cb_receive_ref == LUA_NOREF;
+  net_recv_cb(ud, p, 0, 0);
+  if (nocb)  // dropped, nobody will consume it
+    net_rx_consumed(ud, len);
+}
+
+// Runs once lwIP has handed over everything it had queued, so whatever
+// is still held below the threshold is delivered now rather than waiting
+// for more data that may never come. The socket is found again through
+// its registry ref, as it may have been closed and collected meanwhile.
+static task_handle_t net_rx_flush_task;
+static void net_rx_flush( task_param_t param, uint8_t prio ) {
+  lua_State *L = lua_getstate();
+  int ref = (int)param;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+  lnet_userdata *ud = (lnet_userdata *)lua_touserdata(L, -1);
+  if (ud && lua_getmetatable(L, -1)) {
+    luaL_getmetatable(L, NET_TABLE_TCP_CLIENT);
+    if (!lua_rawequal(L, -1, -2) || ud->self_ref != ref)
+      ud = NULL;
+    lua_pop(L, 2);
+  } else {
+    ud = NULL;
+  }
+  lua_pop(L, 1);
+  if (ud) {
+    ud->client.rx_flush = 0;
+    net_rx_deliver(ud);
+  }
+}
+
 static err_t net_tcp_recv_cb(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
   lnet_userdata *ud = (lnet_userdata*)arg;
   if (!ud || !ud->pcb || ud->type != TYPE_TCP_CLIENT || ud->self_ref == LUA_NOREF)
     return ERR_ABRT;
+  net_aborted = NULL;
+  if (ud->client.closing) {  // nobody to deliver to any more
+    if (p) {
+      tcp_recved(tpcb, p->tot_len);
+      pbuf_free(p);
+    }
+    return ERR_OK;
+  }
   if (!p) {
+    net_rx_deliver(ud);
+    if (ud->pcb != tpcb)  // closed from the receive callback
+      return net_tcp_result(tpcb);
     net_err_cb(arg, err);
     return tcp_close(tpcb);
   }
-  net_recv_cb(ud, p, 0, 0);
-  tcp_recved(tpcb, ud->client.hold ? 0 : TCP_WND);
-  return ERR_OK;
+  if (ud->client.rx_pending)
+    pbuf_cat(ud->client.rx_pending, p);
+  else
+    ud->client.rx_pending = p;
+  if (ud->client.rx_pending->tot_len < ud->client.rx_coalesce) {
+    if (ud->client.rx_flush)
+      return ERR_OK;
+    if (!net_rx_flush_task)
+      net_rx_flush_task = task_get_id(net_rx_flush);
+    if (task_post_low(net_rx_flush_task, (task_param_t)ud->self_ref)) {
+      ud->client.rx_flush = 1;
+      return ERR_OK;
+    }
+  }
+  net_rx_deliver(ud);
+  return net_tcp_result(tpcb);
 }
 
 static err_t net_sent_cb(void *arg, struct tcp_pcb *tpcb, u16_t len) {
   lnet_userdata *ud = (lnet_userdata*)arg;
   if (!ud || !ud->pcb || ud->type != TYPE_TCP_CLIENT || ud->self_ref == LUA_NOREF) return ERR_ABRT;
+  net_aborted = NULL;
+  if (ud->client.closing) {
+    net_tcp_close_pending(ud);
+    return net_tcp_result(tpcb);
+  }
+  if (ud->client.stream) {
+    if (ud->client.stream_left) {
+      err_t err = net_stream_more(ud);
+      return err == ERR_OK ? ERR_OK : net_stream_failed(ud, tpcb, err);
+    }
+    if (tpcb->unsent || tpcb->unacked)
+      return ERR_OK;  // report the stream as sent once it is all acked
+    ud->client.stream = 0;
+  }
+  if (ud->client.batch) {
+    net_batch_flush(ud);
+    if (ud->client.batch->len || tpcb->unsent || tpcb->unacked)
+      return ERR_OK;  // report once per batch, when it is all acked
+  }
   if (ud->client.cb_sent_ref == LUA_NOREF) return ERR_OK;
   lua_State *L = lua_getstate();
   lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.cb_sent_ref);
   lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
   lua_call(L, 1, 0);
+  return net_tcp_result(tpcb);
+}
+
+// Retries a stream or a close that ran out of lwIP memory with nothing
+// in flight.
+static err_t net_poll_cb(void *arg, struct tcp_pcb *tpcb) {
+  lnet_userdata *ud = (lnet_userdata*)arg;
+  tcp_poll(tpcb, NULL, 0);
+  if (!ud || !ud->pcb || ud->type != TYPE_TCP_CLIENT || ud->self_ref == LUA_NOREF) return ERR_OK;
+  net_aborted = NULL;
+  if (ud->client.closing) {
+    net_tcp_close_pending(ud);
+    return net_tcp_result(tpcb);
+  }
+  if (ud->client.stream_left) {
+    err_t err = net_stream_more(ud);  // polls again if it is still stuck
+    if (err != ERR_OK)
+      return net_stream_failed(ud, tpcb, err);
+  }
   return ERR_OK;
 }
 
@@ -273,9 +680,12 @@ static err_t net_accept_cb(void *arg, struct tcp_pcb *newpcb, err_t err) {
   nud->tcp_pcb->keep_cnt = 1;
   tcp_accepted(ud->tcp_pcb);
 
+  net_aborted = NULL;
   lua_call(L, 1, 0);
+  if (nud->tcp_pcb != newpcb)  // closed by the accept callback
+    return net_tcp_result(newpcb);
 
-  return net_connected_cb(nud, nud->tcp_pcb, ERR_OK);
+  return net_connected_cb(nud, newpcb, ERR_OK);
 }
 
 #pragma mark - Lua API - create
@@ -539,6 +949,7 @@ int net_send( lua_State *L ) {
     if (!domain) return luaL_error(L, "need IP address");
     if (!ipaddr_aton(domain, &addr)) return luaL_error(L, "invalid IP address");
   }
+  int data_idx = stack;
   data = luaL_checklstring(L, stack++, &datalen);
   if (!data || datalen == 0) return luaL_error(L, "no data to send");
   if (lua_isfunction(L, stack) || lua_islightfunction(L, stack)) {
@@ -579,11 +990,73 @@ int net_send( lua_State *L ) {
       lua_call(L, 1, 0);
     }
   } else if (ud->type == TYPE_TCP_CLIENT) {
-    err = tcp_write(ud->tcp_pcb, data, datalen, TCP_WRITE_FLAG_COPY);
+    if (ud->client.closing)
+      return luaL_error(L, "not connected");
+    if (ud->client.stream)
+      return luaL_error(L, "send in progress");
+    if (ud->client.batch && net_batch_add(ud, data, datalen, &err)) {
+      // queued, or sent along with the batch
+    } else if (datalen <= tcp_sndbuf(ud->tcp_pcb)) {
+      err = tcp_write(ud->tcp_pcb, data, datalen, TCP_WRITE_FLAG_COPY);
+    } else {
+      // Too big to queue at once: keep the string until it is all queued
+      lua_pushvalue(L, data_idx);
+      ud->client.stream_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+      ud->client.stream_data = data;
+      ud->client.stream_left = datalen;
+      ud->client.stream = 1;
+      err = net_stream_more(ud);
+    }
   }
   return lwip_lua_checkerr(L, err);
 }
 
+// Lua: client:sendfile(filename[, offset[, length]][, function(c)])
+int net_sendfile( lua_State *L ) {
+  lnet_userdata *ud = net_get_udata(L);
+  if (!ud || ud->type != TYPE_TCP_CLIENT)
+    return luaL_error(L, "invalid user data");
+  const char *fname = luaL_checkstring(L, 2);
+  int stack = 3;
+  uint32_t offset = 0, length = (uint32_t)-1;
+  if (lua_isnumber(L, stack))
+    offset = luaL_checkinteger(L, stack++);
+  if (lua_isnumber(L, stack))
+    length = luaL_checkinteger(L, stack++);
+  if (lua_isfunction(L, stack) || lua_islightfunction(L, stack)) {
+    lua_pushvalue(L, stack++);
+    luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_sent_ref);
+    ud->client.cb_sent_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  if (!ud->pcb || ud->self_ref == LUA_NOREF || ud->client.closing)
+    return luaL_error(L, "not connected");
+  if (ud->client.stream)
+    return luaL_error(L, "send in progress");
+  if (ud->client.batch) {
+    err_t err = net_batch_flush(ud);
+    if (err == ERR_OK && ud->client.batch->len)
+      err = ERR_MEM;
+    if (err != ERR_OK)
+      return lwip_lua_checkerr(L, err);
+  }
+  int fd = vfs_open(fname, "r");
+  if (!fd)
+    return luaL_error(L, "cannot open %s", fname);
+  uint32_t size = vfs_size(fd);
+  if (offset > size)
+    offset = size;
+  if (length > size - offset)
+    length = size - offset;
+  if (length == 0 || vfs_lseek(fd, offset, VFS_SEEK_SET) < 0) {
+    vfs_close(fd);
+    return luaL_error(L, "no data to send");
+  }
+  ud->client.stream_fd = fd;
+  ud->client.stream_left = length;
+  ud->client.stream = 1;
+  return lwip_lua_checkerr(L, net_stream_more(ud));
+}
+
 // Lua: client:hold()
 int net_hold( lua_State *L ) {
   lnet_userdata *ud = net_get_udata(L);
@@ -603,11 +1076,104 @@ int net_unhold( lua_State *L ) {
   if (ud->client.hold && ud->tcp_pcb) {
 	ud->client.hold = 0;
 	ud->tcp_pcb->flags |= TF_ACK_NOW;
-    tcp_recved(ud->tcp_pcb, TCP_WND);
+    if (ud->client.rx_high)
+      net_rx_consumed(ud, 0);
+    else
+      tcp_recved(ud->tcp_pcb, TCP_WND);
+  }
+  return 0;
+}
+
+// Lua: client:watermark([high[, low]])
+int net_watermark( lua_State *L ) {
+  lnet_userdata *ud = net_get_udata(L);
+  if (!ud || ud->type != TYPE_TCP_CLIENT)
+    return luaL_error(L, "invalid user data");
+  int high = luaL_optinteger(L, 2, 0);
+  int low = luaL_optinteger(L, 3, high / 2);
+  luaL_argcheck(L, high >= 0 && high <= 0xffff, 2, "out of range");
+  luaL_argcheck(L, low >= 0 && (low < high || high == 0), 3, "must be below high");
+  int was = ud->client.rx_high;
+  ud->client.rx_high = high;
+  ud->client.rx_low = low;
+  if (high == 0) {
+    // back to reopening the window on delivery
+    ud->client.rx_backlog = 0;
+    ud->client.rx_credit = 0;
+    ud->client.rx_throttled = 0;
+    if (was && ud->tcp_pcb && !ud->client.hold)
+      tcp_recved(ud->tcp_pcb, TCP_WND);
+  } else if (ud->client.rx_backlog >= high) {
+    ud->client.rx_throttled = 1;
+  } else {
+    net_rx_consumed(ud, 0);
+  }
+  return 0;
+}
+
+// Lua: client:consumed(bytes), returns the bytes still unconsumed
+int net_consumed( lua_State *L ) {
+  lnet_userdata *ud = net_get_udata(L);
+  if (!ud || ud->type != TYPE_TCP_CLIENT)
+    return luaL_error(L, "invalid user data");
+  int len = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, len >= 0, 2, "must be >= 0");
+  if (ud->client.rx_high)
+    net_rx_consumed(ud, len);
+  lua_pushinteger(L, ud->client.rx_backlog);
+  return 1;
+}
+
+// Lua: client:coalesce([bytes]), returns the previous setting
+int net_coalesce( lua_State *L ) {
+  lnet_userdata *ud = net_get_udata(L);
+  if (!ud || ud->type != TYPE_TCP_CLIENT)
+    return luaL_error(L, "invalid user data");
+  int old = ud->client.rx_coalesce;
+  if (lua_isnumber(L, 2)) {
+    int n = lua_tointeger(L, 2);
+    luaL_argcheck(L, n >= 0, 2, "must be >= 0");
+    ud->client.rx_coalesce = LWIP_MIN(n, TCP_WND);
+    if (ud->client.rx_pending &&
+        ud->client.rx_pending->tot_len >= ud->client.rx_coalesce)
+      net_rx_deliver(ud);
   }
+  lua_pushinteger(L, old);
+  return 1;
+}
+
+// Lua: client:batch([ms])
+int net_batch_set( lua_State *L ) {
+  lnet_userdata *ud = net_get_udata(L);
+  if (!ud || ud->type != TYPE_TCP_CLIENT)
+    return luaL_error(L, "invalid user data");
+  int delay = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, delay >= 0, 2, "must be >= 0");
+  if (delay == 0) {
+    err_t err = net_batch_flush(ud);
+    net_batch_free(ud);
+    return lwip_lua_checkerr(L, err);
+  }
+  if (!ud->client.batch) {
+    net_batch *b = (net_batch *)c_malloc(sizeof(net_batch));
+    if (!b)
+      return luaL_error(L, "out of memory");
+    b->len = 0;
+    os_timer_setfn(&b->timer, net_batch_timeout, ud);
+    ud->client.batch = b;
+  }
+  ud->client.batch->delay = delay;
   return 0;
 }
 
+// Lua: client:flush()
+int net_flush( lua_State *L ) {
+  lnet_userdata *ud = net_get_udata(L);
+  if (!ud || ud->type != TYPE_TCP_CLIENT)
+    return luaL_error(L, "invalid user data");
+  return lwip_lua_checkerr(L, net_batch_flush(ud));
+}
+
 // Lua: client/socket:dns(domain, callback(socket, addr))
 int net_dns( lua_State *L ) {
   lnet_userdata *ud = net_get_udata(L);
@@ -734,11 +1300,11 @@ int net_close( lua_State *L ) {
   if (ud->pcb) {
     switch (ud->type) {
       case TYPE_TCP_CLIENT:
-        if (ERR_OK != tcp_close(ud->tcp_pcb)) {
-          tcp_arg(ud->tcp_pcb, NULL);
-          tcp_abort(ud->tcp_pcb);
-        }
-        ud->tcp_pcb = NULL;
+        if (ud->client.closing)
+          return luaL_error(L, "not connected");
+        net_stream_free(L, ud);
+        net_rx_free(ud);
+        net_tcp_close(ud);
         break;
       case TYPE_TCP_SERVER:
         tcp_close(ud->tcp_pcb);
@@ -784,6 +1350,9 @@ int net_delete( lua_State *L ) {
   }
   switch (ud->type) {
     case TYPE_TCP_CLIENT:
+      net_stream_free(L, ud);
+      net_rx_free(ud);
+      net_batch_free(ud);
       luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_connect_ref);
       ud->client.cb_connect_ref = LUA_NOREF;
       luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_disconnect_ref);
@@ -977,6 +1546,12 @@ static const LUA_REG_TYPE net_tcpsocket_map[] = {
   { LSTRKEY( "close" ),   LFUNCVAL( net_close ) },
   { LSTRKEY( "on" ),      LFUNCVAL( net_on ) },
   { LSTRKEY( "send" ),    LFUNCVAL( net_send ) },
+  { LSTRKEY( "sendfile" ), LFUNCVAL( net_sendfile ) },
+  { LSTRKEY( "coalesce" ), LFUNCVAL( net_coalesce ) },
+  { LSTRKEY( "watermark" ), LFUNCVAL( net_watermark ) },
+  { LSTRKEY( "consumed" ), LFUNCVAL( net_consumed ) },
+  { LSTRKEY( "batch" ),   LFUNCVAL( net_batch_set ) },
+  { LSTRKEY( "flush" ),   LFUNCVAL( net_flush ) },
   { LSTRKEY( "hold" ),    LFUNCVAL( net_hold ) },
   { LSTRKEY( "unhold" ),  LFUNCVAL( net_unhold ) },
   { LSTRKEY( "dns" ),     LFUNCVAL( net_dns ) },
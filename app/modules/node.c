@@ -14,6 +14,7 @@
 #include "lopcodes.h"
 #include "lstring.h"
 #include "lundump.h"
+#include "lflash.h"
 
 #include "platform.h"
 #include "lrodefs.h"
@@ -317,6 +318,37 @@ static int node_compile( lua_State* L )
   return 0;
 }
 
+#ifdef LUA_FLASH_STORE
+// Lua: flashindex(module) -- function for module in the flash store, or nil
+// Lua: flashindex() -- table of module names, image size, store size
+static int node_flashindex( lua_State* L )
+{
+  if (lua_isnoneornil(L, 1))
+    return luaN_list(L);
+
+  int status = luaN_index(L, luaL_checkstring(L, 1));
+  if (status < 0) {
+    lua_pushnil(L);
+  } else if (status != 0) {
+    return luaL_error(L, lua_tostring(L, -1));
+  }
+  return 1;
+}
+
+// Lua: flashreload(imagefile) -- copy image into the flash store and restart
+static int node_flashreload( lua_State* L )
+{
+  const char *err = luaN_reload(L, luaL_checkstring(L, 1));
+  if (err) {
+    lua_pushstring(L, err);
+    return 1;
+  }
+  // Functions loaded from the old image now point at overwritten flash
+  system_restart();
+  return 0;
+}
+#endif
+
 // Task callback handler for node.task.post()
 static task_handle_t do_node_task_handle;
 static void do_node_task (task_param_t task_fn_ref, uint8_t prio)
@@ -470,6 +502,18 @@ static int node_egc_setmode(lua_State* L) {
   legc_set_mode( L, mode, limit );
   return 0;
 }
+
+// Lua: node.egc.setbudget( microseconds )
+// Gives the collector up to this much incremental work after each dispatched
+// task and keeps it running in idle time until the cycle completes; 0 disables.
+static int node_egc_setbudget(lua_State* L) {
+  unsigned budget = luaL_checkinteger(L, 1);
+
+  luaL_argcheck(L, budget <= LEGC_MAX_BUDGET, 1, "budget too large");
+
+  legc_set_budget( L, budget );
+  return 0;
+}
 //
 // Lua: osprint(true/false)
 // Allows you to turn on the native Espressif SDK printing
@@ -561,6 +605,7 @@ static int node_random (lua_State *L) {
 
 static const LUA_REG_TYPE node_egc_map[] = {
   { LSTRKEY( "setmode" ),           LFUNCVAL( node_egc_setmode ) },
+  { LSTRKEY( "setbudget" ),         LFUNCVAL( node_egc_setbudget ) },
   { LSTRKEY( "NOT_ACTIVE" ),        LNUMVAL( EGC_NOT_ACTIVE ) },
   { LSTRKEY( "ON_ALLOC_FAILURE" ),  LNUMVAL( EGC_ON_ALLOC_FAILURE ) },
   { LSTRKEY( "ON_MEM_LIMIT" ),      LNUMVAL( EGC_ON_MEM_LIMIT ) },
@@ -593,6 +638,10 @@ static const LUA_REG_TYPE node_map[] =
 // Moved to adc module, use adc.readvdd33()
 // { LSTRKEY( "readvdd33" ), LFUNCVAL( node_readvdd33) },
   { LSTRKEY( "compile" ), LFUNCVAL( node_compile) },
+#ifdef LUA_FLASH_STORE
+  { LSTRKEY( "flashindex" ), LFUNCVAL( node_flashindex ) },
+  { LSTRKEY( "flashreload" ), LFUNCVAL( node_flashreload ) },
+#endif
   { LSTRKEY( "CPU80MHZ" ), LNUMVAL( CPU80MHZ ) },
   { LSTRKEY( "CPU160MHZ" ), LNUMVAL( CPU160MHZ ) },
   { LSTRKEY( "setcpufreq" ), LFUNCVAL( node_setcpufreq) },
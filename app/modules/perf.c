@@ -2,8 +2,13 @@
 // This module allows performance monitoring by looking at
 // the PC at regular intervals and building a histogram
 // 
-// perf.start(start, end, nbins[, pc offset on stack])
-// perf.stop()  -> total sample, samples outside range, table { addr -> count , .. }
+// perf.start(start, end, nbins[, luaslots])
+// perf.stop()  -> total sample, samples outside range, table { addr -> count , .. },
+//                 binsize, table { function -> { samples = n, line -> count, .. }, .. }
+//
+// The same samples also record which Lua function (and instruction in it)
+// the main Lua thread was running. These are resolved to source lines
+// only when the profile is collected by perf.stop().
 
 
 #include "ets_sys.h"
@@ -13,12 +18,28 @@
 
 #include "module.h"
 #include "lauxlib.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "ldebug.h"
 #include "platform.h"
 #include "hw_timer.h"
 #include "cpu_esp8266.h"
 
+// perf.stop() needs two Lua stack slots per sample, and a C function
+// gets no more than LUAI_MAXCSTACK
+#define LUA_MAX_SLOTS 2048
+
+typedef struct {
+  const void *fn;     // Proto, or C function address
+  int pc;             // instruction in the Proto, or -1 for a C function
+  uint32_t count;
+} LUASAMPLE;
+
 typedef struct {
   int ref;
+  lua_State *L;
+  LUASAMPLE *lua;
+  uint32_t lua_mask;  // number of lua slots - 1, or 0 if not profiling Lua
   uint32_t start;
   uint32_t bucket_shift;
   uint32_t bucket_count;
@@ -32,6 +53,66 @@ extern char _flash_used_end[];
 
 #define TIMER_OWNER ((os_param_t) 'p')
 
+// Lua structures may be half updated when the timer fires, so only follow
+// pointers that lead into the heap
+#define IS_DRAM(p)  ((uint32_t) (p) - 0x3FFE8000 < 0x18000 && !((uint32_t) (p) & 3))
+#define LUA_PROBES  8
+#define LIVE_PC     0x40000000
+
+static void ICACHE_RAM_ATTR lua_sample(DATA *d)
+{
+  lua_State *L = d->L;
+  CallInfo *ci = L->ci;
+  const void *fn;
+  int pc = -1;
+
+  if (ci == L->base_ci) {
+    return;     // not running Lua
+  }
+  if (ci < L->base_ci || ci >= L->end_ci || ci->func < L->stack || ci->func >= L->stack_last) {
+    return;
+  }
+  if (ttislightfunction(ci->func)) {
+    fn = fvalue(ci->func);
+  } else if (ttisfunction(ci->func) && IS_DRAM(clvalue(ci->func))) {
+    Closure *cl = clvalue(ci->func);
+    if (cl->c.isC) {
+      fn = cl->c.f;
+    } else {
+      Proto *p = cl->l.p;
+      if (!IS_DRAM(p)) {
+        return;
+      }
+      pc = L->savedpc - p->code - 1;
+      if (pc < 0) {
+        pc = 0;   // just entered
+      }
+      if (pc >= p->sizecode) {
+        return;
+      }
+      fn = p;
+    }
+  } else {
+    return;
+  }
+
+  uint32_t slot = (((uint32_t) fn >> 2) * 31 + pc) & d->lua_mask;
+  int i;
+  for (i = 0; i < LUA_PROBES; i++, slot = (slot + 1) & d->lua_mask) {
+    LUASAMPLE *e = &d->lua[slot];
+    if (e->fn == fn && e->pc == pc) {
+      e->count++;
+      return;
+    }
+    if (!e->fn) {
+      e->fn = fn;
+      e->pc = pc;
+      e->count = 1;
+      return;
+    }
+  }
+}
+
 static void ICACHE_RAM_ATTR hw_timer_cb(os_param_t p)
 {
   (void) p;
@@ -51,6 +132,9 @@ static void ICACHE_RAM_ATTR hw_timer_cb(os_param_t p)
       data->outside_samples++;
     }
     data->total_samples++;
+    if (data->lua_mask) {
+      lua_sample(data);
+    }
   }
 }
 
@@ -59,6 +143,7 @@ static int perf_start(lua_State *L)
   uint32_t start = luaL_optinteger(L, 1, 0x40000000);
   uint32_t end = luaL_optinteger(L, 2, (uint32_t) _flash_used_end);
   uint32_t bins = luaL_optinteger(L, 3, 1024);
+  uint32_t luaslots = luaL_optinteger(L, 4, 64);
 
   if (end <= start) {
     luaL_error(L, "end must be larger than start");
@@ -75,10 +160,24 @@ static int perf_start(lua_State *L)
 
   bins = (end - start + (1 << shift) - 1) / (1 << shift);
 
+  // The Lua profile table is a power of two in size
+  if (luaslots > LUA_MAX_SLOTS) {
+    luaL_error(L, "too many luaslots");
+  }
+  if (luaslots) {
+    uint32_t n;
+    for (n = 2; n < luaslots; n <<= 1) {
+    }
+    luaslots = n;
+  }
+
   size_t data_size = sizeof(DATA) + bins * sizeof(uint32_t);
-  DATA *d = (DATA *) lua_newuserdata(L, data_size);
-  memset(d, 0, data_size);
+  DATA *d = (DATA *) lua_newuserdata(L, data_size + luaslots * sizeof(LUASAMPLE));
+  memset(d, 0, data_size + luaslots * sizeof(LUASAMPLE));
   d->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  d->L = lua_getstate();
+  d->lua = (LUASAMPLE *) ((char *) d + data_size);
+  d->lua_mask = luaslots ? luaslots - 1 : 0;
   d->start = start;
   d->bucket_shift = shift;
   d->bucket_count = bins;
@@ -103,6 +202,84 @@ static int perf_start(lua_State *L)
   return 0;
 }
 
+// Turn the Lua samples into a table keyed by function, each holding the
+// sample count per source line and the total for the function.
+static void lua_profile(lua_State *L, DATA *d)
+{
+  int slots = d->lua_mask + 1;
+  int i;
+  GCObject *o;
+
+  // The Protos that were sampled may have been freed since. Find the
+  // ones still alive, then put their source names and first lines on
+  // the stack and convert the pcs to lines before anything is allocated.
+  luaL_checkstack(L, 2 * slots + 4, "perf");
+  for (o = G(L)->rootgc; o; o = o->gch.next) {
+    if (o->gch.tt == LUA_TPROTO) {
+      for (i = 0; i < slots; i++) {
+        if (d->lua[i].fn == (const void *) o && d->lua[i].pc >= 0) {
+          d->lua[i].pc |= LIVE_PC;
+        }
+      }
+    }
+  }
+  int base = lua_gettop(L);
+  for (i = 0; i < slots; i++) {
+    LUASAMPLE *e = &d->lua[i];
+    if (e->fn && e->pc >= 0) {
+      const Proto *p = (const Proto *) e->fn;
+      if (!(e->pc & LIVE_PC) || !p->source) {
+        e->fn = NULL;
+        continue;
+      }
+      e->pc = getline(p, e->pc & ~LIVE_PC);
+      setsvalue2s(L, L->top, p->source);
+      L->top++;
+      setivalue(L->top, p->linedefined);
+      L->top++;
+    }
+  }
+
+  lua_newtable(L);
+  int source = base + 1;
+  for (i = 0; i < slots; i++) {
+    LUASAMPLE *e = &d->lua[i];
+    if (!e->fn) {
+      continue;
+    }
+    if (e->pc >= 0) {
+      char buff[LUA_IDSIZE];
+      luaO_chunkid(buff, lua_tostring(L, source), LUA_IDSIZE);
+      lua_pushfstring(L, "%s:%d", buff, lua_tointeger(L, source + 1));
+      source += 2;
+    } else {
+      lua_pushfstring(L, "C:%p", e->fn);
+    }
+    lua_pushvalue(L, -1);
+    lua_rawget(L, -3);
+    if (lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      lua_createtable(L, 0, 2);
+      lua_pushvalue(L, -2);
+      lua_pushvalue(L, -2);
+      lua_rawset(L, -5);
+    }
+    lua_getfield(L, -1, "samples");
+    lua_pushinteger(L, lua_tointeger(L, -1) + e->count);
+    lua_setfield(L, -3, "samples");
+    lua_pop(L, 1);
+    if (e->pc >= 0) {
+      lua_rawgeti(L, -1, e->pc);
+      lua_pushinteger(L, lua_tointeger(L, -1) + e->count);
+      lua_rawseti(L, -3, e->pc);
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 2);
+  }
+  lua_insert(L, base + 1);
+  lua_settop(L, base + 1);
+}
+
 static int perf_stop(lua_State *L)
 {
   if (!data) {
@@ -130,9 +307,15 @@ static int perf_stop(lua_State *L)
 
   lua_pushnumber(L, 1 << d->bucket_shift);
 
+  if (d->lua_mask) {
+    lua_profile(L, d);
+  } else {
+    lua_pushnil(L);
+  }
+
   lua_unref(L, d->ref);
 
-  return 4;
+  return 5;
 }
 
 static const LUA_REG_TYPE perf_map[] = {
@@ -17,6 +17,7 @@
 #include "espconn.h"
 #include "lwip/err.h"
 #include "lwip/dns.h"
+#include "rtc/rtcaccess.h"
 
 #ifdef HAVE_SSL_SERVER_CRT
 #include HAVE_SSL_SERVER_CRT
@@ -28,6 +29,16 @@ __attribute__((section(".clientcert.flash"))) unsigned char tls_client_cert_area
 
 extern int tls_socket_create( lua_State *L );
 extern const LUA_REG_TYPE tls_cert_map[];
+extern const LUA_REG_TYPE tls_session_map[];
+
+extern int espconn_secure_session_cache(int count);
+extern uint16 espconn_secure_session_export(uint8 *buffer, uint16 length);
+extern sint8 espconn_secure_session_import(const uint8 *buffer, uint16 length);
+extern bool espconn_secure_set_buffers(uint8 level, uint16 receive, uint16 send);
+extern sint8 espconn_secure_get_buffers(struct espconn *espconn, uint16 *receive, uint16 *send);
+
+// Marks the sessions exported to RTC memory, the low 16 bits hold their length
+#define TLS_SESSION_RTC_MAGIC 0x544c0000
 
 typedef struct {
   struct espconn *pesp_conn;
@@ -363,6 +374,24 @@ static int tls_socket_getpeer( lua_State *L ) {
   }
   return 2;
 }
+static int tls_socket_getbuffers( lua_State *L ) {
+  tls_socket_ud *ud = (tls_socket_ud *)luaL_checkudata(L, 1, "tls.socket");
+  luaL_argcheck(L, ud, 1, "TLS socket expected");
+  if(ud==NULL){
+  	NODE_DBG("userdata is nil.\n");
+  	return 0;
+  }
+
+  uint16 receive, send;
+  if(ud->pesp_conn && espconn_secure_get_buffers(ud->pesp_conn, &receive, &send) == ESPCONN_OK){
+    lua_pushinteger( L, receive );
+    lua_pushinteger( L, send );
+  } else {
+    lua_pushnil( L );
+    lua_pushnil( L );
+  }
+  return 2;
+}
 static int tls_socket_close( lua_State *L ) {
   tls_socket_ud *ud = (tls_socket_ud *)luaL_checkudata(L, 1, "tls.socket");
   luaL_argcheck(L, ud, 1, "TLS socket expected");
@@ -611,6 +640,96 @@ static int tls_cert_verify(lua_State *L)
   return 1;
 }
 
+// Lua: tls.session.cache([count])
+static int tls_session_cache(lua_State *L)
+{
+  int count = -1;
+  if (!lua_isnoneornil(L, 1)) {
+    count = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, count >= 0, 1, "must not be negative");
+  }
+  lua_pushinteger(L, espconn_secure_session_cache(count));
+  return 1;
+}
+
+// Lua: tls.session.export([rtc_slot])
+static int tls_session_export(lua_State *L)
+{
+  int to_rtc = !lua_isnoneornil(L, 1);
+  int slot = to_rtc ? luaL_checkinteger(L, 1) : 0;
+  uint16 len = espconn_secure_session_export(NULL, 0);
+  int words = 1 + (len + 3) / 4;
+  if (to_rtc && (slot < 0 || slot + words > RTC_USER_MEM_NUM_DWORDS)) {
+    return luaL_error(L, "RTC mem would overrun");
+  }
+
+  // A userdata, so that nothing leaks if a Lua call below raises an error
+  uint8 *buffer = (uint8 *)lua_newuserdata(L, len);
+  espconn_secure_session_export(buffer, len);
+
+  if (!to_rtc) {
+    lua_pushlstring(L, (const char *)buffer, len);
+  } else {
+    rtc_mem_write(slot++, TLS_SESSION_RTC_MAGIC | len);
+    for (int i = 0; i < len; i += 4) {
+      uint32 word = 0;
+      for (int j = 0; j < 4 && i + j < len; j++) {
+        word |= (uint32)buffer[i + j] << (8 * j);
+      }
+      rtc_mem_write(slot++, word);
+    }
+    lua_pushinteger(L, words);
+  }
+  return 1;
+}
+
+// Lua: tls.session.import(data | rtc_slot)
+static int tls_session_import(lua_State *L)
+{
+  sint8 count;
+
+  if (lua_type(L, 1) == LUA_TNUMBER) {
+    int slot = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, slot >= 0 && slot < RTC_USER_MEM_NUM_DWORDS, 1, "invalid slot");
+    uint32 head = rtc_mem_read(slot++);
+    uint16 len = head & 0xffff;
+    if ((head & 0xffff0000) != TLS_SESSION_RTC_MAGIC || slot + (len + 3) / 4 > RTC_USER_MEM_NUM_DWORDS) {
+      lua_pushinteger(L, 0);
+      return 1;
+    }
+    uint8 *buffer = luaM_malloc(L, len);
+    for (int i = 0; i < len; i += 4) {
+      uint32 word = rtc_mem_read(slot++);
+      for (int j = 0; j < 4 && i + j < len; j++) {
+        buffer[i + j] = word >> (8 * j);
+      }
+    }
+    count = espconn_secure_session_import(buffer, len);
+    luaM_freemem(L, buffer, len);
+  } else {
+    size_t len;
+    const char *data = luaL_checklstring(L, 1, &len);
+    count = espconn_secure_session_import((const uint8 *)data, len);
+  }
+
+  lua_pushinteger(L, count < 0 ? 0 : count);
+  return 1;
+}
+
+// Lua: tls.setbuffers([receive[, send]])
+static int tls_set_buffers(lua_State *L)
+{
+  int receive = luaL_optinteger(L, 1, 0);
+  int send = luaL_optinteger(L, 2, 0);
+
+  luaL_argcheck(L, receive == 0 || receive == 512 || receive == 1024 ||
+                   receive == 2048 || receive == 4096, 1, "must be 512, 1024, 2048 or 4096");
+  luaL_argcheck(L, send == 0 || (send >= 512 && send <= 4096), 2, "must be between 512 and 4096");
+
+  espconn_secure_set_buffers(ESPCONN_CLIENT, receive, send);
+  return 0;
+}
+
 static const LUA_REG_TYPE tls_socket_map[] = {
   { LSTRKEY( "connect" ), LFUNCVAL( tls_socket_connect ) },
   { LSTRKEY( "close" ),   LFUNCVAL( tls_socket_close ) },
@@ -620,6 +739,7 @@ static const LUA_REG_TYPE tls_socket_map[] = {
   { LSTRKEY( "unhold" ),  LFUNCVAL( tls_socket_unhold ) },
   { LSTRKEY( "dns" ),     LFUNCVAL( tls_socket_dns ) },
   { LSTRKEY( "getpeer" ), LFUNCVAL( tls_socket_getpeer ) },
+  { LSTRKEY( "getbuffers" ), LFUNCVAL( tls_socket_getbuffers ) },
   { LSTRKEY( "__gc" ),    LFUNCVAL( tls_socket_delete ) },
   { LSTRKEY( "__index" ), LROVAL( tls_socket_map ) },
   { LNILKEY, LNILVAL }
@@ -632,9 +752,19 @@ const LUA_REG_TYPE tls_cert_map[] = {
   { LNILKEY, LNILVAL }
 };
 
+const LUA_REG_TYPE tls_session_map[] = {
+  { LSTRKEY( "cache" ),            LFUNCVAL( tls_session_cache ) },
+  { LSTRKEY( "export" ),           LFUNCVAL( tls_session_export ) },
+  { LSTRKEY( "import" ),           LFUNCVAL( tls_session_import ) },
+  { LSTRKEY( "__index" ),          LROVAL( tls_session_map ) },
+  { LNILKEY, LNILVAL }
+};
+
 static const LUA_REG_TYPE tls_map[] = {
   { LSTRKEY( "createConnection" ), LFUNCVAL( tls_socket_create ) },
   { LSTRKEY( "cert" ),             LROVAL( tls_cert_map ) },
+  { LSTRKEY( "session" ),          LROVAL( tls_session_map ) },
+  { LSTRKEY( "setbuffers" ),       LFUNCVAL( tls_set_buffers ) },
   { LSTRKEY( "__metatable" ),      LROVAL( tls_map ) },
   { LNILKEY, LNILVAL }
 };
@@ -80,3 +80,148 @@ int msg_size(msg_queue_t **head){
   }
   return i;
 }
+
+int msg_ring_init(msg_ring_t *ring, uint16_t size, uint16_t depth, uint8_t policy){
+  uint8_t *buf = NULL;
+  if(depth > 0){
+    buf = (uint8_t *)c_malloc(size);
+    if(!buf){
+      NODE_DBG("not enough memory\n");
+      return 0;
+    }
+  }
+  msg_ring_free(ring);
+  ring->buf = buf;
+  ring->size = buf ? size : 0;
+  ring->depth = depth;
+  ring->policy = policy;
+  ring->dropped = 0;
+  msg_ring_clear(ring);
+  return 1;
+}
+
+void msg_ring_free(msg_ring_t *ring){
+  if(ring->buf){
+    c_free(ring->buf);
+    ring->buf = NULL;
+  }
+  ring->size = 0;
+  msg_ring_clear(ring);
+}
+
+void msg_ring_clear(msg_ring_t *ring){
+  ring->head = ring->tail = 0;
+  ring->wrap = ring->size;
+  ring->sending = 0;
+  ring->count = 0;
+  ring->in_flight = 0;
+}
+
+// the data runs head..wrap and then 0..tail once tail has gone round
+static int msg_ring_wrapped(msg_ring_t *ring){
+  return ring->count > 0 && ring->tail <= ring->head;
+}
+
+static void msg_ring_settle(msg_ring_t *ring){
+  if(ring->count == 0){
+    msg_ring_clear(ring);
+  } else if(msg_ring_wrapped(ring) && ring->head == ring->wrap){
+    ring->head = 0;
+    ring->wrap = ring->size;
+  }
+}
+
+// drop the oldest message not handed to the network yet, the ones after
+// it move down so that the bytes being sent stay where they are
+static int msg_ring_drop(msg_ring_t *ring){
+  if(ring->count == ring->in_flight){
+    return 0;
+  }
+  uint16_t pos = ring->head + ring->sending;
+  uint16_t *end = msg_ring_wrapped(ring) ? &ring->wrap : &ring->tail;
+  if(pos >= *end){
+    pos = 0;
+    end = &ring->tail;
+  }
+  uint16_t length = mqtt_get_total_length(ring->buf + pos, *end - pos);
+  os_memmove(ring->buf + pos, ring->buf + pos + length, *end - pos - length);
+  *end -= length;
+  ring->count--;
+  ring->dropped++;
+  msg_ring_settle(ring);
+  return 1;
+}
+
+uint8_t * msg_ring_reserve(msg_ring_t *ring, uint16_t length){
+  if(!ring->buf || length > ring->size){
+    ring->dropped++;
+    return NULL;
+  }
+  for(;;){
+    if(ring->count < ring->depth){
+      if(!msg_ring_wrapped(ring)){
+        if(ring->size - ring->tail >= length){
+          return ring->buf + ring->tail;
+        }
+        if(ring->count > 0 && ring->head >= length){
+          ring->wrap = ring->tail;
+          ring->tail = 0;
+          return ring->buf;
+        }
+      } else if(ring->head - ring->tail >= length){
+        return ring->buf + ring->tail;
+      }
+    }
+    if(ring->policy != MSG_RING_DROP_OLDEST || !msg_ring_drop(ring)){
+      NODE_DBG("batch full, message dropped\n");
+      ring->dropped++;
+      return NULL;
+    }
+  }
+}
+
+// msg was built in the space from msg_ring_reserve(), its fixed header
+// may have left a byte free in front
+void msg_ring_commit(msg_ring_t *ring, mqtt_message_t *msg){
+  if(msg->data != ring->buf + ring->tail){
+    os_memmove(ring->buf + ring->tail, msg->data, msg->length);
+  }
+  ring->tail += msg->length;
+  ring->count++;
+}
+
+// whole messages from head, at most max bytes unless the first one is larger
+uint8_t * msg_ring_flush(msg_ring_t *ring, uint16_t max, uint16_t *length){
+  if(ring->sending || ring->count == 0){
+    return NULL;
+  }
+  uint16_t end = msg_ring_wrapped(ring) ? ring->wrap : ring->tail;
+  uint16_t len = 0;
+  while(ring->head + len < end){
+    uint8_t *msg = ring->buf + ring->head + len;
+    uint16_t msg_len = mqtt_get_total_length(msg, end - ring->head - len);
+    if(ring->in_flight > 0 && len + msg_len > max){
+      break;
+    }
+    len += msg_len;
+    ring->in_flight++;
+  }
+  ring->sending = len;
+  *length = len;
+  return ring->buf + ring->head;
+}
+
+// release the bytes being sent, returns how many messages they held
+uint16_t msg_ring_sent(msg_ring_t *ring){
+  uint16_t sent = ring->in_flight;
+  ring->head += ring->sending;
+  ring->count -= sent;
+  ring->sending = 0;
+  ring->in_flight = 0;
+  msg_ring_settle(ring);
+  return sent;
+}
+
+int msg_ring_pending(msg_ring_t *ring){
+  return ring->count - ring->in_flight;
+}
@@ -21,6 +21,34 @@ msg_queue_t * msg_dequeue(msg_queue_t **head);
 msg_queue_t * msg_peek(msg_queue_t **head);
 int msg_size(msg_queue_t **head);
 
+#define MSG_RING_DROP_NEWEST 0
+#define MSG_RING_DROP_OLDEST 1
+
+// QoS0 publishes are built in place in one buffer and sent in batches.
+// Messages are kept whole and in order, the ones being sent are at head.
+typedef struct msg_ring_t {
+  uint8_t *buf;
+  uint16_t size;
+  uint16_t head;      // oldest message
+  uint16_t tail;      // where the next message goes
+  uint16_t wrap;      // end of the data before tail went back to 0
+  uint16_t sending;   // bytes from head handed to the network
+  uint16_t count;     // messages held, the ones being sent included
+  uint16_t in_flight; // messages in the bytes being sent
+  uint16_t depth;     // most messages held
+  uint8_t policy;
+  uint32_t dropped;
+} msg_ring_t;
+
+int msg_ring_init(msg_ring_t *ring, uint16_t size, uint16_t depth, uint8_t policy);
+void msg_ring_free(msg_ring_t *ring);
+void msg_ring_clear(msg_ring_t *ring);
+uint8_t * msg_ring_reserve(msg_ring_t *ring, uint16_t length);
+void msg_ring_commit(msg_ring_t *ring, mqtt_message_t *msg);
+uint8_t * msg_ring_flush(msg_ring_t *ring, uint16_t max, uint16_t *length);
+uint16_t msg_ring_sent(msg_ring_t *ring);
+int msg_ring_pending(msg_ring_t *ring);
+
 #ifdef __cplusplus
 }
 #endif
@@ -917,6 +917,41 @@ uint32_t platform_flash_mapped2phys (uint32_t mapped_addr)
   return mapped_addr - INTERNAL_FLASH_MAPPED_ADDRESS + meg * 0x100000;
 }
 
+uint32_t platform_flash_phys2mapped (uint32_t phys_addr)
+{
+  uint32_t cache_ctrl = READ_PERI_REG(CACHE_FLASH_CTRL_REG);
+  if (!(cache_ctrl & CACHE_FLASH_ACTIVE))
+    return -1;
+  bool b0 = (cache_ctrl & CACHE_FLASH_MAPPED0) ? 1 : 0;
+  bool b1 = (cache_ctrl & CACHE_FLASH_MAPPED1) ? 1 : 0;
+  uint32_t meg = (b1 << 1) | b0;
+  if (phys_addr < meg * 0x100000 || phys_addr >= (meg + 1) * 0x100000)
+    return -1;
+  return phys_addr - meg * 0x100000 + INTERNAL_FLASH_MAPPED_ADDRESS;
+}
+
+void platform_flash_mapped_copy (void *to, const void *from, uint32_t size)
+{
+  uint8_t *dst = (uint8_t *)to;
+  uint32_t addr = (uint32_t)from;
+  uint32_t word = 0;
+  if (size && (addr & 3))
+    word = *(const uint32_t *)(addr & ~3);
+  for (; size && (addr & 3); size--, addr++)
+    *dst++ = (uint8_t)(word >> (8 * (addr & 3)));
+  for (; size >= 4; size -= 4, addr += 4, dst += 4) {
+    word = *(const uint32_t *)addr;
+    dst[0] = (uint8_t)word;
+    dst[1] = (uint8_t)(word >> 8);
+    dst[2] = (uint8_t)(word >> 16);
+    dst[3] = (uint8_t)(word >> 24);
+  }
+  if (size)
+    word = *(const uint32_t *)addr;
+  for (; size; size--, addr++)
+    *dst++ = (uint8_t)(word >> (8 * (addr & 3)));
+}
+
 void* platform_print_deprecation_note( const char *msg, const char *time_frame)
 {
   c_printf( "Warning, deprecated API! %s. It will be removed %s. See documentation for details.\n", msg, time_frame );
@@ -287,6 +287,26 @@ int platform_flash_erase_sector( uint32_t sector_id );
  */
 uint32_t platform_flash_mapped2phys (uint32_t mapped_addr);
 
+/**
+ * Translate a physical flash address to the address at which it can be read
+ * through the flash cache, based on the current flash cache mapping.
+ * @param phys_addr Physical flash address to translate
+ * @return the corresponding mapped address, or -1 if flash cache is not
+ *  currently active or the address is outside the mapped megabyte.
+ * @see platform_flash_mapped2phys.
+ */
+uint32_t platform_flash_phys2mapped (uint32_t phys_addr);
+
+/**
+ * Copy from memory mapped flash to RAM. Mapped flash only allows aligned
+ * 32 bit loads, so unlike memcpy this does not depend on the load exception
+ * handler for an unaligned source or length.
+ * @param to Destination in RAM
+ * @param from Source address (>= INTERNAL_FLASH_MAPPED_ADDRESS)
+ * @param size Number of bytes to copy
+ */
+void platform_flash_mapped_copy (void *to, const void *from, uint32_t size);
+
 // *****************************************************************************
 // Allocator support
 
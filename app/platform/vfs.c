@@ -280,6 +280,63 @@ sint32_t vfs_fscfg( const char *name, uint32_t *phys_addr, uint32_t *phys_size)
   return VFS_RES_ERR;
 }
 
+sint32_t vfs_fsgc( const char *name, sint32_t *reserve, sint32_t *idle, uint32_t *free_blocks )
+{
+  vfs_fs_fns *fs_fns;
+  char *outname;
+
+#ifdef BUILD_SPIFFS
+  if (fs_fns = myspiffs_realm( "/FLASH", &outname, FALSE )) {
+    return fs_fns->fsgc( reserve, idle, free_blocks );
+  }
+#endif
+
+#ifdef BUILD_FATFS
+  // not supported
+#endif
+
+  // Error
+  return VFS_RES_ERR;
+}
+
+sint32_t vfs_fscache( const char *name, sint32_t *pages )
+{
+  vfs_fs_fns *fs_fns;
+  char *outname;
+
+#ifdef BUILD_SPIFFS
+  if (fs_fns = myspiffs_realm( "/FLASH", &outname, FALSE )) {
+    return fs_fns->fscache( pages );
+  }
+#endif
+
+#ifdef BUILD_FATFS
+  // not supported
+#endif
+
+  // Error
+  return VFS_RES_ERR;
+}
+
+sint32_t vfs_fsstats( const char *name, struct vfs_fsstats *stats )
+{
+  vfs_fs_fns *fs_fns;
+  char *outname;
+
+#ifdef BUILD_SPIFFS
+  if (fs_fns = myspiffs_realm( "/FLASH", &outname, FALSE )) {
+    return fs_fns->fsstats( stats );
+  }
+#endif
+
+#ifdef BUILD_FATFS
+  // not supported
+#endif
+
+  // Error
+  return VFS_RES_ERR;
+}
+
 sint32_t vfs_format( void )
 {
   vfs_fs_fns *fs_fns;
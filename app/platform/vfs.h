@@ -88,6 +88,37 @@ inline uint32_t vfs_size( int fd ) {
   return f ? f->fns->size( f ) : 0;
 }
 
+// vfs_map - read data in place from memory mapped flash
+//   fd: file descriptor
+//   len: maximum length on entry, length of the returned data on exit
+//   Returns: Address of the data at the current position, which is moved
+//            past it, or NULL if the file system or the location of the data
+//            does not allow this; use vfs_read then. Mapped flash only allows
+//            aligned 32 bit loads, see platform_flash_mapped_copy().
+inline const char *vfs_map( int fd, uint32_t *len ) {
+  vfs_file *f = (vfs_file *)fd;
+  return f && f->fns->map ? f->fns->map( f, len ) : NULL;
+}
+
+// vfs_ixmap - keep the location of the file data in memory for fast seeks
+//   fd: file descriptor
+//   len: bytes of file data to cover around the current position, the
+//        file system may cover less; 0 drops the map
+//   Returns: VFS_RES_OK, or VFS_RES_ERR if the file system has no such map
+inline sint32_t vfs_ixmap( int fd, uint32_t len ) {
+  vfs_file *f = (vfs_file *)fd;
+  return f && f->fns->ixmap ? f->fns->ixmap( f, len ) : VFS_RES_ERR;
+}
+
+// vfs_pagesize - get the unit in which the file system stores file data
+//   fd: file descriptor
+//   Returns: Bytes of file data per page or sector, writes that end on
+//            a multiple of it leave no partial page to rewrite; 0 if unknown
+inline uint32_t vfs_pagesize( int fd ) {
+  vfs_file *f = (vfs_file *)fd;
+  return f && f->fns->pagesize ? f->fns->pagesize( f ) : 0;
+}
+
 // vfs_ferrno - get file system specific errno
 //   fd: file descriptor
 //   Returns: errno
@@ -181,6 +212,26 @@ sint32_t  vfs_chdir( const char *path );
 //   Returns: VFS_RES_OK, or VFS_RES_ERR in case of error
 sint32_t vfs_fscfg( const char *name, uint32_t *phys_addr, uint32_t *phys_size);
 
+// vfs_fsgc - configure idle time garbage collection of file system
+//   reserve: number of free blocks to keep erased, 0 disables, -1 leaves it;
+//            receives the current setting
+//   idle: idle period in ms before collecting, -1 leaves it; receives the
+//         current setting
+//   free_blocks: receives the number of free blocks
+//   Returns: VFS_RES_OK, or VFS_RES_ERR in case of error
+sint32_t vfs_fsgc( const char *name, sint32_t *reserve, sint32_t *idle, uint32_t *free_blocks );
+
+// vfs_fscache - set the number of cache pages of file system, remounting it
+//   pages: new number of pages, -1 leaves it; receives the current number,
+//          which is unchanged while files are open
+//   Returns: VFS_RES_OK, or VFS_RES_ERR in case of error
+sint32_t vfs_fscache( const char *name, sint32_t *pages );
+
+// vfs_fsstats - get cache and garbage collection statistics of file system
+//   stats: receives the counts since the file system was mounted
+//   Returns: VFS_RES_OK, or VFS_RES_ERR in case of error
+sint32_t vfs_fsstats( const char *name, struct vfs_fsstats *stats );
+
 // vfs_errno - get file system specific errno
 //   name: logical drive identifier
 //   Returns: errno
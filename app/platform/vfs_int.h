@@ -60,6 +60,15 @@ struct vfs_stat {
   uint8_t is_arch;
 };
 
+// file system statistics since mount
+struct vfs_fsstats {
+  uint32_t cache_pages;
+  uint32_t cache_hits;
+  uint32_t cache_misses;
+  uint32_t gc_runs;
+  uint32_t erases;
+};
+
 // file descriptor functions
 struct vfs_file_fns {
   sint32_t (*close)( const struct vfs_file *fd );
@@ -71,6 +80,9 @@ struct vfs_file_fns {
   sint32_t (*flush)( const struct vfs_file *fd );
   uint32_t (*size)( const struct vfs_file *fd );
   sint32_t (*ferrno)( const struct vfs_file *fd );
+  const char *(*map)( const struct vfs_file *fd, uint32_t *len );
+  sint32_t (*ixmap)( const struct vfs_file *fd, uint32_t len );
+  uint32_t (*pagesize)( const struct vfs_file *fd );
 };
 typedef const struct vfs_file_fns vfs_file_fns;
 
@@ -111,6 +123,9 @@ struct vfs_fs_fns {
   sint32_t  (*mkdir)( const char *name );
   sint32_t  (*fsinfo)( uint32_t *total, uint32_t *used );
   sint32_t  (*fscfg)( uint32_t *phys_addr, uint32_t *phys_size );
+  sint32_t  (*fsgc)( sint32_t *reserve, sint32_t *idle, uint32_t *free_blocks );
+  sint32_t  (*fscache)( sint32_t *pages );
+  sint32_t  (*fsstats)( struct vfs_fsstats *stats );
   sint32_t  (*format)( void );
   sint32_t  (*chdrive)( const char * );
   sint32_t  (*chdir)( const char * );
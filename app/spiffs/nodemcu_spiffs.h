@@ -9,9 +9,9 @@
 typedef uint32_t intptr_t;
 #endif
 
-// Turn off stats
-#define SPIFFS_CACHE_STATS 	    0
-#define SPIFFS_GC_STATS             0
+// Count cache hits and misses and garbage collection runs for file.fsinfo()
+#define SPIFFS_CACHE_STATS 	    1
+#define SPIFFS_GC_STATS             1
 
 // Needs to align stuff
 #define SPIFFS_ALIGNED_OBJECT_INDEX_TABLES	1
@@ -23,4 +23,7 @@ typedef uint32_t intptr_t;
 // Reduce the chance of returning disk full
 #define SPIFFS_GC_MAX_RUNS          256
 
+// Allow open files to keep their object index in RAM, see SPIFFS_IX_MAP_BUDGET
+#define SPIFFS_IX_MAP               1
+
 #endif
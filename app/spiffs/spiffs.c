@@ -3,6 +3,7 @@
 #include "spiffs.h"
 
 #include "spiffs_nucleus.h"
+#include "task/task.h"
 
 spiffs fs;
 
@@ -14,8 +15,20 @@ spiffs fs;
 static u8_t spiffs_work_buf[LOG_PAGE_SIZE*2];
 static u8_t spiffs_fds[sizeof(spiffs_fd) * SPIFFS_MAX_OPEN_FILES];
 #if SPIFFS_CACHE
-static u8_t myspiffs_cache[(LOG_PAGE_SIZE+32)*2];
+#ifndef SPIFFS_CACHE_PAGES
+#define SPIFFS_CACHE_PAGES 2
 #endif
+// the cache keeps at most 32 pages, the width of its usage map
+#define MAX_CACHE_PAGES 32
+#define CACHE_BYTES(pages) \
+  (sizeof(spiffs_cache) + (pages) * (sizeof(spiffs_cache_page) + LOG_PAGE_SIZE) + sizeof(void *))
+static u8_t myspiffs_cache_buf[CACHE_BYTES(SPIFFS_CACHE_PAGES)];
+// a cache of another size set by file.fscfg() is allocated on the heap
+static u8_t *myspiffs_cache = myspiffs_cache_buf;
+static u32_t myspiffs_cache_pages = SPIFFS_CACHE_PAGES;
+#endif
+// flash sectors erased since the file system was mounted
+static u32_t myspiffs_erases;
 
 static s32_t my_spiffs_read(u32_t addr, u32_t size, u8_t *dst) {
   platform_flash_read(dst, addr, size);
@@ -33,6 +46,7 @@ static s32_t my_spiffs_erase(u32_t addr, u32_t size) {
   while( sect_first <= sect_last )
     if( platform_flash_erase_sector( sect_first ++ ) == PLATFORM_ERR )
       return SPIFFS_ERR_INTERNAL;
+  myspiffs_erases++;
   return SPIFFS_OK;
 } 
 
@@ -164,6 +178,52 @@ static bool myspiffs_find_cfg(spiffs_config *cfg, bool force_create) {
   return FALSE;
 }
 
+// ***************************************************************************
+// idle time garbage collection
+// ***************************************************************************
+
+#ifndef SPIFFS_GC_RESERVE
+#define SPIFFS_GC_RESERVE 0
+#endif
+#ifndef SPIFFS_GC_IDLE_MS
+#define SPIFFS_GC_IDLE_MS 200
+#endif
+#define SPIFFS_GC_IDLE_MAX 6870947  // os_timer limit (0x68D7A3)
+
+static uint32_t gc_reserve = SPIFFS_GC_RESERVE;
+static uint32_t gc_idle = SPIFFS_GC_IDLE_MS;
+static os_timer_t gc_timer;
+static task_handle_t gc_task;
+
+// One step erases at most one block; the next waits for another idle period
+// so that a burst of file system use always goes first.
+static void myspiffs_gc_step( task_param_t param, uint8 prio ) {
+  s32_t err = fs.err_code;
+
+  if (!SPIFFS_mounted( &fs ) || fs.free_blocks >= gc_reserve)
+    return;
+  if (SPIFFS_gc_step( &fs ) == SPIFFS_OK && fs.free_blocks < gc_reserve)
+    os_timer_arm( &gc_timer, gc_idle, 0 );
+  // nothing left to collect is not the application's error
+  fs.err_code = err;
+}
+
+static void myspiffs_gc_timeout( void *arg ) {
+  task_post_low( gc_task, 0 );
+}
+
+// Called on every file system access, (re)starting the idle period.
+static void myspiffs_gc_touch( void ) {
+  if (!gc_reserve)
+    return;
+  if (!gc_task) {
+    gc_task = task_get_id( myspiffs_gc_step );
+    os_timer_setfn( &gc_timer, (os_timer_func_t *)myspiffs_gc_timeout, NULL );
+  }
+  os_timer_disarm( &gc_timer );
+  os_timer_arm( &gc_timer, gc_idle, 0 );
+}
+
 static bool myspiffs_mount_internal(bool force_mount) {
   spiffs_config cfg;
   if (!myspiffs_find_cfg(&cfg, force_mount) && !force_mount) {
@@ -171,6 +231,7 @@ static bool myspiffs_mount_internal(bool force_mount) {
   }
 
   fs.err_code = 0;
+  myspiffs_erases = 0;
 
   int res = SPIFFS_mount(&fs,
     &cfg,
@@ -179,13 +240,15 @@ static bool myspiffs_mount_internal(bool force_mount) {
     sizeof(spiffs_fds),
 #if SPIFFS_CACHE
     myspiffs_cache,
-    sizeof(myspiffs_cache),
+    CACHE_BYTES(myspiffs_cache_pages),
 #else
     0, 0,
 #endif
     // myspiffs_check_callback);
     0);
   NODE_DBG("mount res: %d, %d\n", res, fs.err_code);
+  if (res == SPIFFS_OK)
+    myspiffs_gc_touch();
   return res == SPIFFS_OK;
 }
 
@@ -197,6 +260,7 @@ void myspiffs_unmount() {
   SPIFFS_unmount(&fs);
 }
 
+
 // FS formatting function
 // Returns 1 if OK, 0 for error
 int myspiffs_format( void )
@@ -242,6 +306,10 @@ void test_spiffs() {
 
 #define MY_LDRV_ID "FLASH"
 
+#ifndef SPIFFS_IX_MAP_BUDGET
+#define SPIFFS_IX_MAP_BUDGET 0
+#endif
+
 // default current drive
 static int is_current_drive = TRUE;
 
@@ -255,6 +323,9 @@ static sint32_t myspiffs_vfs_tell( const struct vfs_file *fd );
 static sint32_t myspiffs_vfs_flush( const struct vfs_file *fd );
 static uint32_t myspiffs_vfs_size( const struct vfs_file *fd );
 static sint32_t myspiffs_vfs_ferrno( const struct vfs_file *fd );
+static const char *myspiffs_vfs_map( const struct vfs_file *fd, uint32_t *len );
+static sint32_t myspiffs_vfs_ixmap( const struct vfs_file *fd, uint32_t len );
+static uint32_t myspiffs_vfs_pagesize( const struct vfs_file *fd );
 
 static sint32_t  myspiffs_vfs_closedir( const struct vfs_dir *dd );
 static sint32_t  myspiffs_vfs_readdir( const struct vfs_dir *dd, struct vfs_stat *buf );
@@ -267,6 +338,9 @@ static sint32_t  myspiffs_vfs_remove( const char *name );
 static sint32_t  myspiffs_vfs_rename( const char *oldname, const char *newname );
 static sint32_t  myspiffs_vfs_fsinfo( uint32_t *total, uint32_t *used );
 static sint32_t  myspiffs_vfs_fscfg( uint32_t *phys_addr, uint32_t *phys_size );
+static sint32_t  myspiffs_vfs_fsgc( sint32_t *reserve, sint32_t *idle, uint32_t *free_blocks );
+static sint32_t  myspiffs_vfs_fscache( sint32_t *pages );
+static sint32_t  myspiffs_vfs_fsstats( struct vfs_fsstats *stats );
 static sint32_t  myspiffs_vfs_format( void );
 static sint32_t  myspiffs_vfs_errno( void );
 static void      myspiffs_vfs_clearerr( void );
@@ -286,6 +360,9 @@ static vfs_fs_fns myspiffs_fs_fns = {
   .mkdir    = NULL,
   .fsinfo   = myspiffs_vfs_fsinfo,
   .fscfg    = myspiffs_vfs_fscfg,
+  .fsgc     = myspiffs_vfs_fsgc,
+  .fscache  = myspiffs_vfs_fscache,
+  .fsstats  = myspiffs_vfs_fsstats,
   .format   = myspiffs_vfs_format,
   .chdrive  = NULL,
   .chdir    = NULL,
@@ -302,7 +379,10 @@ static vfs_file_fns myspiffs_file_fns = {
   .tell      = myspiffs_vfs_tell,
   .flush     = myspiffs_vfs_flush,
   .size      = myspiffs_vfs_size,
-  .ferrno    = myspiffs_vfs_ferrno
+  .ferrno    = myspiffs_vfs_ferrno,
+  .map       = myspiffs_vfs_map,
+  .ixmap     = myspiffs_vfs_ixmap,
+  .pagesize  = myspiffs_vfs_pagesize
 };
 
 static vfs_dir_fns myspiffs_dd_fns = {
@@ -317,6 +397,9 @@ static vfs_dir_fns myspiffs_dd_fns = {
 struct myvfs_file {
   struct vfs_file vfs_file;
   spiffs_file fh;
+#if SPIFFS_IX_MAP
+  spiffs_ix_map *ix_map;
+#endif
 };
 
 struct myvfs_dir {
@@ -377,11 +460,34 @@ static sint32_t myspiffs_vfs_readdir( const struct vfs_dir *dd, struct vfs_stat
   const struct myvfs_file *myfd = (const struct myvfs_file *)descr; \
   spiffs_file fh = myfd->fh;
 
+#if SPIFFS_IX_MAP
+// Move the index map to the page of the current position once that has
+// left it; SPIFFS_read looks up pages outside the map on the medium.
+static void myspiffs_ix_follow( const struct myvfs_file *myfd ) {
+  spiffs_ix_map *map = myfd->ix_map;
+  s32_t pos;
+  spiffs_span_ix spix;
+
+  if (map && (pos = SPIFFS_tell( &fs, myfd->fh )) >= 0) {
+    spix = pos / SPIFFS_DATA_PAGE_SIZE(&fs);
+    if (spix < map->start_spix || spix > map->end_spix)
+      SPIFFS_ix_remap( &fs, myfd->fh, pos - pos % SPIFFS_DATA_PAGE_SIZE(&fs) );
+  }
+}
+#endif
+
 static sint32_t myspiffs_vfs_close( const struct vfs_file *fd ) {
   GET_FILE_FH(fd);
 
+  myspiffs_gc_touch();
   sint32_t res = SPIFFS_close( &fs, fh );
 
+#if SPIFFS_IX_MAP
+  // closing unmapped the file
+  if (myfd->ix_map)
+    c_free( myfd->ix_map );
+#endif
+
   // free descriptor memory
   c_free( (void *)fd );
 
@@ -391,6 +497,10 @@ static sint32_t myspiffs_vfs_close( const struct vfs_file *fd ) {
 static sint32_t myspiffs_vfs_read( const struct vfs_file *fd, void *ptr, size_t len ) {
   GET_FILE_FH(fd);
 
+  myspiffs_gc_touch();
+#if SPIFFS_IX_MAP
+  myspiffs_ix_follow( myfd );
+#endif
   sint32_t n = SPIFFS_read( &fs, fh, ptr, len );
 
   return n >= 0 ? n : VFS_RES_ERR;
@@ -399,6 +509,7 @@ static sint32_t myspiffs_vfs_read( const struct vfs_file *fd, void *ptr, size_t
 static sint32_t myspiffs_vfs_write( const struct vfs_file *fd, const void *ptr, size_t len ) {
   GET_FILE_FH(fd);
 
+  myspiffs_gc_touch();
   sint32_t n = SPIFFS_write( &fs, fh, (void *)ptr, len );
 
   return n >= 0 ? n : VFS_RES_ERR;
@@ -422,6 +533,9 @@ static sint32_t myspiffs_vfs_lseek( const struct vfs_file *fd, sint32_t off, int
   }
 
   sint32_t res = SPIFFS_lseek( &fs, fh, off, spiffs_whence );
+#if SPIFFS_IX_MAP
+  myspiffs_ix_follow( myfd );
+#endif
   return res >= 0 ? res : VFS_RES_ERR;
 }
 
@@ -457,6 +571,114 @@ static sint32_t myspiffs_vfs_ferrno( const struct vfs_file *fd ) {
   return SPIFFS_errno( &fs );
 }
 
+// Locate the data at the current position in the data page that holds it,
+// using the object index as SPIFFS_read does, and return its address in
+// the memory mapped flash. The index and page header are read in place too,
+// which saves the page reads that SPIFFS_read repeats on every call.
+static const char *myspiffs_vfs_map( const struct vfs_file *fd, uint32_t *len ) {
+  GET_FILE_FH(fd);
+  spiffs_fd *sfd;
+  spiffs_span_ix data_spix, objix_spix;
+  spiffs_page_ix objix_pix, data_pix;
+  spiffs_page_header ph;
+  u32_t entry, offs, n, page;
+
+  if (SPIFFS_fflush( &fs, fh ) < SPIFFS_OK ||
+      spiffs_fd_get( &fs, fh, &sfd ) != SPIFFS_OK ||
+      sfd->size == SPIFFS_UNDEFINED_LEN || sfd->fdoffset >= sfd->size)
+    return NULL;
+
+  data_spix = sfd->fdoffset / SPIFFS_DATA_PAGE_SIZE(&fs);
+  objix_spix = SPIFFS_OBJ_IX_ENTRY_SPAN_IX(&fs, data_spix);
+  if (objix_spix == 0) {
+    objix_pix = sfd->objix_hdr_pix;
+    entry = sizeof(spiffs_page_object_ix_header);
+  } else {
+    if (sfd->cursor_objix_spix != objix_spix) {
+      if (spiffs_obj_lu_find_id_and_span( &fs, sfd->obj_id | SPIFFS_OBJ_ID_IX_FLAG,
+                                          objix_spix, 0, &objix_pix ) != SPIFFS_OK)
+        return NULL;
+      sfd->cursor_objix_pix = objix_pix;
+      sfd->cursor_objix_spix = objix_spix;
+    }
+    objix_pix = sfd->cursor_objix_pix;
+    entry = sizeof(spiffs_page_object_ix);
+  }
+  entry += SPIFFS_OBJ_IX_ENTRY(&fs, data_spix) * sizeof(spiffs_page_ix);
+  entry = platform_flash_phys2mapped( SPIFFS_PAGE_TO_PADDR(&fs, objix_pix) + entry );
+  if (entry == (u32_t)-1)
+    return NULL;
+  platform_flash_mapped_copy( &data_pix, (const void *)entry, sizeof(data_pix) );
+  if (data_pix == (spiffs_page_ix)-1 || data_pix >= SPIFFS_MAX_PAGES(&fs) ||
+      data_pix % SPIFFS_PAGES_PER_BLOCK(&fs) < SPIFFS_OBJ_LOOKUP_PAGES(&fs))
+    return NULL;
+
+  // check the page header as SPIFFS_read does (flag bits are active low)
+  page = platform_flash_phys2mapped( SPIFFS_PAGE_TO_PADDR(&fs, data_pix) );
+  if (page == (u32_t)-1)
+    return NULL;
+  platform_flash_mapped_copy( &ph, (const void *)page, sizeof(ph) );
+  if (ph.obj_id != (sfd->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) || ph.span_ix != data_spix ||
+      (ph.flags & (SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_DELET |
+                   SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_INDEX)) !=
+      (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_INDEX))
+    return NULL;
+
+  offs = sfd->fdoffset % SPIFFS_DATA_PAGE_SIZE(&fs);
+  n = SPIFFS_DATA_PAGE_SIZE(&fs) - offs;
+  if (n > sfd->size - sfd->fdoffset)
+    n = sfd->size - sfd->fdoffset;
+  if (n > *len)
+    n = *len;
+  sfd->fdoffset += n;
+  *len = n;
+  return (const char *)(page + sizeof(spiffs_page_header) + offs);
+}
+
+// Map the object index for len bytes of file data from the page of the
+// current position, within SPIFFS_IX_MAP_BUDGET. The map buffer follows the
+// map struct in one allocation; spiffs keeps it up to date as the file
+// changes and drops it when the file is closed.
+static sint32_t myspiffs_vfs_ixmap( const struct vfs_file *fd, uint32_t len ) {
+#if SPIFFS_IX_MAP
+  struct myvfs_file *myfd = (struct myvfs_file *)fd;
+  spiffs_ix_map *map = myfd->ix_map;
+  u32_t entries = 0;
+  s32_t pos;
+
+  if (map) {
+    SPIFFS_ix_unmap( &fs, myfd->fh );
+    c_free( map );
+    myfd->ix_map = NULL;
+  }
+  if (len == 0)
+    return VFS_RES_OK;
+
+  entries = SPIFFS_bytes_to_ix_map_entries( &fs, len );
+  if (entries > SPIFFS_IX_MAP_BUDGET / sizeof( spiffs_page_ix ))
+    entries = SPIFFS_IX_MAP_BUDGET / sizeof( spiffs_page_ix );
+  if (entries == 0 || (pos = SPIFFS_tell( &fs, myfd->fh )) < 0)
+    return VFS_RES_ERR;
+
+  if (!(map = (spiffs_ix_map *)c_malloc( sizeof( spiffs_ix_map ) + entries * sizeof( spiffs_page_ix ) )))
+    return VFS_RES_ERR;
+  if (SPIFFS_ix_map( &fs, myfd->fh, map, pos - pos % SPIFFS_DATA_PAGE_SIZE(&fs),
+                     (entries - 1) * SPIFFS_DATA_PAGE_SIZE(&fs), (spiffs_page_ix *)(map + 1) ) < SPIFFS_OK) {
+    SPIFFS_ix_unmap( &fs, myfd->fh );
+    c_free( map );
+    return VFS_RES_ERR;
+  }
+  myfd->ix_map = map;
+  return VFS_RES_OK;
+#else
+  return VFS_RES_ERR;
+#endif
+}
+
+static uint32_t myspiffs_vfs_pagesize( const struct vfs_file *fd ) {
+  return SPIFFS_DATA_PAGE_SIZE(&fs);
+}
+
 
 static int fs_mode2flag(const char *mode){
   if(c_strlen(mode)==1){
@@ -489,10 +711,23 @@ static vfs_file *myspiffs_vfs_open( const char *name, const char *mode ) {
   struct myvfs_file *fd;
   int flags = fs_mode2flag( mode );
 
+  myspiffs_gc_touch();
   if (fd = (struct myvfs_file *)c_malloc( sizeof( struct myvfs_file ) )) {
     if (0 < (fd->fh = SPIFFS_open( &fs, name, flags, 0 ))) {
       fd->vfs_file.fs_type = VFS_FS_SPIFFS;
       fd->vfs_file.fns     = &myspiffs_file_fns;
+#if SPIFFS_IX_MAP
+      fd->ix_map = NULL;
+      // seeking beyond what the index header covers searches the medium
+      // for index pages; map such files when the budget covers all of them,
+      // as moving a smaller map costs that same search
+      spiffs_stat stat;
+      if (flags == SPIFFS_RDONLY && SPIFFS_fstat( &fs, fd->fh, &stat ) >= SPIFFS_OK &&
+          stat.size != SPIFFS_UNDEFINED_LEN &&
+          stat.size > SPIFFS_OBJ_HDR_IX_LEN(&fs) * SPIFFS_DATA_PAGE_SIZE(&fs) &&
+          SPIFFS_bytes_to_ix_map_entries( &fs, stat.size ) <= SPIFFS_IX_MAP_BUDGET / sizeof( spiffs_page_ix ))
+        myspiffs_vfs_ixmap( (vfs_file *)fd, stat.size );
+#endif
       return (vfs_file *)fd;
     } else {
       c_free( fd );
@@ -536,10 +771,12 @@ static sint32_t myspiffs_vfs_stat( const char *name, struct vfs_stat *buf ) {
 }
 
 static sint32_t myspiffs_vfs_remove( const char *name ) {
+  myspiffs_gc_touch();
   return SPIFFS_remove( &fs, name );
 }
 
 static sint32_t myspiffs_vfs_rename( const char *oldname, const char *newname ) {
+  myspiffs_gc_touch();
   return SPIFFS_rename( &fs, oldname, newname );
 }
 
@@ -547,12 +784,85 @@ static sint32_t myspiffs_vfs_fsinfo( uint32_t *total, uint32_t *used ) {
   return SPIFFS_info( &fs, total, used );
 }
 
+#if SPIFFS_CACHE
+// Remount with a cache of the given number of pages. Unmounting closes all
+// files, so this is refused while any is open. Returns the pages in use.
+static u32_t myspiffs_set_cache( u32_t pages ) {
+  spiffs_fd *fds = (spiffs_fd *)fs.fd_space;
+  u8_t *cache = myspiffs_cache_buf;
+  u32_t i;
+
+  if (pages < 1)
+    pages = 1;
+  else if (pages > MAX_CACHE_PAGES)
+    pages = MAX_CACHE_PAGES;
+  if (pages == myspiffs_cache_pages || !SPIFFS_mounted( &fs ))
+    return myspiffs_cache_pages;
+  for (i = 0; i < fs.fd_count; i++)
+    if (fds[i].file_nbr != 0)
+      return myspiffs_cache_pages;
+
+  if (pages != SPIFFS_CACHE_PAGES && !(cache = (u8_t *)c_malloc( CACHE_BYTES(pages) )))
+    return myspiffs_cache_pages;
+  SPIFFS_unmount( &fs );
+  if (myspiffs_cache != myspiffs_cache_buf)
+    c_free( myspiffs_cache );
+  myspiffs_cache = cache;
+  myspiffs_cache_pages = pages;
+  myspiffs_mount();
+  return myspiffs_cache_pages;
+}
+#endif
+
 static sint32_t myspiffs_vfs_fscfg( uint32_t *phys_addr, uint32_t *phys_size ) {
   *phys_addr = fs.cfg.phys_addr;
   *phys_size = fs.cfg.phys_size;
   return VFS_RES_OK;
 }
 
+static sint32_t myspiffs_vfs_fsgc( sint32_t *reserve, sint32_t *idle, uint32_t *free_blocks ) {
+  if (*idle == 0 || *idle > SPIFFS_GC_IDLE_MAX)
+    return VFS_RES_ERR;
+  if (*idle > 0)
+    gc_idle = *idle;
+  if (*reserve >= 0) {
+    gc_reserve = *reserve;
+    if (gc_reserve)
+      myspiffs_gc_touch();
+    else
+      os_timer_disarm( &gc_timer );
+  }
+  *reserve = gc_reserve;
+  *idle = gc_idle;
+  *free_blocks = fs.free_blocks;
+  return VFS_RES_OK;
+}
+
+static sint32_t myspiffs_vfs_fscache( sint32_t *pages ) {
+#if SPIFFS_CACHE
+  *pages = *pages >= 0 ? myspiffs_set_cache( *pages ) : myspiffs_cache_pages;
+  return VFS_RES_OK;
+#else
+  return VFS_RES_ERR;
+#endif
+}
+
+static sint32_t myspiffs_vfs_fsstats( struct vfs_fsstats *stats ) {
+  c_memset( stats, 0, sizeof( struct vfs_fsstats ) );
+#if SPIFFS_CACHE
+  stats->cache_pages = myspiffs_cache_pages;
+#if SPIFFS_CACHE_STATS
+  stats->cache_hits = fs.cache_hits;
+  stats->cache_misses = fs.cache_misses;
+#endif
+#endif
+#if SPIFFS_GC_STATS
+  stats->gc_runs = fs.stats_gc_runs;
+#endif
+  stats->erases = myspiffs_erases;
+  return VFS_RES_OK;
+}
+
 static vfs_vol  *myspiffs_vfs_mount( const char *name, int num ) {
   // volume descriptor not supported, just return TRUE / FALSE
   return myspiffs_mount() ? (vfs_vol *)1 : NULL;
@@ -671,6 +671,23 @@ s32_t SPIFFS_gc_quick(spiffs *fs, u16_t max_free_pages);
  */
 s32_t SPIFFS_gc(spiffs *fs, u32_t size);
 
+/**
+ * Runs one bounded step of garbage collection: erases a block where all
+ * pages are deleted, or failing that moves the used pages out of the best
+ * candidate block and erases it. At most one block is erased per call, so
+ * this can be spread over idle time to keep free blocks at hand for writes.
+ *
+ * Only blocks with more deleted than used pages are cleaned, and no block
+ * once the free blocks are as many as the used pages leave room for.
+ *
+ * Will set err_no to SPIFFS_OK if a block was erased and free space was
+ * gained, SPIFFS_ERR_NO_DELETED_BLOCKS if there is nothing worth collecting,
+ * or other error.
+ *
+ * @param fs            the file system struct
+ */
+s32_t SPIFFS_gc_step(spiffs *fs);
+
 /**
  * Check if EOF reached.
  * @param fs            the file system struct
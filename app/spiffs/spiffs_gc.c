@@ -104,6 +104,40 @@ s32_t spiffs_gc_quick(
   return res;
 }
 
+// Finds the best candidate block, moves its used pages elsewhere and erases
+// it. Returns SPIFFS_ERR_NO_DELETED_BLOCKS if no block has deleted pages,
+// or with gainful set, none has more deleted pages than used ones.
+s32_t spiffs_gc_clean_candidate(
+    spiffs *fs,
+    char fs_crammed,
+    char gainful) {
+  s32_t res;
+  spiffs_block_ix *cands;
+  int count;
+  spiffs_block_ix cand;
+
+  res = spiffs_gc_find_candidate(fs, &cands, &count, fs_crammed, gainful);
+  SPIFFS_CHECK_RES(res);
+  if (count == 0) {
+    return SPIFFS_ERR_NO_DELETED_BLOCKS;
+  }
+#if SPIFFS_GC_STATS
+  fs->stats_gc_runs++;
+#endif
+  cand = cands[0];
+  fs->cleaning = 1;
+  //SPIFFS_GC_DBG("gcing: cleaning block "_SPIPRIi"\n", cand);
+  res = spiffs_gc_clean(fs, cand);
+  fs->cleaning = 0;
+  SPIFFS_GC_DBG("gc_check: cleaning block "_SPIPRIi", result "_SPIPRIi"\n", cand, res);
+  SPIFFS_CHECK_RES(res);
+
+  res = spiffs_gc_erase_page_stats(fs, cand);
+  SPIFFS_CHECK_RES(res);
+
+  return spiffs_gc_erase_block(fs, cand);
+}
+
 // Checks if garbage collecting is necessary. If so a candidate block is found,
 // cleansed and erased
 s32_t spiffs_gc_check(
@@ -136,36 +170,13 @@ s32_t spiffs_gc_check(
         fs->free_blocks, free_pages, fs->stats_p_allocated, fs->stats_p_deleted, (free_pages+fs->stats_p_allocated+fs->stats_p_deleted),
         len, (u32_t)(free_pages*SPIFFS_DATA_PAGE_SIZE(fs)));
 
-    spiffs_block_ix *cands;
-    int count;
-    spiffs_block_ix cand;
     s32_t prev_free_pages = free_pages;
     // if the fs is crammed, ignore block age when selecting candidate - kind of a bad state
-    res = spiffs_gc_find_candidate(fs, &cands, &count, free_pages <= 0);
-    SPIFFS_CHECK_RES(res);
-    if (count == 0) {
+    res = spiffs_gc_clean_candidate(fs, free_pages <= 0, 0);
+    if (res == SPIFFS_ERR_NO_DELETED_BLOCKS) {
       SPIFFS_GC_DBG("gc_check: no candidates, return\n");
       return (s32_t)needed_pages < free_pages ? SPIFFS_OK : SPIFFS_ERR_FULL;
     }
-#if SPIFFS_GC_STATS
-    fs->stats_gc_runs++;
-#endif
-    cand = cands[0];
-    fs->cleaning = 1;
-    //SPIFFS_GC_DBG("gcing: cleaning block "_SPIPRIi"\n", cand);
-    res = spiffs_gc_clean(fs, cand);
-    fs->cleaning = 0;
-    if (res < 0) {
-      SPIFFS_GC_DBG("gc_check: cleaning block "_SPIPRIi", result "_SPIPRIi"\n", cand, res);
-    } else {
-      SPIFFS_GC_DBG("gc_check: cleaning block "_SPIPRIi", result "_SPIPRIi"\n", cand, res);
-    }
-    SPIFFS_CHECK_RES(res);
-
-    res = spiffs_gc_erase_page_stats(fs, cand);
-    SPIFFS_CHECK_RES(res);
-
-    res = spiffs_gc_erase_block(fs, cand);
     SPIFFS_CHECK_RES(res);
 
     free_pages =
@@ -237,7 +248,8 @@ s32_t spiffs_gc_find_candidate(
     spiffs *fs,
     spiffs_block_ix **block_candidates,
     int *candidate_count,
-    char fs_crammed) {
+    char fs_crammed,
+    char gainful) {
   s32_t res = SPIFFS_OK;
   u32_t blocks = fs->block_count;
   spiffs_block_ix cur_block = 0;
@@ -294,7 +306,10 @@ s32_t spiffs_gc_find_candidate(
 
     // calculate score and insert into candidate table
     // stoneage sort, but probably not so many blocks
-    if (res == SPIFFS_OK && deleted_pages_in_block > 0) {
+    // with gainful set, leave out blocks where moving the used pages
+    // costs more free pages than erasing the block wins
+    if (res == SPIFFS_OK && deleted_pages_in_block > 0 &&
+        (!gainful || deleted_pages_in_block > used_pages_in_block)) {
       // read erase count
       spiffs_obj_id erase_count;
       res = _spiffs_rd(fs, SPIFFS_OP_C_READ | SPIFFS_OP_T_OBJ_LU2, 0,
@@ -605,6 +605,12 @@ s32_t SPIFFS_lseek(spiffs *fs, spiffs_file fh, s32_t offs, int whence) {
 
   spiffs_span_ix data_spix = offs / SPIFFS_DATA_PAGE_SIZE(fs);
   spiffs_span_ix objix_spix = SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, data_spix);
+#if SPIFFS_IX_MAP
+  // reading a mapped page needs no object index, the read finds it otherwise
+  if (fd->ix_map && data_spix >= fd->ix_map->start_spix && data_spix <= fd->ix_map->end_spix) {
+    objix_spix = fd->cursor_objix_spix;
+  }
+#endif
   if (fd->cursor_objix_spix != objix_spix) {
     spiffs_page_ix pix;
     res = spiffs_obj_lu_find_id_and_span(
@@ -1144,6 +1150,42 @@ s32_t SPIFFS_gc(spiffs *fs, u32_t size) {
 #endif // SPIFFS_READ_ONLY
 }
 
+s32_t SPIFFS_gc_step(spiffs *fs) {
+#if SPIFFS_READ_ONLY
+  (void)fs;
+  return SPIFFS_ERR_RO_NOT_IMPL;
+#else
+  s32_t res;
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  u32_t pages_per_block = SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs);
+  u32_t used_blocks = (fs->stats_p_allocated + pages_per_block - 1) / pages_per_block;
+  u32_t free_blocks = fs->free_blocks;
+  u32_t dirty_pages = fs->stats_p_allocated + fs->stats_p_deleted;
+
+  if (free_blocks + used_blocks + 1 >= fs->block_count) {
+    // as many free blocks as the used pages leave room for
+    res = SPIFFS_ERR_NO_DELETED_BLOCKS;
+  } else {
+    res = spiffs_gc_quick(fs, 0);
+    if (res == SPIFFS_ERR_NO_DELETED_BLOCKS) {
+      res = spiffs_gc_clean_candidate(fs, 0, 1);
+    }
+  }
+  if (res == SPIFFS_OK && fs->free_blocks <= free_blocks &&
+      fs->stats_p_allocated + fs->stats_p_deleted >= dirty_pages) {
+    // the moves used up what the erase won, going on only wears the flash
+    res = SPIFFS_ERR_NO_DELETED_BLOCKS;
+  }
+
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_UNLOCK(fs);
+  return 0;
+#endif // SPIFFS_READ_ONLY
+}
+
 s32_t SPIFFS_eof(spiffs *fs, spiffs_file fh) {
   s32_t res;
   SPIFFS_API_CHECK_CFG(fs);
@@ -1282,9 +1324,9 @@ s32_t SPIFFS_ix_remap(spiffs *fs, spiffs_file fh, u32_t offset) {
     const s32_t vec_len = map->end_spix - map->start_spix + 1; // spix range includes last
     map->start_spix += spix_diff;
     map->end_spix += spix_diff;
-    if (spix_diff >= vec_len) {
+    if (spix_diff >= vec_len || -spix_diff >= vec_len) {
       // moving beyond range
-      memset(&map->map_buf, 0, vec_len * sizeof(spiffs_page_ix));
+      memset(&map->map_buf[0], 0, vec_len * sizeof(spiffs_page_ix));
       // populate_ix_map is inclusive
       res = spiffs_populate_ix_map(fs, fd, 0, vec_len-1);
       SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
@@ -729,7 +729,8 @@ s32_t spiffs_gc_find_candidate(
     spiffs *fs,
     spiffs_block_ix **block_candidate,
     int *candidate_count,
-    char fs_crammed);
+    char fs_crammed,
+    char gainful);
 
 s32_t spiffs_gc_clean(
     spiffs *fs,
@@ -738,6 +739,11 @@ s32_t spiffs_gc_clean(
 s32_t spiffs_gc_quick(
     spiffs *fs, u16_t max_free_pages);
 
+s32_t spiffs_gc_clean_candidate(
+    spiffs *fs,
+    char fs_crammed,
+    char gainful);
+
 // ---------------
 
 s32_t spiffs_fd_find_new(
@@ -21,6 +21,7 @@
 LOCAL os_event_t *task_Q[TASK_PRIORITY_COUNT];
 LOCAL task_callback_t *task_func;
 LOCAL int task_count;
+LOCAL task_hook_t task_hook;
 
 LOCAL void task_dispatch (os_event_t *e) {
   task_handle_t handle = e->sig;
@@ -30,6 +31,8 @@ LOCAL void task_dispatch (os_event_t *e) {
     if ( priority <= TASK_PRIORITY_HIGH && task_func && entry < task_count ){
       /* call the registered task handler with the specified parameter and priority */
       task_func[entry](e->par, priority);
+      if (task_hook)
+        task_hook();
       return;
     }
   }
@@ -70,3 +73,11 @@ task_handle_t task_get_id(task_callback_t t) {
   task_func[task_count++] = t;
   return TASK_HANDLE_MONIKER + ((task_count-1)  << TASK_HANDLE_SHIFT);
 }
+
+/*
+ * Set a function to be called after each dispatched task, or NULL for none.
+ * The Lua GC uses this to do its incremental work between callbacks.
+ */
+void task_set_dispatch_hook(task_hook_t hook) {
+  task_hook = hook;
+}
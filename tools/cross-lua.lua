@@ -24,7 +24,7 @@ local lua_files = [[
     lfunc.c lgc.c llex.c lmathlib.c lmem.c loadlib.c lobject.c lopcodes.c  
     lparser.c lrotable.c lstate.c lstring.c lstrlib.c ltable.c ltablib.c 
     ltm.c  lundump.c lvm.c lzio.c 
-    luac_cross/luac.c luac_cross/loslib.c luac_cross/print.c
+    luac_cross/luac.c luac_cross/loslib.c luac_cross/print.c luac_cross/optimize.c
     ../modules/linit.c
     ../libc/c_stdlib.c
   ]]
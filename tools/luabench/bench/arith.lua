@@ -0,0 +1,21 @@
+-- Integer arithmetic: counters, nested loops, indexing and a checksum
+local N = 256
+
+return {
+  ops = 200,
+  run = function(ops)
+    local t = {}
+    for j = 1, N do t[j] = j end
+    for i = 1, ops do
+      local sum, n = 0, 0
+      for j = 1, N do
+        local v = t[j]
+        for k = 1, 8 do
+          if v % 2 == 1 then v = (v - 1) / 2 + 40961 else v = v / 2 end
+        end
+        sum = (sum * 31 + v) % 65521
+        if j % 3 == 0 then n = n + j * 2 - 1 end
+      end
+    end
+  end
+}
@@ -0,0 +1,15 @@
+-- Integer arrays: fill, sum and sort a buffer of samples
+local N = 512
+
+return {
+  ops = 200,
+  run = function(ops)
+    for i = 1, ops do
+      local t = {}
+      for j = 1, N do t[j] = (j * 7919) % 1021 end
+      local s = 0
+      for j = 1, #t do s = s + t[j] end
+      table.sort(t)
+    end
+  end
+}
@@ -0,0 +1,22 @@
+-- Closure heavy callbacks: each event creates a closure capturing locals
+-- and passes it through a small dispatcher, like net and tmr callbacks.
+local function dispatch(handlers, event, arg)
+  local h = handlers[event]
+  if h then return h(arg) end
+end
+
+return {
+  ops = 20000,
+  run = function(ops)
+    local total = 0
+    local handlers = {}
+    for i = 1, ops do
+      local seen = i
+      handlers.data = function(d) total = total + d + seen end
+      handlers.sent = function() seen = seen - 1 end
+      dispatch(handlers, "data", i)
+      dispatch(handlers, "sent")
+    end
+    return total
+  end
+}
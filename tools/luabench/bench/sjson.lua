@@ -0,0 +1,17 @@
+-- sjson encode and decode of a small nested document.
+local doc = {
+  id = 42, name = "sensor", enabled = true,
+  readings = { 1.5, 2.25, 3.125, 4, 5 },
+  config = { interval = 60, unit = "C", thresholds = { low = 10, high = 30 } },
+}
+
+return {
+  ops = 2000,
+  run = function(ops)
+    for i = 1, ops do
+      local s = sjson.encode(doc)
+      local t = sjson.decode(s)
+      assert(t.config.thresholds.high == 30)
+    end
+  end
+}
@@ -0,0 +1,16 @@
+-- String building: concatenation of short pieces, table.concat of the
+-- same pieces and string.format, which all intern new strings.
+return {
+  ops = 5000,
+  run = function(ops)
+    local parts = {}
+    for i = 1, ops do
+      local s = "key" .. i .. "=" .. (i * 3) .. ";"
+      parts[i % 32 + 1] = s
+      if i % 32 == 0 then
+        s = table.concat(parts)
+      end
+      s = string.format("%s:%d:%s", "item", i, s:sub(1, 4))
+    end
+  end
+}
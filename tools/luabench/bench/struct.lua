@@ -0,0 +1,11 @@
+-- struct.pack and struct.unpack of a fixed binary record.
+return {
+  ops = 10000,
+  run = function(ops)
+    for i = 1, ops do
+      local s = struct.pack("<I2I4hBc8", i % 65536, i, -i % 32768, i % 256, "payload!")
+      local a, b, c, d, e = struct.unpack("<I2I4hBc8", s)
+      assert(b == i)
+    end
+  end
+}
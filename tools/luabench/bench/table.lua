@@ -0,0 +1,17 @@
+-- Table churn: create, fill, read back and drop small tables with array
+-- and hash parts, as callbacks building records do.
+return {
+  ops = 20000,
+  run = function(ops)
+    local keep = {}
+    for i = 1, ops do
+      local t = { i, i + 1, i + 2, name = "rec", id = i }
+      t.value = t[1] + t[2] + t[3]
+      t[4] = t.id
+      keep[i % 64 + 1] = t
+    end
+    local sum = 0
+    for _, t in pairs(keep) do sum = sum + t.value end
+    return sum
+  end
+}
@@ -0,0 +1,9 @@
+/*
+ * Host replacement for app/libc/c_string.h, which pulls in the SDK headers.
+ */
+#ifndef _C_STRING_H_
+#define _C_STRING_H_
+
+#include <string.h>
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Host benchmark driver for the NodeMCU Lua VM.
+ *
+ * The VM, the builtin libraries and a few modules are compiled from app/ with
+ * the firmware's memory settings (see Makefile).  Each script named on the
+ * command line must return a table
+ *
+ *   { ops = <number of operations per run>, run = function(ops) ... end }
+ *
+ * and is run the requested number of times, in a Lua state of its own so
+ * that no script sees the heap another left behind.  For each script the
+ * driver reports operations per second, the peak Lua heap and the number of
+ * incremental GC steps taken.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lstate.h"
+#include "legc.h"
+
+unsigned long luabench_gcsteps;
+
+static lua_Alloc l_alloc;
+static void *l_alloc_ud;
+static size_t heap_used, heap_peak;
+
+/* Wrap the firmware allocator, so that emergency GC still applies */
+static void *bench_alloc (void *ud, void *ptr, size_t osize, size_t nsize)
+{
+  void *nptr = l_alloc(l_alloc_ud, ptr, osize, nsize);
+  if (nptr != NULL || nsize == 0) {
+    heap_used += nsize - osize;
+    if (heap_used > heap_peak)
+      heap_peak = heap_used;
+  }
+  return nptr;
+}
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage (void)
+{
+  fprintf(stderr,
+    "Usage: luabench [-r runs] [-e egcmode] [-m memlimit] script.lua...\n"
+    "  -r runs      number of timed runs of each script (default 5)\n"
+    "  -e egcmode   emergency GC mode, as for node.egc.setmode() (default 0)\n"
+    "  -m memlimit  EGC memory limit in bytes (default 0)\n");
+  exit(1);
+}
+
+static lua_State *new_state (int egcmode, int memlimit)
+{
+  lua_State *L = luaL_newstate();
+  l_alloc = lua_getallocf(L, &l_alloc_ud);
+  heap_used = lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+  lua_setallocf(L, bench_alloc, NULL);
+  G(L)->egcmode = egcmode;     /* as legc_set_mode(), which needs the SDK */
+  G(L)->memlimit = memlimit;
+  luaL_openlibs(L);
+  return L;
+}
+
+static int bench (lua_State *L, const char *script, int runs)
+{
+  unsigned long steps;
+  double start, elapsed;
+  lua_Number ops;
+  int i;
+
+  if (luaL_loadfile(L, script) || lua_pcall(L, 0, 1, 0))
+    goto error;
+  lua_getfield(L, -1, "ops");
+  ops = lua_tonumber(L, -1);
+  lua_getfield(L, -2, "run");
+  if (ops <= 0 || !lua_isfunction(L, -1)) {
+    fprintf(stderr, "%s: must return { ops = n, run = function }\n", script);
+    return 1;
+  }
+
+  /* warm up once, then start every script from a fully collected heap */
+  lua_pushvalue(L, -1);
+  lua_pushnumber(L, ops);
+  if (lua_pcall(L, 1, 0, 0))
+    goto error;
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  heap_peak = heap_used;
+  steps = luabench_gcsteps;
+
+  start = now();
+  for (i = 0; i < runs; i++) {
+    lua_pushvalue(L, -1);
+    lua_pushnumber(L, ops);
+    if (lua_pcall(L, 1, 0, 0))
+      goto error;
+  }
+  elapsed = now() - start;
+
+  printf("%-24s %12.0f %10u %10lu\n", script,
+         ops * runs / elapsed, (unsigned) heap_peak, luabench_gcsteps - steps);
+  return 0;
+
+error:
+  fprintf(stderr, "%s: %s\n", script, lua_tostring(L, -1));
+  return 1;
+}
+
+int main (int argc, char *argv[])
+{
+  int runs = 5, egcmode = 0, memlimit = 0, failed = 0;
+  lua_State *L;
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (i + 1 == argc)
+      usage();
+    switch (argv[i][1]) {
+      case 'r': runs = atoi(argv[++i]); break;
+      case 'e': egcmode = atoi(argv[++i]); break;
+      case 'm': memlimit = atoi(argv[++i]); break;
+      default: usage();
+    }
+  }
+  if (i == argc || runs <= 0)
+    usage();
+
+  printf("%-24s %12s %10s %10s\n", "benchmark", "ops/sec", "peak heap", "GC steps");
+  for (; i < argc; i++) {
+    L = new_state(egcmode, memlimit);
+    failed |= bench(L, argv[i], runs);
+    lua_close(L);
+  }
+  return failed;
+}
@@ -0,0 +1,11 @@
+/*
+ * Forced include for every file of the host benchmark build; see Makefile.
+ */
+#ifndef _LUABENCH_H_
+#define _LUABENCH_H_
+
+extern unsigned long luabench_gcsteps;
+
+#define luai_gcstep(L)  ((void)(L), luabench_gcsteps++)
+
+#endif
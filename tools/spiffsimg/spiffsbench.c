@@ -0,0 +1,665 @@
+/*
+ * spiffsbench - replay file system workloads on a simulated NOR flash
+ *
+ * Builds the SPIFFS sources from app/spiffs for the host, like spiffsimg,
+ * and mounts them on a RAM flash that keeps NOR semantics (programming can
+ * only clear bits), charges each read, page program and sector erase with
+ * a typical SPI NOR timing and counts the erases of every sector. Each
+ * workload starts on a freshly formatted file system and is reported as one
+ * line: throughput in simulated time, time spent in garbage collection,
+ * write amplification and wear. See README.md for the workload commands.
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <getopt.h>
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+
+// Timings of a W25Q32 class part as fitted to the ESP8266 (datasheet
+// typicals), in ns: SPI read setup and per byte, page program setup
+// (first byte) and per further byte, and 4 kB sector erase.
+static struct {
+  uint64_t read, read_byte, prog, prog_byte, erase;
+} nor = { 5000, 100, 30000, 2500, 45000000 };
+
+#define NOR_PAGE   256
+#define NOR_SECTOR 4096
+
+static uint8_t *flash;
+static uint32_t flash_size;
+static uint32_t *wear;
+
+static spiffs fs;
+static spiffs_config cfg;
+static u8_t *work_buf;
+static u8_t fds[sizeof(spiffs_fd) * SPIFFS_MAX_OPEN_FILES];
+static u8_t *cache_buf;
+static u32_t cache_bytes;
+static u32_t ix_map_budget = SPIFFS_IX_MAP_BUDGET;
+static u32_t gc_reserve = SPIFFS_GC_RESERVE;
+static int verbose = 0;
+
+// simulated clock and flash counters
+static uint64_t now_ns;
+static uint64_t flash_read_bytes, flash_prog_bytes;
+static uint32_t violations;
+// time inside the garbage collector, tracked through the --wrap'ed entries
+static int gc_depth;
+static uint64_t gc_ns;
+
+static struct {
+  uint64_t t0, gc0;
+  uint64_t rd_ns, wr_ns, idle_ns, max_ns;
+  uint64_t user_rd, user_wr, flash_rd0, flash_wr0;
+  uint32_t ops, full, errors, gc_runs0, hits0, misses0;
+} run;
+
+// number of files created by the last fill, for churn and rm
+static uint32_t filled;
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd (void)
+{
+  // a fixed generator keeps the results comparable between hosts
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return rnd_state >> 8;
+}
+
+
+static s32_t nor_read (u32_t addr, u32_t size, u8_t *dst)
+{
+  memcpy (dst, flash + addr, size);
+  now_ns += nor.read + size * nor.read_byte;
+  flash_read_bytes += size;
+  return SPIFFS_OK;
+}
+
+static s32_t nor_write (u32_t addr, u32_t size, u8_t *src)
+{
+  while (size)
+  {
+    // a page program does not cross a 256 byte flash page
+    u32_t n = NOR_PAGE - addr % NOR_PAGE;
+    if (n > size)
+      n = size;
+    for (u32_t i = 0; i < n; i++)
+    {
+      // spiffs clears the flags of a page header by writing the whole byte
+      if ((~flash[addr + i] & src[i]) &&
+          (addr + i) % cfg.log_page_size != offsetof (spiffs_page_header, flags))
+        violations++;
+      flash[addr + i] &= src[i];
+    }
+    now_ns += nor.prog + (n - 1) * nor.prog_byte;
+    flash_prog_bytes += n;
+    addr += n;
+    src += n;
+    size -= n;
+  }
+  return SPIFFS_OK;
+}
+
+static s32_t nor_erase (u32_t addr, u32_t size)
+{
+  for (u32_t a = addr & ~(NOR_SECTOR - 1); a < addr + size; a += NOR_SECTOR)
+  {
+    memset (flash + a, 0xff, NOR_SECTOR);
+    wear[a / NOR_SECTOR]++;
+    now_ns += nor.erase;
+  }
+  return SPIFFS_OK;
+}
+
+
+#define GC_WRAP(fn, params, args) \
+  s32_t __real_##fn params; \
+  s32_t __wrap_##fn params { \
+    uint64_t t0 = now_ns; \
+    gc_depth++; \
+    s32_t res = __real_##fn args; \
+    if (--gc_depth == 0) \
+      gc_ns += now_ns - t0; \
+    return res; \
+  }
+
+GC_WRAP(spiffs_gc_check, (spiffs *fs, u32_t len), (fs, len))
+GC_WRAP(spiffs_gc_quick, (spiffs *fs, u16_t max_free_pages), (fs, max_free_pages))
+GC_WRAP(spiffs_gc_clean_candidate, (spiffs *fs, char fs_crammed, char gainful), (fs, fs_crammed, gainful))
+
+
+static void die (const char *what)
+{
+  fprintf (stderr, "%s: fatal error %d\n", what, SPIFFS_errno (&fs));
+  exit (1);
+}
+
+
+static void reset_counters (void)
+{
+  memset (&run, 0, sizeof (run));
+  memset (wear, 0, flash_size / NOR_SECTOR * sizeof (*wear));
+  run.t0 = now_ns;
+  run.gc0 = gc_ns;
+  run.flash_rd0 = flash_read_bytes;
+  run.flash_wr0 = flash_prog_bytes;
+#if SPIFFS_GC_STATS
+  run.gc_runs0 = fs.stats_gc_runs;
+#endif
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+  run.hits0 = fs.cache_hits;
+  run.misses0 = fs.cache_misses;
+#endif
+}
+
+
+static void mount (void)
+{
+  memset (flash, 0xff, flash_size);
+  now_ns = 0;
+  if (SPIFFS_mount (&fs, &cfg, work_buf, fds, sizeof (fds), cache_buf, cache_bytes, 0) == 0)
+    die ("spiffs_mount of an erased flash");
+  if (SPIFFS_format (&fs) != 0)
+    die ("spiffs_format");
+  if (SPIFFS_mount (&fs, &cfg, work_buf, fds, sizeof (fds), cache_buf, cache_bytes, 0) != 0)
+    die ("spiffs_mount");
+  violations = 0;
+  reset_counters ();
+}
+
+
+// Each API call is an operation; the slowest one is the worst stall a
+// caller sees, typically a write that had to collect garbage first.
+static uint64_t op_start;
+
+static void op_begin (void)
+{
+  op_start = now_ns;
+}
+
+static s32_t op_end (s32_t res)
+{
+  uint64_t t = now_ns - op_start;
+  run.ops++;
+  if (t > run.max_ns)
+    run.max_ns = t;
+  if (res == SPIFFS_ERR_FULL)
+    run.full++;
+  else if (res < 0 && res != SPIFFS_ERR_END_OF_OBJECT && res != SPIFFS_ERR_NOT_FOUND)
+  {
+    if (verbose)
+      fprintf (stderr, "spiffs error %d\n", (int)res);
+    run.errors++;
+  }
+  return res;
+}
+
+// File contents are a function of the name and the offset, so that reads
+// can check what they get back.
+static uint8_t pattern (uint32_t h, uint32_t offs)
+{
+  return (uint8_t)(h + offs * 13 + (offs >> 8));
+}
+
+static uint32_t name_hash (const char *name)
+{
+  uint32_t h = 5381;
+  while (*name)
+    h = h * 33 + (uint8_t)*name++;
+  return h;
+}
+
+
+static void put (const char *name, uint32_t bytes, uint32_t chunk, bool append)
+{
+  uint8_t buf[4096];
+  uint32_t h = name_hash (name);
+  spiffs_stat st;
+
+  if (chunk == 0 || chunk > sizeof (buf))
+    chunk = 256;
+  op_begin ();
+  spiffs_file fh = op_end (SPIFFS_open (&fs, name, SPIFFS_WRONLY | SPIFFS_CREAT |
+                                        (append ? SPIFFS_APPEND : SPIFFS_TRUNC), 0));
+  if (fh < 0)
+    return;
+  uint32_t offs = 0;
+  if (append && SPIFFS_fstat (&fs, fh, &st) == SPIFFS_OK)
+    offs = st.size;
+  while (bytes)
+  {
+    uint32_t n = bytes < chunk ? bytes : chunk;
+    for (uint32_t i = 0; i < n; i++)
+      buf[i] = pattern (h, offs + i);
+    op_begin ();
+    if (op_end (SPIFFS_write (&fs, fh, buf, n)) < 0)
+      break;
+    run.user_wr += n;
+    offs += n;
+    bytes -= n;
+  }
+  op_begin ();
+  op_end (SPIFFS_close (&fs, fh));
+}
+
+
+// Opens for reading and maps the object index as the firmware does, when
+// the file outgrows its index header and the map budget covers it all.
+static spiffs_file open_read (const char *name, spiffs_ix_map *map, spiffs_page_ix *ix)
+{
+  spiffs_stat st;
+
+  op_begin ();
+  spiffs_file fh = op_end (SPIFFS_open (&fs, name, SPIFFS_RDONLY, 0));
+  if (fh < 0)
+    return fh;
+#if SPIFFS_IX_MAP
+  if (SPIFFS_fstat (&fs, fh, &st) == SPIFFS_OK &&
+      st.size > (u32_t)(SPIFFS_OBJ_HDR_IX_LEN(&fs) * SPIFFS_DATA_PAGE_SIZE(&fs)) &&
+      (u32_t)SPIFFS_bytes_to_ix_map_entries (&fs, st.size) <= ix_map_budget / sizeof (spiffs_page_ix))
+  {
+    op_begin ();
+    op_end (SPIFFS_ix_map (&fs, fh, map, 0, st.size, ix));
+  }
+#endif
+  return fh;
+}
+
+static bool check (const char *name, uint32_t offs, const uint8_t *buf, s32_t n)
+{
+  uint32_t h = name_hash (name);
+  for (s32_t i = 0; i < n; i++)
+    if (buf[i] != pattern (h, offs + i))
+    {
+      fprintf (stderr, "%s: bad data at offset %u\n", name, offs + i);
+      run.errors++;
+      return false;
+    }
+  return true;
+}
+
+// Reads count blocks of len bytes at random offsets, or the whole file in
+// len byte reads when count is 0.
+static void get (const char *name, uint32_t count, uint32_t len)
+{
+  uint8_t buf[4096];
+  spiffs_ix_map map;
+  spiffs_page_ix ix[ix_map_budget / sizeof (spiffs_page_ix) + 1];
+  spiffs_stat st;
+
+  if (len == 0 || len > sizeof (buf))
+    len = 256;
+  spiffs_file fh = open_read (name, &map, ix);
+  if (fh < 0)
+    return;
+  if (count == 0)
+  {
+    uint32_t offs = 0;
+    s32_t n;
+    do {
+      op_begin ();
+      n = op_end (SPIFFS_read (&fs, fh, buf, len));
+      if (n > 0 && check (name, offs, buf, n))
+      {
+        run.user_rd += n;
+        offs += n;
+      }
+    } while (n == (s32_t)len);
+  }
+  else if (SPIFFS_fstat (&fs, fh, &st) == SPIFFS_OK && st.size >= len)
+  {
+    while (count--)
+    {
+      uint32_t offs = rnd () % (st.size - len + 1);
+      op_begin ();
+      op_end (SPIFFS_lseek (&fs, fh, offs, SPIFFS_SEEK_SET));
+      op_begin ();
+      s32_t n = op_end (SPIFFS_read (&fs, fh, buf, len));
+      if (n > 0 && check (name, offs, buf, n))
+        run.user_rd += n;
+    }
+  }
+  op_begin ();
+  op_end (SPIFFS_close (&fs, fh));
+}
+
+
+static void rm (const char *name)
+{
+  op_begin ();
+  op_end (SPIFFS_remove (&fs, name));
+}
+
+static void rm_all (const char *prefix, uint32_t files)
+{
+  char name[SPIFFS_OBJ_NAME_LEN + 12];
+
+  if (!files)
+    files = filled;
+  for (uint32_t i = 0; i < files; i++)
+  {
+    snprintf (name, sizeof (name), "%s%u", prefix, i);
+    rm (name);
+  }
+}
+
+// Creates prefix0, prefix1, ... of bytes each until percent of the file
+// system is used or it is full.
+static void fill (const char *prefix, uint32_t bytes, uint32_t percent)
+{
+  char name[SPIFFS_OBJ_NAME_LEN + 12];
+  u32_t total, used;
+
+  filled = 0;
+  for (uint32_t i = 0; SPIFFS_info (&fs, &total, &used) == SPIFFS_OK &&
+                  (uint64_t)used * 100 < (uint64_t)total * percent; i++)
+  {
+    uint32_t full = run.full;
+    snprintf (name, sizeof (name), "%s%u", prefix, i);
+    put (name, bytes, 1024, false);
+    if (run.full != full)
+    {
+      run.full = full;
+      rm (name);
+      break;
+    }
+    filled++;
+  }
+}
+
+// Runs the idle garbage collector of the firmware until the reserve of
+// free blocks is met or it finds nothing worth collecting, which must come
+// within steps steps.
+static void idle (uint32_t steps)
+{
+  uint64_t t0 = now_ns;
+  while (fs.free_blocks < gc_reserve)
+  {
+    if (SPIFFS_gc_step (&fs) != SPIFFS_OK)
+      break;
+    if (!--steps)
+    {
+      fprintf (stderr, "idle: collector still erasing after all steps\n");
+      run.errors++;
+      break;
+    }
+  }
+  SPIFFS_clearerr (&fs);
+  run.idle_ns += now_ns - t0;
+}
+
+// Rewrites a random one of prefix0 .. prefix<files-1> rounds times, with
+// the idle garbage collector run between the rewrites when asked for.
+static void churn (const char *prefix, uint32_t files, uint32_t bytes, uint32_t rounds, bool gc)
+{
+  char name[SPIFFS_OBJ_NAME_LEN + 12];
+
+  if (!files)
+    files = filled;
+  while (files && rounds--)
+  {
+    snprintf (name, sizeof (name), "%s%u", prefix, rnd () % files);
+    uint64_t t0 = now_ns;
+    put (name, bytes, 1024, false);
+    run.wr_ns += now_ns - t0;
+    if (gc)
+      idle (~0u);
+  }
+}
+
+
+static double kbps (uint64_t bytes, uint64_t ns)
+{
+  return ns ? bytes * 1e9 / 1024 / ns : 0;
+}
+
+static void header (void)
+{
+  printf ("%-12s %-12s %8s %8s %8s %5s %8s %5s %6s %5s %6s %5s %4s\n",
+          "config", "workload", "wr KB/s", "rd KB/s", "gc ms", "gc%", "max ms",
+          "WA", "erases", "wear", "avg", "hit%", "full");
+}
+
+static int report (const char *config, const char *workload)
+{
+  uint64_t busy = run.rd_ns + run.wr_ns;
+  uint64_t fg_gc = gc_ns - run.gc0;
+  uint32_t sectors = flash_size / NOR_SECTOR, erases = 0, max_wear = 0;
+  uint32_t hits = 0, misses = 0;
+
+  for (uint32_t i = 0; i < sectors; i++)
+  {
+    erases += wear[i];
+    if (wear[i] > max_wear)
+      max_wear = wear[i];
+  }
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+  hits = fs.cache_hits - run.hits0;
+  misses = fs.cache_misses - run.misses0;
+#endif
+  // idle collection is not charged to the foreground operations
+  fg_gc = fg_gc > run.idle_ns ? fg_gc - run.idle_ns : 0;
+  printf ("%-12s %-12s %8.1f %8.1f %8.1f %5.1f %8.1f %5.2f %6u %5u %6.2f %5.1f %4u\n",
+          config, workload,
+          kbps (run.user_wr, run.wr_ns), kbps (run.user_rd, run.rd_ns),
+          fg_gc / 1e6, busy ? fg_gc * 100.0 / busy : 0, run.max_ns / 1e6,
+          run.user_wr ? (double)(flash_prog_bytes - run.flash_wr0) / run.user_wr : 0,
+          erases, max_wear, (double)erases / sectors,
+          hits + misses ? hits * 100.0 / (hits + misses) : 0, run.full);
+  if (verbose)
+    printf ("  %u ops, %.1f s busy, %.1f s idle, %llu/%llu bytes read from/programmed to flash, %u gc runs\n",
+            run.ops, busy / 1e9, run.idle_ns / 1e9,
+            (unsigned long long)(flash_read_bytes - run.flash_rd0),
+            (unsigned long long)(flash_prog_bytes - run.flash_wr0),
+#if SPIFFS_GC_STATS
+            fs.stats_gc_runs - run.gc_runs0
+#else
+            0
+#endif
+            );
+
+  int res = 0;
+  if (run.errors)
+  {
+    fprintf (stderr, "%s: %u errors\n", workload, run.errors);
+    res = 1;
+  }
+  if (violations)
+  {
+    fprintf (stderr, "%s: %u bytes programmed from 0 to 1\n", workload, violations);
+    res = 1;
+  }
+  if (SPIFFS_check (&fs) != SPIFFS_OK)
+  {
+    fprintf (stderr, "%s: SPIFFS_check failed %d\n", workload, SPIFFS_errno (&fs));
+    res = 1;
+  }
+  return res;
+}
+
+
+static int replay (const char *config, const char *fname)
+{
+  FILE *in = fopen (fname, "r");
+  if (!in)
+  {
+    perror (fname);
+    return 1;
+  }
+  const char *workload = strrchr (fname, '/') ? strrchr (fname, '/') + 1 : fname;
+
+  mount ();
+  char line[128];
+  int lineno = 0, res = 0;
+  while (fgets (line, sizeof (line), in))
+  {
+    char cmd[16], name[SPIFFS_OBJ_NAME_LEN];
+    unsigned a = 0, b = 0, c = 0, d = 0;
+    lineno++;
+    char *p = line;
+    while (isspace ((unsigned char)*p))
+      p++;
+    if (!*p || *p == '#')
+      continue;
+    int n = sscanf (p, "%15s %31s %u %u %u %u", cmd, name, &a, &b, &c, &d);
+    uint64_t t0 = now_ns;
+    uint64_t *busy = &run.wr_ns;
+
+    if ((strcmp (cmd, "create") == 0 || strcmp (cmd, "append") == 0) && n >= 3)
+    {
+      // open, write and close c times
+      for (unsigned i = 0; i < (n >= 5 ? c : 1); i++)
+        put (name, a, b, cmd[0] == 'a');
+    }
+    else if (strcmp (cmd, "read") == 0 && n >= 2)
+    {
+      get (name, 0, a);
+      busy = &run.rd_ns;
+    }
+    else if (strcmp (cmd, "seek") == 0 && n >= 4)
+    {
+      get (name, a, b);
+      busy = &run.rd_ns;
+    }
+    else if (strcmp (cmd, "rm") == 0 && n >= 2)
+    {
+      if (n >= 3)
+        rm_all (name, a);
+      else
+        rm (name);
+    }
+    else if (strcmp (cmd, "fill") == 0 && n >= 4)
+      fill (name, a, b);
+    else if (strcmp (cmd, "churn") == 0 && n >= 5)
+    {
+      // accounts its own time, leaving out the idle collection
+      churn (name, a, b, c, n >= 6 && d);
+      busy = NULL;
+    }
+    else if (strcmp (cmd, "idle") == 0)
+    {
+      idle (n >= 2 ? strtoul (name, 0, 0) : ~0u);
+      busy = NULL;
+    }
+    else if (strcmp (cmd, "reset") == 0)
+    {
+      reset_counters ();
+      busy = NULL;
+    }
+    else
+    {
+      fprintf (stderr, "%s:%d: SYNTAX ERROR: %s", fname, lineno, p);
+      res = 1;
+      break;
+    }
+    if (busy)
+      *busy += now_ns - t0;
+    if (verbose > 1)
+      printf ("  %-40.40s %10.1f ms\n", strtok (p, "\n"), (now_ns - t0) / 1e6);
+  }
+  fclose (in);
+
+  res |= report (config, workload);
+  SPIFFS_unmount (&fs);
+  return res;
+}
+
+
+static uint32_t getsize (const char *s)
+{
+  char *end = 0;
+  uint32_t val = strtoul (s, &end, 0);
+  if (*end == 'k' || *end == 'K')
+    val <<= 10;
+  else if (*end == 'm' || *end == 'M')
+    val <<= 20;
+  return val;
+}
+
+static void syntax (void)
+{
+  fprintf (stderr,
+    "Syntax: spiffsbench [-n config] [-S fssize] [-b blocksize] [-p pagesize] [-c cachepages]\n"
+    "                    [-x ixmapbudget] [-g gcreserve] [-s seed] [-t read,readbyte,prog,progbyte,erase]\n"
+    "                    [-q] [-v] workload...\n\n"
+  );
+  exit (1);
+}
+
+int main (int argc, char *argv[])
+{
+  const char *config = "default";
+  uint32_t block = 0, page = 256, cache_pages = SPIFFS_CACHE_PAGES;
+  bool show_header = true;
+  int opt;
+
+  flash_size = 1 << 20;
+  while ((opt = getopt (argc, argv, "n:S:b:p:c:x:g:s:t:qv")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n': config = optarg; break;
+      case 'S': flash_size = getsize (optarg); break;
+      case 'b': block = getsize (optarg); break;
+      case 'p': page = getsize (optarg); break;
+      case 'c': cache_pages = strtoul (optarg, 0, 0); break;
+      case 'x': ix_map_budget = getsize (optarg); break;
+      case 'g': gc_reserve = strtoul (optarg, 0, 0); break;
+      case 's': rnd_state = strtoul (optarg, 0, 0); break;
+      case 't':
+        if (sscanf (optarg, "%" SCNu64 ",%" SCNu64 ",%" SCNu64 ",%" SCNu64 ",%" SCNu64, &nor.read, &nor.read_byte,
+                    &nor.prog, &nor.prog_byte, &nor.erase) != 5)
+          syntax ();
+        break;
+      case 'q': show_header = false; break;
+      case 'v': verbose++; break;
+      default: syntax ();
+    }
+  }
+  if (optind == argc)
+    syntax ();
+
+  // the firmware uses 4 kB blocks for file systems of up to 128 kB
+  if (!block)
+    block = flash_size > 128 * 1024 ? 2 * NOR_SECTOR : NOR_SECTOR;
+  flash_size &= ~(block - 1);
+  if (flash_size < 4 * block || block % NOR_SECTOR)
+    die ("file system size and block size");
+
+  cfg.phys_size = flash_size;
+  cfg.phys_addr = 0;
+  cfg.phys_erase_block = NOR_SECTOR;
+  cfg.log_block_size = block;
+  cfg.log_page_size = page;
+  cfg.hal_read_f = nor_read;
+  cfg.hal_write_f = nor_write;
+  cfg.hal_erase_f = nor_erase;
+
+  flash = malloc (flash_size);
+  wear = calloc (flash_size / NOR_SECTOR, sizeof (*wear));
+  work_buf = malloc (2 * page);
+#if SPIFFS_CACHE
+  if (cache_pages < 1)
+    cache_pages = 1;
+  if (cache_pages > 32)
+    cache_pages = 32;
+  cache_bytes = sizeof (spiffs_cache) + cache_pages * (sizeof (spiffs_cache_page) + page) + sizeof (void *);
+  cache_buf = malloc (cache_bytes);
+#else
+  (void)cache_pages;
+#endif
+  if (!flash || !wear || !work_buf)
+    die ("malloc");
+
+  if (show_header)
+    header ();
+  int res = 0;
+  for (int i = optind; i < argc; i++)
+    res |= replay (config, argv[i]);
+  return res;
+}